@@ -0,0 +1,281 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+
+#include "actuator.h"
+#include "gpio_sequence.h"
+#include "gpio_table.h"
+#include "led_driver.h"
+#include "seq_window.h"
+
+static const char *TAG = "actuator";
+
+#define QUEUED_ACK      (1 << 0) // last command of a sequenced datagram: ack it once actuated
+#define QUEUED_ACK_ONLY (1 << 1) // no command, only an ack with `status`
+
+typedef struct {
+    proto_cmd_t cmd;
+    uint8_t flags;
+    uint8_t status;
+    uint16_t port;
+    uint32_t addr;
+    uint32_t seq;
+    int64_t rx_time;
+    int64_t enqueue_time;
+} queued_cmd_t;
+
+// Power-of-two microsecond buckets: [0] < 1 us, [1] < 2 us, ... [HIST_BUCKETS - 1] everything longer
+#define HIST_BUCKETS 16
+
+typedef struct {
+    const char *name;
+    uint32_t bucket[HIST_BUCKETS];
+} latency_hist_t;
+
+static QueueHandle_t s_queue;
+static const led_driver_t *s_led;
+static int s_ack_sock = -1;
+static seq_window_t s_window;
+static uint32_t s_dropped;
+static uint32_t s_duplicates;
+static uint32_t s_stale;
+
+static latency_hist_t s_hist_rx_enqueue = { .name = "rx->enqueue" };
+static latency_hist_t s_hist_enqueue_actuate = { .name = "enqueue->actuate" };
+static latency_hist_t s_hist_rx_actuate = { .name = "rx->actuate" };
+static uint32_t s_actuated;
+static uint32_t s_coalesced;
+
+static void hist_add(latency_hist_t *hist, int64_t us)
+{
+    int b = 0;
+    while (b < HIST_BUCKETS - 1 && us >= (1LL << b)) {
+        b++;
+    }
+    hist->bucket[b]++;
+}
+
+static void hist_report(latency_hist_t *hist)
+{
+    char line[256];
+    int pos = 0;
+
+    for (int b = 0; b < HIST_BUCKETS && pos < sizeof(line); b++) {
+        if (hist->bucket[b]) {
+            pos += snprintf(line + pos, sizeof(line) - pos, " <%lldus:%u",
+                            1LL << b, (unsigned)hist->bucket[b]);
+        }
+    }
+    ESP_LOGI(TAG, "%s%s", hist->name, pos ? line : " (empty)");
+    memset(hist->bucket, 0, sizeof(hist->bucket));
+}
+
+static void send_ack(const queued_cmd_t *item, int64_t now)
+{
+    uint8_t ack[PROTO_ACK_LEN];
+    struct sockaddr_in dest = {
+        .sin_family = AF_INET,
+        .sin_port = item->port,
+        .sin_addr.s_addr = item->addr,
+    };
+    uint32_t actuate_us = item->status == PROTO_ACK_OK ? (uint32_t)(now - item->rx_time) : 0;
+
+    size_t len = proto_encode_ack(ack, sizeof(ack), item->seq, item->status, actuate_us);
+    if (sendto(s_ack_sock, ack, len, 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+        ESP_LOGD(TAG, "Ack %u not sent: errno %d", (unsigned)item->seq, errno);
+    }
+}
+
+static void apply_command(const proto_cmd_t *cmd)
+{
+    ESP_LOGD(TAG, "op %d GPIO%d=%d", cmd->opcode, cmd->pin, cmd->value);
+    if (led_cmd_apply(s_led, cmd) != ESP_OK) {
+        ESP_LOGW(TAG, "op %d on GPIO%d failed", cmd->opcode, cmd->pin);
+    }
+}
+
+static void actuator_task(void *pvParameters)
+{
+    // Latest pending command per pin: when a backlog builds up, the last writer wins
+    static queued_cmd_t pending[GPIO_NUM_MAX];
+    static bool has_pending[GPIO_NUM_MAX];
+    // Acks are sent only after the whole batch has been actuated
+    static queued_cmd_t acks[ACTUATOR_QUEUE_LEN];
+    queued_cmd_t item;
+
+    while (1) {
+        int n_acks = 0;
+        int drained = 0;
+
+        xQueueReceive(s_queue, &item, portMAX_DELAY);
+        do {
+            if (item.flags & (QUEUED_ACK | QUEUED_ACK_ONLY)) {
+                acks[n_acks++] = item;
+            }
+            if (item.flags & QUEUED_ACK_ONLY) {
+                continue;
+            }
+            if (has_pending[item.cmd.pin]) {
+                s_coalesced++;
+            }
+            pending[item.cmd.pin] = item;
+            has_pending[item.cmd.pin] = true;
+        } while (++drained < ACTUATOR_QUEUE_LEN && xQueueReceive(s_queue, &item, 0) == pdTRUE);
+
+        for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+            if (!has_pending[pin]) {
+                continue;
+            }
+            has_pending[pin] = false;
+            apply_command(&pending[pin].cmd);
+
+            int64_t now = esp_timer_get_time();
+            hist_add(&s_hist_rx_enqueue, pending[pin].enqueue_time - pending[pin].rx_time);
+            hist_add(&s_hist_enqueue_actuate, now - pending[pin].enqueue_time);
+            hist_add(&s_hist_rx_actuate, now - pending[pin].rx_time);
+
+            if (++s_actuated == ACTUATOR_REPORT_EVERY) {
+                ESP_LOGI(TAG, "%u commands actuated, %u coalesced, %u dropped, %u duplicate, %u stale",
+                         (unsigned)s_actuated, (unsigned)s_coalesced, (unsigned)s_dropped,
+                         (unsigned)s_duplicates, (unsigned)s_stale);
+                hist_report(&s_hist_rx_enqueue);
+                hist_report(&s_hist_enqueue_actuate);
+                hist_report(&s_hist_rx_actuate);
+                s_actuated = 0;
+                s_coalesced = 0;
+                s_dropped = 0;
+                s_duplicates = 0;
+                s_stale = 0;
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < n_acks; i++) {
+            send_ack(&acks[i], now);
+        }
+    }
+}
+
+static bool queue_ack_only(const proto_rx_info_t *rx, proto_ack_status_t status)
+{
+    queued_cmd_t item = {
+        .flags = QUEUED_ACK_ONLY,
+        .status = status,
+        .port = rx->port,
+        .addr = rx->addr,
+        .seq = rx->seq,
+        .rx_time = rx->rx_time,
+    };
+    return xQueueSend(s_queue, &item, 0) == pdTRUE;
+}
+
+static bool queued(const proto_cmd_t *cmd)
+{
+    return led_cmd_is_output(cmd->opcode) && gpio_table_has(cmd->pin);
+}
+
+bool actuator_submit(const proto_cmd_t *cmds, int count, const proto_rx_info_t *rx)
+{
+    bool ok = true;
+    int last = -1;
+
+    // A sequenced datagram is applied whole or not at all: it is only recorded as seen once
+    // the queue has room for all of its commands, the last one carrying the ack (or for the
+    // ack alone). One more slot is kept for the busy ack, so the sender learns to send it
+    // again. Only one task submits at a time, and the actuator task only frees slots.
+    if (rx->seq) {
+        UBaseType_t needed = 0;
+        for (int i = 0; i < count && cmds[i].opcode != PROTO_OP_PROGRAM; i++) {
+            needed += queued(&cmds[i]);
+        }
+        if (needed == 0) {
+            needed = 1;
+        }
+        // A datagram of a whole queue's worth of commands can only wait for an empty queue
+        UBaseType_t reserve = needed < ACTUATOR_QUEUE_LEN ? 1 : 0;
+        if (uxQueueSpacesAvailable(s_queue) < needed + reserve) {
+            s_dropped++;
+            queue_ack_only(rx, PROTO_ACK_BUSY);
+            return false;
+        }
+
+        switch (seq_window_check(&s_window, rx->addr, rx->port, rx->seq)) {
+        case SEQ_DUPLICATE:
+            s_duplicates++;
+            return queue_ack_only(rx, PROTO_ACK_DUPLICATE);
+        case SEQ_STALE:
+            s_stale++;
+            return queue_ack_only(rx, PROTO_ACK_STALE);
+        case SEQ_NEW:
+            break;
+        }
+    }
+
+    // Everything after a PROGRAM record is the program; it bypasses the queue and coalescing
+    int program = count;
+    bool handled = false;
+    for (int i = 0; i < count; i++) {
+        if (cmds[i].opcode == PROTO_OP_PROGRAM) {
+            program = i;
+            break;
+        }
+        if (cmds[i].opcode == PROTO_OP_STOP) {
+            gpio_sequence_stop();
+            handled = true;
+        } else if (!queued(&cmds[i])) {
+            ESP_LOGW(TAG, "Ignoring op %d for GPIO%d", cmds[i].opcode, cmds[i].pin);
+        } else {
+            last = i;
+        }
+    }
+
+    if (program < count) {
+        esp_err_t err = gpio_sequence_start(&cmds[program + 1], count - program - 1, cmds[program].value);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Program not started: %s", esp_err_to_name(err));
+        } else {
+            handled = true;
+        }
+    }
+    if (last < 0) {
+        return rx->seq ? queue_ack_only(rx, handled ? PROTO_ACK_OK : PROTO_ACK_EMPTY) : true;
+    }
+
+    for (int i = 0; i <= last; i++) {
+        if (!queued(&cmds[i])) {
+            continue;
+        }
+        queued_cmd_t item = {
+            .cmd = cmds[i],
+            .flags = (rx->seq && i == last) ? QUEUED_ACK : 0,
+            .status = PROTO_ACK_OK,
+            .port = rx->port,
+            .addr = rx->addr,
+            .seq = rx->seq,
+            .rx_time = rx->rx_time,
+            .enqueue_time = esp_timer_get_time(),
+        };
+        if (xQueueSend(s_queue, &item, 0) != pdTRUE) {
+            s_dropped++;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void actuator_start(void)
+{
+    s_led = led_driver_ledc_init();
+    ESP_ERROR_CHECK(gpio_sequence_init(s_led));
+    s_queue = xQueueCreate(ACTUATOR_QUEUE_LEN, sizeof(queued_cmd_t));
+    s_ack_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (s_ack_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create ack socket: errno %d", errno);
+    }
+    xTaskCreate(actuator_task, "actuator_task", 4096, NULL, ACTUATOR_TASK_PRIORITY, NULL);
+}
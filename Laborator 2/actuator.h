@@ -0,0 +1,22 @@
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "udp_proto.h"
+
+#define ACTUATOR_QUEUE_LEN     64
+#define ACTUATOR_TASK_PRIORITY 10
+// Log the per-stage latency histograms every this many actuated commands
+#define ACTUATOR_REPORT_EVERY  1000
+
+// Start the actuator task that drains the command queue and drives the GPIOs
+void actuator_start(void);
+
+// Queue the commands decoded from one datagram. Sequenced datagrams are checked against the
+// per-sender window first and acked from the actuator task once actuated (or rejected); one
+// that does not fit the queue whole is not applied and is acked PROTO_ACK_BUSY.
+// Never blocks, so it can be called from the lwIP thread. Returns false if anything was dropped.
+bool actuator_submit(const proto_cmd_t *cmds, int count, const proto_rx_info_t *rx);
+
+#endif /* ACTUATOR_H */
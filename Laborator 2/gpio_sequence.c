@@ -0,0 +1,132 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "gpio_sequence.h"
+#include "gpio_table.h"
+
+static const char *TAG = "gpio_sequence";
+
+static esp_timer_handle_t s_timer;
+static const led_driver_t *s_led;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Shared between the loader and the timer callback, guarded by s_lock
+static proto_cmd_t s_steps[GPIO_SEQ_MAX_STEPS];
+static int s_count;
+static int s_index;
+static uint16_t s_repeat;
+static uint16_t s_pass;
+static uint32_t s_generation;
+static int64_t s_next_time;     // absolute time the next step is due, so delays do not drift
+
+static inline uint32_t delay_us(const proto_cmd_t *step)
+{
+    return step->pin == PROTO_DELAY_MS ? step->value * 1000U : step->value;
+}
+
+// Runs every output step up to the next DELAY or the end of the pass, then re-arms the timer
+static void sequence_timer_cb(void *arg)
+{
+    proto_cmd_t batch[GPIO_SEQ_MAX_STEPS];
+    int n = 0;
+    uint32_t wait = 0;
+    bool done = false;
+
+    portENTER_CRITICAL(&s_lock);
+    uint32_t generation = s_generation;
+    while (s_count) {
+        const proto_cmd_t *step = &s_steps[s_index];
+        if (step->opcode == PROTO_OP_DELAY) {
+            wait = delay_us(step);
+        } else {
+            batch[n++] = *step;
+        }
+        bool wrapped = ++s_index == s_count;
+        if (wrapped) {
+            s_index = 0;
+            done = s_repeat && ++s_pass >= s_repeat;
+        }
+        if (wait || wrapped) {
+            break;
+        }
+    }
+    s_next_time += wait;
+    int64_t next_time = s_next_time;
+    portEXIT_CRITICAL(&s_lock);
+
+    for (int i = 0; i < n; i++) {
+        led_cmd_apply(s_led, &batch[i]);
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    bool current = generation == s_generation;
+    portEXIT_CRITICAL(&s_lock);
+
+    // A program loaded meanwhile has already armed the timer itself
+    if (current && !done) {
+        int64_t remaining = next_time - esp_timer_get_time();
+        esp_timer_start_once(s_timer, remaining > 0 ? remaining : 0);
+    }
+}
+
+esp_err_t gpio_sequence_init(const led_driver_t *drv)
+{
+    s_led = drv;
+    const esp_timer_create_args_t args = {
+        .callback = sequence_timer_cb,
+        .name = "gpio_sequence",
+    };
+    return esp_timer_create(&args, &s_timer);
+}
+
+esp_err_t gpio_sequence_start(const proto_cmd_t *steps, int count, uint16_t repeat)
+{
+    if (count <= 0 || count > GPIO_SEQ_MAX_STEPS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t pass_us = 0;
+    for (int i = 0; i < count; i++) {
+        if (steps[i].opcode == PROTO_OP_DELAY) {
+            pass_us += delay_us(&steps[i]);
+        }
+        bool valid = (led_cmd_is_output(steps[i].opcode) && gpio_table_has(steps[i].pin)) ||
+                     steps[i].opcode == PROTO_OP_DELAY;
+        if (!valid) {
+            ESP_LOGW(TAG, "Rejecting program: step %d (op %d, pin %d) not allowed",
+                     i, steps[i].opcode, steps[i].pin);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    // DELAY 0 alone would re-arm the timer at once on every pass and spin the timer task
+    if (repeat == 0 && pass_us == 0) {
+        ESP_LOGW(TAG, "Rejecting endless program without a non-zero delay");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    memcpy(s_steps, steps, count * sizeof(proto_cmd_t));
+    s_count = count;
+    s_index = 0;
+    s_repeat = repeat;
+    s_pass = 0;
+    s_generation++;
+    s_next_time = esp_timer_get_time();
+    portEXIT_CRITICAL(&s_lock);
+
+    // Stop again in case the previous program's callback re-armed the timer in between
+    esp_timer_stop(s_timer);
+    ESP_LOGI(TAG, "Running %d step program, %d passes", count, repeat);
+    return esp_timer_start_once(s_timer, 0);
+}
+
+void gpio_sequence_stop(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_count = 0;
+    s_generation++;
+    portEXIT_CRITICAL(&s_lock);
+    esp_timer_stop(s_timer);
+}
@@ -0,0 +1,23 @@
+#ifndef GPIO_SEQUENCE_H
+#define GPIO_SEQUENCE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "led_driver.h"
+#include "udp_proto.h"
+
+// Longest program that can be uploaded
+#define GPIO_SEQ_MAX_STEPS PROTO_MAX_RECORDS
+
+// Create the esp_timer that runs uploaded programs through `drv`
+esp_err_t gpio_sequence_init(const led_driver_t *drv);
+
+// Replace the running program with `steps` (output and DELAY records) and start it.
+// `repeat` is the number of passes, 0 loops until stopped or replaced; such a program is
+// rejected with ESP_ERR_INVALID_ARG unless its delays add up to more than 0.
+esp_err_t gpio_sequence_start(const proto_cmd_t *steps, int count, uint16_t repeat);
+
+// Stop the running program, leaving the pins at their current levels
+void gpio_sequence_stop(void);
+
+#endif /* GPIO_SEQUENCE_H */
@@ -0,0 +1,50 @@
+#ifndef GPIO_TABLE_H
+#define GPIO_TABLE_H
+
+#include <stdint.h>
+
+/* Pins that can be driven over UDP. Each entry X(pin) enables the text command "GPIO<pin>=<0|1>"
+ * and the binary record for the same pin; add a line here to expose another output. */
+#define GPIO_PIN_TABLE(X) \
+    X(4)                  \
+    X(5)                  \
+    X(18)                 \
+    X(19)
+
+#define GPIO_TABLE_MASK_ENTRY(pin) | (1ULL << (pin))
+#define GPIO_TABLE_PIN_MASK (0ULL GPIO_PIN_TABLE(GPIO_TABLE_MASK_ENTRY))
+
+#define GPIO_TABLE_COUNT_ENTRY(pin) + 1
+#define GPIO_TABLE_SIZE (0 GPIO_PIN_TABLE(GPIO_TABLE_COUNT_ENTRY))
+
+// Check whether `pin` is in the table; compiles to a single switch over the configured pins
+static inline int gpio_table_has(unsigned pin)
+{
+#define GPIO_TABLE_CASE_ENTRY(p) case (p):
+    switch (pin) {
+    GPIO_PIN_TABLE(GPIO_TABLE_CASE_ENTRY)
+        return 1;
+    default:
+        return 0;
+    }
+#undef GPIO_TABLE_CASE_ENTRY
+}
+
+// Position of each pin in the table, e.g. GPIO_TABLE_IDX_4
+#define GPIO_TABLE_ENUM_ENTRY(pin) GPIO_TABLE_IDX_##pin,
+enum { GPIO_PIN_TABLE(GPIO_TABLE_ENUM_ENTRY) };
+#undef GPIO_TABLE_ENUM_ENTRY
+
+// Index of `pin` in the table, -1 if it is not configured
+static inline int gpio_table_index(unsigned pin)
+{
+#define GPIO_TABLE_INDEX_ENTRY(p) case (p): return GPIO_TABLE_IDX_##p;
+    switch (pin) {
+    GPIO_PIN_TABLE(GPIO_TABLE_INDEX_ENTRY)
+    default:
+        return -1;
+    }
+#undef GPIO_TABLE_INDEX_ENTRY
+}
+
+#endif /* GPIO_TABLE_H */
@@ -0,0 +1,124 @@
+/* Host build of the device receive logic for multicast testing on Linux.
+
+   Joins the command multicast group on the loopback interface, decodes with the same
+   proto_decode()/seq_window_check() as the firmware for the given node id and groups, prints
+   what it would actuate and acks sequenced frames like actuator.c. Start several with
+   different node ids, then drive them with one sender:
+
+     ./mcast_rx -n 1 -g 0x1 &  ./mcast_rx -n 2 -g 0x3 &  ./mcast_rx -n 3 -g 0x2 &
+     python ../udp_sender.py --group 239.10.0.1 --select group:1 --rate 100 --count 500
+
+   Build: gcc -O2 -I.. -o mcast_rx mcast_rx.c ../udp_proto.c ../seq_window.c
+   Usage: ./mcast_rx [-a group] [-p port] [-i iface_addr] [-n node_id] [-g groups_mask] [-q]
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "seq_window.h"
+#include "udp_proto.h"
+
+int main(int argc, char **argv)
+{
+    const char *group = "239.10.0.1";
+    const char *iface = "127.0.0.1";
+    unsigned port = 10001;
+    unsigned node_id = 0;
+    unsigned long groups = 1;
+    int quiet = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:i:n:g:q")) != -1) {
+        switch (opt) {
+        case 'a': group = optarg; break;
+        case 'p': port = strtoul(optarg, NULL, 0); break;
+        case 'i': iface = optarg; break;
+        case 'n': node_id = strtoul(optarg, NULL, 0); break;
+        case 'g': groups = strtoul(optarg, NULL, 0); break;
+        case 'q': quiet = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-a group] [-p port] [-i iface] [-n node] [-g groups] [-q]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    // Several simulated nodes share the port on one host
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in local = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    struct ip_mreq mreq = {
+        .imr_multiaddr.s_addr = inet_addr(group),
+        .imr_interface.s_addr = inet_addr(iface),
+    };
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("IP_ADD_MEMBERSHIP");
+        return 1;
+    }
+
+    proto_set_node(node_id, groups);
+    fprintf(stderr, "node %u groups 0x%lx listening on %s:%u\n", node_id, groups, group, port);
+
+    static seq_window_t window;
+    uint8_t buf[PROTO_MAX_FRAME_LEN];
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    unsigned long frames = 0, applied = 0;
+
+    while (1) {
+        struct sockaddr_in src;
+        socklen_t srclen = sizeof(src);
+        ssize_t len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&src, &srclen);
+        if (len < 0) {
+            perror("recvfrom");
+            return 1;
+        }
+
+        uint32_t seq;
+        int n = proto_decode(buf, len, cmds, PROTO_MAX_RECORDS, &seq);
+        if (n < 0) {
+            continue;
+        }
+
+        proto_ack_status_t status = n ? PROTO_ACK_OK : PROTO_ACK_EMPTY;
+        if (seq) {
+            seq_result_t res = seq_window_check(&window, src.sin_addr.s_addr, src.sin_port, seq);
+            if (res == SEQ_DUPLICATE) {
+                status = PROTO_ACK_DUPLICATE;
+                n = 0;
+            } else if (res == SEQ_STALE) {
+                status = PROTO_ACK_STALE;
+                n = 0;
+            }
+        }
+
+        frames++;
+        applied += n;
+        for (int i = 0; i < n && !quiet; i++) {
+            printf("node %u seq %u: op %u GPIO%u=%u\n", node_id, seq, cmds[i].opcode, cmds[i].pin, cmds[i].value);
+        }
+        if (quiet && frames % 1000 == 0) {
+            printf("node %u: %lu frames, %lu commands\n", node_id, frames, applied);
+        }
+        fflush(stdout);
+
+        if (seq) {
+            uint8_t ack[PROTO_ACK_LEN];
+            size_t ack_len = proto_encode_ack(ack, sizeof(ack), seq, status, 0);
+            sendto(sock, ack, ack_len, 0, (struct sockaddr *)&src, srclen);
+        }
+    }
+}
@@ -0,0 +1,253 @@
+/* Host benchmark for the single-task multi-socket server.
+
+   Binds several UDP endpoints on loopback and drives each from its own sender thread with
+   batched binary command frames. The receive side is either the firmware's net_server (one
+   thread, select() over every socket) or one blocking thread per socket, the layout that a
+   task per endpoint would give on the device. Reports per-socket and combined datagrams/s and
+   commands/s, and the receive stack the layout would reserve on the ESP32.
+
+   Build: gcc -O2 -pthread -I.. -o net_bench net_bench.c ../net_server.c ../udp_proto.c
+   Usage: ./net_bench [-s sockets] [-n datagrams_per_socket] [-b records_per_frame] [-r datagrams_per_sec]
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "net_server.h"
+#include "udp_proto.h"
+
+#define BENCH_PORT  10201
+#define MAX_SOCKETS NET_SERVER_MAX_ENDPOINTS
+
+typedef struct {
+    int sock;
+    size_t datagrams;
+    size_t received;
+    size_t commands;
+    uint64_t last_rx_ns;
+} endpoint_stats_t;
+
+typedef struct {
+    uint16_t port;
+    size_t datagrams;
+    size_t batch;
+    unsigned rate;
+} sender_t;
+
+static endpoint_stats_t s_stats[MAX_SOCKETS];
+static int s_sockets = 3;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void count_frame(endpoint_stats_t *st, const uint8_t *data, size_t len)
+{
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    uint32_t seq;
+    int n = proto_decode(data, len, cmds, PROTO_MAX_RECORDS, &seq);
+
+    if (n >= 0) {
+        st->received++;
+        st->commands += n;
+        st->last_rx_ns = now_ns();
+    }
+}
+
+static void bench_handler(const net_conn_t *conn, const uint8_t *data, size_t len, void *ctx)
+{
+    count_frame(ctx, data, len);
+}
+
+static void *sender_thread(void *arg)
+{
+    sender_t *tx = arg;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(tx->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    uint8_t frame[PROTO_MAX_FRAME_LEN];
+    uint64_t interval = tx->rate ? 1000000000ull / tx->rate : 0;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < tx->datagrams; i++) {
+        if (interval) {
+            while (now_ns() < start + i * interval) {
+            }
+        }
+        for (size_t j = 0; j < tx->batch; j++) {
+            cmds[j] = (proto_cmd_t){ .opcode = PROTO_OP_SET_LEVEL, .pin = 4, .value = (i + j) & 1 };
+        }
+        size_t len = proto_encode(frame, sizeof(frame), i + 1, cmds, tx->batch);
+        sendto(sock, frame, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    close(sock);
+    return NULL;
+}
+
+static size_t total_received(void)
+{
+    size_t total = 0;
+    for (int i = 0; i < s_sockets; i++) {
+        total += s_stats[i].received;
+    }
+    return total;
+}
+
+// One blocking receiver per socket; a 1 s receive timeout ends it once the senders stop
+static void *receiver_thread(void *arg)
+{
+    endpoint_stats_t *st = arg;
+    uint8_t buf[NET_SERVER_RX_BUF_LEN];
+
+    while (st->received < st->datagrams) {
+        ssize_t len = recv(st->sock, buf, sizeof(buf), 0);
+        if (len < 0) {
+            break;
+        }
+        count_frame(st, buf, len);
+    }
+    return NULL;
+}
+
+static int open_socket(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval tv = { .tv_sec = 1 };
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    return sock;
+}
+
+// Throughput is measured up to the last datagram received, not the idle timeout after it
+static void report(const char *mode, uint64_t start, unsigned stack_bytes)
+{
+    size_t datagrams = 0, commands = 0;
+    uint64_t end = start;
+
+    for (int i = 0; i < s_sockets; i++) {
+        printf("  %-7s port %d: %zu/%zu datagrams, %zu commands\n", mode, BENCH_PORT + i,
+               s_stats[i].received, s_stats[i].datagrams, s_stats[i].commands);
+        datagrams += s_stats[i].received;
+        commands += s_stats[i].commands;
+        if (s_stats[i].last_rx_ns > end) {
+            end = s_stats[i].last_rx_ns;
+        }
+    }
+    double elapsed = end - start;
+    printf("%-7s sockets=%d  %10.0f datagram/s  %10.0f cmd/s  receive stack on device %u bytes\n",
+           mode, s_sockets, datagrams / (elapsed / 1e9), commands / (elapsed / 1e9), stack_bytes);
+}
+
+static uint64_t start_senders(sender_t *senders, pthread_t *threads)
+{
+    uint64_t start = now_ns();
+    for (int i = 0; i < s_sockets; i++) {
+        pthread_create(&threads[i], NULL, sender_thread, &senders[i]);
+    }
+    return start;
+}
+
+static void join_all(pthread_t *threads)
+{
+    for (int i = 0; i < s_sockets; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t datagrams = 50000;
+    size_t batch = 16;
+    unsigned rate = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:b:r:")) != -1) {
+        switch (opt) {
+        case 's': s_sockets = atoi(optarg); break;
+        case 'n': datagrams = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = strtoul(optarg, NULL, 0); break;
+        case 'r': rate = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-s sockets] [-n datagrams] [-b batch] [-r rate]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (s_sockets < 1 || s_sockets > MAX_SOCKETS || batch == 0 || batch > PROTO_MAX_RECORDS) {
+        fprintf(stderr, "sockets must be 1..%d and batch 1..%d\n", MAX_SOCKETS, PROTO_MAX_RECORDS);
+        return 1;
+    }
+
+    sender_t senders[MAX_SOCKETS];
+    pthread_t tx_threads[MAX_SOCKETS];
+    pthread_t rx_threads[MAX_SOCKETS];
+    int rcvbuf = 8 << 20;
+
+    for (int i = 0; i < s_sockets; i++) {
+        senders[i] = (sender_t){ BENCH_PORT + i, datagrams, batch, rate };
+    }
+
+    // One thread per socket
+    memset(s_stats, 0, sizeof(s_stats));
+    for (int i = 0; i < s_sockets; i++) {
+        s_stats[i].sock = open_socket(BENCH_PORT + i);
+        s_stats[i].datagrams = datagrams;
+        setsockopt(s_stats[i].sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        pthread_create(&rx_threads[i], NULL, receiver_thread, &s_stats[i]);
+    }
+    uint64_t start = start_senders(senders, tx_threads);
+    join_all(tx_threads);
+    join_all(rx_threads);
+    report("threads", start, s_sockets * NET_SERVER_TASK_STACK);
+    for (int i = 0; i < s_sockets; i++) {
+        close(s_stats[i].sock);
+    }
+
+    // Every socket in one net_server loop
+    static const char *names[MAX_SOCKETS] = { "bench0", "bench1", "bench2", "bench3", "bench4", "bench5" };
+    memset(s_stats, 0, sizeof(s_stats));
+    for (int i = 0; i < s_sockets; i++) {
+        s_stats[i].datagrams = datagrams;
+        s_stats[i].sock = net_server_add_udp(names[i], BENCH_PORT + i, bench_handler, &s_stats[i]);
+        if (s_stats[i].sock < 0) {
+            return 1;
+        }
+        setsockopt(s_stats[i].sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    start = start_senders(senders, tx_threads);
+    size_t expected = s_sockets * datagrams;
+    uint64_t last_progress = now_ns();
+    while (total_received() < expected && now_ns() - last_progress < 1000000000ull) {
+        if (net_server_poll(100) > 0) {
+            last_progress = now_ns();
+        }
+    }
+    join_all(tx_threads);
+    report("select", start, NET_SERVER_TASK_STACK);
+
+    char line[256];
+    net_server_format_stats(line, sizeof(line));
+    printf("net_server stats: %s\n", line);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/* Host benchmark for the command parser in udp_proto.c.
+
+   Checks a few known inputs, then decodes millions of synthetic text and binary commands for
+   the pins in gpio_table.h and prints the cost per command, so parser changes can be tracked.
+
+   Build: gcc -O2 -I.. -o parser_bench parser_bench.c ../udp_proto.c
+   Usage: ./parser_bench [commands]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpio_table.h"
+#include "udp_proto.h"
+
+static const unsigned pins[] = {
+#define PIN_ENTRY(pin) pin,
+    GPIO_PIN_TABLE(PIN_ENTRY)
+#undef PIN_ENTRY
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int decode_str(const char *text, proto_cmd_t *cmds)
+{
+    uint32_t seq;
+    return proto_decode((const uint8_t *)text, strlen(text), cmds, PROTO_MAX_RECORDS, &seq);
+}
+
+static int self_check(void)
+{
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "check failed: %s\n", #cond); failures++; } } while (0)
+    CHECK(decode_str("GPIO4=1", cmds) == 1 && cmds[0].pin == 4 && cmds[0].value == 1);
+    CHECK(decode_str("GPIO4=0\n", cmds) == 1 && cmds[0].value == 0);
+    CHECK(decode_str("GPIO18=1;GPIO4=0", cmds) == 2 && cmds[0].pin == 18 && cmds[1].pin == 4);
+    CHECK(decode_str("GPIO3=1", cmds) == 0);    // not in the table
+    CHECK(decode_str("GPIO4=2", cmds) == 0);
+    CHECK(decode_str("GPIO4", cmds) == 0);
+    CHECK(decode_str("hello", cmds) == 0);
+
+    uint8_t frame[PROTO_MAX_FRAME_LEN];
+    uint32_t seq;
+    proto_cmd_t in[2] = { { .opcode = PROTO_OP_SET_LEVEL, .pin = 4, .value = 1 },
+                          { .opcode = PROTO_OP_SET_LEVEL, .pin = 19, .value = 0 } };
+    size_t len = proto_encode(frame, sizeof(frame), 42, in, 2);
+    CHECK(proto_decode(frame, len, cmds, PROTO_MAX_RECORDS, &seq) == 2 && seq == 42 && cmds[1].pin == 19);
+    CHECK(proto_decode(frame, len - 1, cmds, PROTO_MAX_RECORDS, &seq) == -1);
+#undef CHECK
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+    const size_t npins = sizeof(pins) / sizeof(pins[0]);
+
+    if (self_check()) {
+        return 1;
+    }
+
+    // Pre-generate a pool of datagrams so only decoding is timed
+    enum { POOL = 1024 };
+    static uint8_t text[POOL][16];
+    static size_t text_len[POOL];
+    static uint8_t bin[POOL][PROTO_HEADER_LEN + PROTO_RECORD_LEN];
+    static size_t bin_len[POOL];
+    for (size_t i = 0; i < POOL; i++) {
+        unsigned pin = pins[rand() % npins];
+        unsigned value = rand() & 1;
+        text_len[i] = snprintf((char *)text[i], sizeof(text[i]), "GPIO%u=%u", pin, value);
+        proto_cmd_t cmd = { .opcode = PROTO_OP_SET_LEVEL, .pin = pin, .value = value };
+        bin_len[i] = proto_encode(bin[i], sizeof(bin[i]), i, &cmd, 1);
+    }
+
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    uint32_t seq;
+    unsigned long checksum = 0;
+
+    double t0 = now_s();
+    for (size_t i = 0; i < total; i++) {
+        size_t k = i % POOL;
+        checksum += proto_decode(text[k], text_len[k], cmds, PROTO_MAX_RECORDS, &seq) + cmds[0].pin;
+    }
+    double t1 = now_s();
+    for (size_t i = 0; i < total; i++) {
+        size_t k = i % POOL;
+        checksum += proto_decode(bin[k], bin_len[k], cmds, PROTO_MAX_RECORDS, &seq) + cmds[0].pin;
+    }
+    double t2 = now_s();
+
+    printf("%zu commands over %zu pins (checksum %lu)\n", total, npins, checksum);
+    printf("text   %6.1f ns/cmd\n", (t1 - t0) * 1e9 / total);
+    printf("binary %6.1f ns/cmd\n", (t2 - t1) * 1e9 / total);
+    return 0;
+}
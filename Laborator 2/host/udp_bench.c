@@ -0,0 +1,183 @@
+/* Host-side throughput benchmark for the UDP command protocols.
+
+   A receiver thread runs the same proto_decode() as the control handler on a loopback socket
+   while the main thread sends legacy text commands or batched binary frames at it, then reports
+   commands/sec and send-to-decode latency for both.
+
+   Build: gcc -O2 -pthread -I.. -o udp_bench udp_bench.c ../udp_proto.c
+   Usage: ./udp_bench [-n datagrams] [-b records_per_frame] [-r datagrams_per_sec] [-d delay_ms]
+          -d emulates a fixed per-datagram delay such as the old 200 ms vTaskDelay.
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "udp_proto.h"
+
+#define BENCH_PORT 10101
+
+typedef struct {
+    int sock;
+    int binary;
+    size_t datagrams;
+    unsigned delay_ms;
+    uint64_t *recv_ns;
+    size_t received;
+    size_t commands;
+} receiver_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *receiver_thread(void *arg)
+{
+    receiver_t *rx = arg;
+    uint8_t buf[PROTO_MAX_FRAME_LEN];
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    uint32_t seq;
+
+    while (rx->received < rx->datagrams) {
+        ssize_t len = recv(rx->sock, buf, sizeof(buf), 0);
+        if (len < 0) {
+            break;  // receive timeout: the rest was lost
+        }
+        int n = proto_decode(buf, len, cmds, PROTO_MAX_RECORDS, &seq);
+        if (n < 0) {
+            continue;
+        }
+        // Text datagrams carry no sequence number, loopback keeps them in order
+        size_t idx = rx->binary ? seq : rx->received;
+        if (idx < rx->datagrams) {
+            rx->recv_ns[idx] = now_ns();
+        }
+        rx->received++;
+        rx->commands += n;
+        if (rx->delay_ms) {
+            usleep(rx->delay_ms * 1000);
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(int binary, size_t datagrams, size_t batch, unsigned rate, unsigned delay_ms)
+{
+    int rx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 8 << 20;
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = { .tv_sec = 1 };
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(rx_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+
+    uint64_t *send_ns = calloc(datagrams, sizeof(uint64_t));
+    receiver_t rx = {
+        .sock = rx_sock,
+        .binary = binary,
+        .datagrams = datagrams,
+        .delay_ms = delay_ms,
+        .recv_ns = calloc(datagrams, sizeof(uint64_t)),
+    };
+    pthread_t thread;
+    pthread_create(&thread, NULL, receiver_thread, &rx);
+
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    uint8_t frame[PROTO_MAX_FRAME_LEN];
+    uint64_t interval = rate ? 1000000000ull / rate : 0;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < datagrams; i++) {
+        if (interval) {
+            while (now_ns() < start + i * interval) {
+            }
+        }
+        send_ns[i] = now_ns();
+        if (binary) {
+            for (size_t j = 0; j < batch; j++) {
+                cmds[j] = (proto_cmd_t){ .opcode = PROTO_OP_SET_LEVEL, .pin = 4, .value = (i + j) & 1 };
+            }
+            size_t len = proto_encode(frame, sizeof(frame), i, cmds, batch);
+            sendto(tx_sock, frame, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            const char *text = (i & 1) ? "GPIO4=1" : "GPIO4=0";
+            sendto(tx_sock, text, strlen(text), 0, (struct sockaddr *)&addr, sizeof(addr));
+        }
+    }
+
+    pthread_join(thread, NULL);
+    uint64_t elapsed = now_ns() - start;
+
+    size_t samples = 0;
+    for (size_t i = 0; i < datagrams; i++) {
+        if (rx.recv_ns[i]) {
+            send_ns[samples++] = rx.recv_ns[i] - send_ns[i];
+        }
+    }
+    qsort(send_ns, samples, sizeof(uint64_t), cmp_u64);
+
+    printf("%-6s batch=%-3zu datagrams=%zu received=%zu commands=%zu  %10.0f cmd/s  "
+           "latency p50=%.1fus p99=%.1fus max=%.1fus\n",
+           binary ? "binary" : "text", binary ? batch : 1, datagrams, rx.received, rx.commands,
+           rx.commands / (elapsed / 1e9),
+           samples ? send_ns[samples / 2] / 1e3 : 0.0,
+           samples ? send_ns[samples * 99 / 100] / 1e3 : 0.0,
+           samples ? send_ns[samples - 1] / 1e3 : 0.0);
+
+    free(send_ns);
+    free(rx.recv_ns);
+    close(rx_sock);
+    close(tx_sock);
+}
+
+int main(int argc, char **argv)
+{
+    size_t datagrams = 100000;
+    size_t batch = 16;
+    unsigned rate = 0;
+    unsigned delay_ms = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:r:d:")) != -1) {
+        switch (opt) {
+        case 'n': datagrams = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = strtoul(optarg, NULL, 0); break;
+        case 'r': rate = strtoul(optarg, NULL, 0); break;
+        case 'd': delay_ms = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n datagrams] [-b batch] [-r rate] [-d delay_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (batch == 0 || batch > PROTO_MAX_RECORDS) {
+        fprintf(stderr, "batch must be 1..%d\n", PROTO_MAX_RECORDS);
+        return 1;
+    }
+
+    run(0, datagrams, 1, rate, delay_ms);
+    run(1, datagrams, batch, rate, delay_ms);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#include "led_driver.h"
+
+int led_cmd_apply(const led_driver_t *drv, const proto_cmd_t *cmd)
+{
+    switch (cmd->opcode) {
+    case PROTO_OP_SET_LEVEL:
+        return drv->set_level(drv->ctx, cmd->pin, cmd->value ? 1 : 0);
+    case PROTO_OP_SET_DUTY:
+        return drv->set_duty(drv->ctx, cmd->pin, cmd->value);
+    case PROTO_OP_FADE:
+        return drv->fade(drv->ctx, cmd->pin, cmd->value, cmd->arg);
+    default:
+        return -1;
+    }
+}
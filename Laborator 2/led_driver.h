@@ -0,0 +1,38 @@
+#ifndef LED_DRIVER_H
+#define LED_DRIVER_H
+
+#include <stdint.h>
+#include "udp_proto.h"
+
+// Full-scale duty used on the wire and by every driver; drivers scale to their own resolution
+#define LED_DUTY_MAX 0xffff
+
+// Duty step of a fade on chips whose LEDC fade cannot be stopped (SOC_LEDC_SUPPORT_FADE_STOP
+// unset, as on the ESP32): a hardware fade there would hold every later command on its pin,
+// and the actuator task with it, until it ended, and a FADE may last up to 2^24 ms. The LEDC
+// driver ramps those fades in software instead, one duty update per step.
+#define LED_SOFT_FADE_STEP_MS 10
+
+// Output backend for GPIO commands. The firmware uses the LEDC implementation; host
+// builds plug in a mock to test and benchmark command handling without hardware.
+typedef struct {
+    int (*set_level)(void *ctx, uint8_t pin, uint32_t level);
+    int (*set_duty)(void *ctx, uint8_t pin, uint32_t duty);
+    int (*fade)(void *ctx, uint8_t pin, uint32_t duty, uint32_t time_ms);
+    void *ctx;
+} led_driver_t;
+
+// Apply one output command through `drv`; returns the driver's result, or -1 for an opcode
+// that is not an output command
+int led_cmd_apply(const led_driver_t *drv, const proto_cmd_t *cmd);
+
+// Route every pin in gpio_table.h through an LEDC channel and return the LEDC backend
+const led_driver_t *led_driver_ledc_init(void);
+
+// Whether `opcode` is one led_cmd_apply() handles
+static inline int led_cmd_is_output(uint8_t opcode)
+{
+    return opcode == PROTO_OP_SET_LEVEL || opcode == PROTO_OP_SET_DUTY || opcode == PROTO_OP_FADE;
+}
+
+#endif /* LED_DRIVER_H */
@@ -0,0 +1,184 @@
+#include "esp_log.h"
+#include "driver/ledc.h"
+#if !SOC_LEDC_SUPPORT_FADE_STOP
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+#include "gpio_table.h"
+#include "led_driver.h"
+
+static const char *TAG = "led_driver";
+
+#define LEDC_MODE       LEDC_LOW_SPEED_MODE
+#define LEDC_TIMER      LEDC_TIMER_0
+#define LEDC_RES_BITS   13
+#define LEDC_FREQ_HZ    5000
+
+_Static_assert(GPIO_TABLE_SIZE <= LEDC_CHANNEL_MAX, "gpio_table.h has more pins than LEDC channels");
+
+static inline uint32_t scale_duty(uint32_t duty)
+{
+    return duty >> (16 - LEDC_RES_BITS);
+}
+
+#if SOC_LEDC_SUPPORT_FADE_STOP
+
+// The hardware keeps the duty, only the software fades below need it passed
+static void fade_cancel(ledc_channel_t channel, uint32_t duty)
+{
+    ledc_fade_stop(LEDC_MODE, channel);
+}
+
+// The fade engine ramps the duty in hardware; the CPU is only involved to start it
+static int ledc_fade(void *ctx, uint8_t pin, uint32_t duty, uint32_t time_ms)
+{
+    ledc_channel_t channel = gpio_table_index(pin);
+    ledc_fade_stop(LEDC_MODE, channel);
+    return ledc_set_fade_time_and_start(LEDC_MODE, channel, scale_duty(duty), time_ms, LEDC_FADE_NO_WAIT);
+}
+
+#else
+
+// Without fade stop (the ESP32) a hardware fade cannot be interrupted: setting the duty of a
+// fading channel waits for the fade to end. Fades are ramped from an esp_timer instead, so
+// a new command takes over a fading pin at once.
+typedef struct {
+    bool active;
+    uint32_t from, to;      // scaled duty
+    int64_t start_us;
+    uint32_t time_ms;
+} soft_fade_t;
+
+static soft_fade_t s_fades[GPIO_TABLE_SIZE];
+// Scaled duty each channel was last driven at. ledc_get_duty() cannot stand in for it: after
+// ledc_stop() the pin idles at the stop level whatever the duty register holds.
+static uint32_t s_duty[GPIO_TABLE_SIZE];
+static SemaphoreHandle_t s_fade_lock;
+static esp_timer_handle_t s_fade_timer;
+static bool s_fade_timer_running;
+
+static void fade_step(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    bool running = false;
+
+    xSemaphoreTake(s_fade_lock, portMAX_DELAY);
+    for (int i = 0; i < GPIO_TABLE_SIZE; i++) {
+        soft_fade_t *f = &s_fades[i];
+        if (!f->active) {
+            continue;
+        }
+        int64_t elapsed_ms = (now - f->start_us) / 1000;
+        uint32_t duty = f->to;
+        if (elapsed_ms < f->time_ms) {
+            duty = f->from + ((int64_t)f->to - f->from) * elapsed_ms / f->time_ms;
+            running = true;
+        } else {
+            f->active = false;
+        }
+        s_duty[i] = duty;
+        ledc_set_duty(LEDC_MODE, i, duty);
+        ledc_update_duty(LEDC_MODE, i);
+    }
+    if (!running && s_fade_timer_running) {
+        esp_timer_stop(s_fade_timer);
+        s_fade_timer_running = false;
+    }
+    xSemaphoreGive(s_fade_lock);
+}
+
+// Once this returns the timer no longer touches the channel, which the caller drives at
+// scaled `duty`
+static void fade_cancel(ledc_channel_t channel, uint32_t duty)
+{
+    xSemaphoreTake(s_fade_lock, portMAX_DELAY);
+    s_fades[channel].active = false;
+    s_duty[channel] = duty;
+    xSemaphoreGive(s_fade_lock);
+}
+
+static int ledc_fade(void *ctx, uint8_t pin, uint32_t duty, uint32_t time_ms)
+{
+    ledc_channel_t channel = gpio_table_index(pin);
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(s_fade_lock, portMAX_DELAY);
+    s_fades[channel] = (soft_fade_t){
+        .active = time_ms > 0,
+        .from = s_duty[channel],
+        .to = scale_duty(duty),
+        .start_us = esp_timer_get_time(),
+        .time_ms = time_ms,
+    };
+    if (time_ms == 0) {
+        s_duty[channel] = scale_duty(duty);
+        err = ledc_set_duty(LEDC_MODE, channel, scale_duty(duty));
+        err = err == ESP_OK ? ledc_update_duty(LEDC_MODE, channel) : err;
+    } else if (!s_fade_timer_running) {
+        err = esp_timer_start_periodic(s_fade_timer, LED_SOFT_FADE_STEP_MS * 1000);
+        s_fade_timer_running = err == ESP_OK;
+    }
+    xSemaphoreGive(s_fade_lock);
+    return err;
+}
+
+#endif
+
+// Plain on/off stops the PWM with the wanted idle level, which takes effect immediately
+// instead of at the end of the current PWM period
+static int ledc_set_level(void *ctx, uint8_t pin, uint32_t level)
+{
+    ledc_channel_t channel = gpio_table_index(pin);
+    fade_cancel(channel, level ? scale_duty(LED_DUTY_MAX) : 0);
+    return ledc_stop(LEDC_MODE, channel, level);
+}
+
+static int ledc_set_duty_now(void *ctx, uint8_t pin, uint32_t duty)
+{
+    ledc_channel_t channel = gpio_table_index(pin);
+    fade_cancel(channel, scale_duty(duty));
+    esp_err_t err = ledc_set_duty(LEDC_MODE, channel, scale_duty(duty));
+    return err == ESP_OK ? ledc_update_duty(LEDC_MODE, channel) : err;
+}
+
+static const led_driver_t s_ledc_driver = {
+    .set_level = ledc_set_level,
+    .set_duty = ledc_set_duty_now,
+    .fade = ledc_fade,
+};
+
+const led_driver_t *led_driver_ledc_init(void)
+{
+    ledc_timer_config_t timer = {
+        .speed_mode = LEDC_MODE,
+        .timer_num = LEDC_TIMER,
+        .duty_resolution = LEDC_RES_BITS,
+        .freq_hz = LEDC_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&timer));
+
+#define LEDC_CHANNEL_ENTRY(pin)                                         \
+    ESP_ERROR_CHECK(ledc_channel_config(&(ledc_channel_config_t){       \
+        .gpio_num = (pin),                                              \
+        .speed_mode = LEDC_MODE,                                        \
+        .channel = GPIO_TABLE_IDX_##pin,                                \
+        .timer_sel = LEDC_TIMER,                                        \
+        .duty = 0,                                                      \
+    }));                                                                \
+    ledc_stop(LEDC_MODE, GPIO_TABLE_IDX_##pin, 0);
+    GPIO_PIN_TABLE(LEDC_CHANNEL_ENTRY)
+#undef LEDC_CHANNEL_ENTRY
+
+#if SOC_LEDC_SUPPORT_FADE_STOP
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+#else
+    s_fade_lock = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t fade_timer = { .callback = fade_step, .name = "led_fade" };
+    ESP_ERROR_CHECK(esp_timer_create(&fade_timer, &s_fade_timer));
+#endif
+    ESP_LOGI(TAG, "%d pins on LEDC, %d bit duty at %d Hz", GPIO_TABLE_SIZE, LEDC_RES_BITS, LEDC_FREQ_HZ);
+    return &s_ledc_driver;
+}
@@ -11,6 +11,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -22,13 +23,32 @@
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
 
+#include "esp_timer.h"
 #include "driver/gpio.h"
 
+#include "actuator.h"
+#include "gpio_table.h"
+#include "net_server.h"
+#include "udp_proto.h"
+#include "udp_raw_rx.h"
+
 #define CONFIG_ESP_WIFI_SSID      "lab-iot"
 #define CONFIG_ESP_WIFI_PASS      "IoT-IoT-IoT"
 #define CONFIG_ESP_MAXIMUM_RETRY  5
 #define CONFIG_LOCAL_PORT         10001
-#define LED_PIN 4
+// 1: receive through the lwIP raw API and decode in place in the pbuf, 0: BSD socket in the net_server task
+#define CONFIG_UDP_RX_RAW_API     0
+// Fleet-wide commands arrive on this IPv4 multicast group at CONFIG_LOCAL_PORT ("" to disable)
+#define CONFIG_MCAST_GROUP        "239.10.0.1"
+// Node id matched by SELECT records; -1 uses the last two bytes of the station MAC
+#define CONFIG_NODE_ID            -1
+// Groups this node belongs to, bit i = group i
+#define CONFIG_NODE_GROUPS        0x00000001
+// Answers "DISCOVER" queries and broadcasts a beacon every CONFIG_DISCOVERY_BEACON_MS (0: no beacon)
+#define CONFIG_DISCOVERY_PORT     10002
+#define CONFIG_DISCOVERY_BEACON_MS 5000
+// Status queries over UDP or TCP (e.g. `nc <ip> 10003`)
+#define CONFIG_STATUS_PORT        10003
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -42,6 +62,7 @@ static EventGroupHandle_t s_wifi_event_group;
 static const char *TAG = "wifi station";
 
 static int s_retry_num = 0;
+static uint16_t s_node_id;
 
 
 static void event_handler(void* arg, esp_event_base_t event_base,
@@ -126,83 +147,103 @@ bool wifi_init_sta(void)
     return false;
 }
 
-static void udp_task(void *pvParameters)
+// Control port: decode a command datagram and hand it to the actuator
+static void control_handler(const net_conn_t *conn, const uint8_t *data, size_t len, void *ctx)
 {
-    char rx_buffer[128];
-    char addr_str[128];
-    int addr_family = 0;
-    int ip_protocol = 0;
-
-    /*
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_addr.s_addr = inet_addr(CONFIG_PEER_IP_ADDR); // unde #define CONFIG_PEER_IP_ADDR "192.168.89.abc"
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(CONFIG_PEER_PORT);
-    addr_family = AF_INET;
-    ip_protocol = IPPROTO_IP;
-    */
-
-    struct sockaddr_in local_addr;
-    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    local_addr.sin_family = AF_INET;
-    local_addr.sin_port = htons(CONFIG_LOCAL_PORT);
-    ip_protocol = IPPROTO_IP;
-    addr_family = AF_INET;
-
-    while(1)
-    {
-        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-            break;
-        }
-        ESP_LOGI(TAG, "Socket created");
+    proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    proto_rx_info_t rx = {
+        .rx_time = esp_timer_get_time(),
+        .addr = conn->peer.sin_addr.s_addr,
+        .port = conn->peer.sin_port,
+    };
 
-        int err = bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
-        }
-        ESP_LOGI(TAG, "Socket bound, port %d", CONFIG_LOCAL_PORT);
-
-        while (1) {
-
-            struct sockaddr source_addr;
-            socklen_t socklen = sizeof(source_addr);
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, &source_addr, &socklen);
-
-            // Error occurred during receiving
-            if (len < 0) {
-                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                break;
-            }
-            // Data received
-            else {
-                inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
-                rx_buffer[len] = 0; // Null-terminate whatever we received and treat like a string
-                ESP_LOGI(TAG, "Received %d bytes from %s:", len, addr_str);
-                ESP_LOGI(TAG, "%s", rx_buffer);
-                
-                // Check for LED control commands
-                if (strstr(rx_buffer, "GPIO4=0") != NULL) {
-                    ESP_LOGI(TAG, "Turning LED OFF");
-                    gpio_set_level(LED_PIN, 0);
-                } 
-                else if (strstr(rx_buffer, "GPIO4=1") != NULL) {
-                    ESP_LOGI(TAG, "Turning LED ON");
-                    gpio_set_level(LED_PIN, 1);
-                }
-            }
-
-            vTaskDelay(200 / portTICK_PERIOD_MS);
-        }
+    if (esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+        char addr_str[16];
+        inet_ntoa_r(conn->peer.sin_addr, addr_str, sizeof(addr_str) - 1);
+        ESP_LOGD(TAG, "Received %d bytes from %s", (int)len, addr_str);
+    }
 
-        if (sock != -1) {
-            ESP_LOGE(TAG, "Shutting down socket and restarting...");
-            shutdown(sock, 0);
-            close(sock);
+    int n = proto_decode(data, len, cmds, PROTO_MAX_RECORDS, &rx.seq);
+    if (n < 0) {
+        ESP_LOGW(TAG, "Dropping malformed %d byte datagram", (int)len);
+    } else {
+        actuator_submit(cmds, n, &rx);
+    }
+}
+
+static int format_beacon(char *buf, size_t len)
+{
+    return snprintf(buf, len, "NODE id=%u groups=0x%08x control=%d status=%d",
+                    s_node_id, (unsigned)CONFIG_NODE_GROUPS, CONFIG_LOCAL_PORT, CONFIG_STATUS_PORT);
+}
+
+// Discovery port: answer "DISCOVER" with the node id and the ports it serves
+static void discovery_handler(const net_conn_t *conn, const uint8_t *data, size_t len, void *ctx)
+{
+    char reply[96];
+
+    // Other nodes' beacons arrive here too and are not queries
+    if (len < 8 || memcmp(data, "DISCOVER", 8) != 0) {
+        return;
+    }
+    net_server_reply(conn, reply, format_beacon(reply, sizeof(reply)));
+}
+
+static void discovery_beacon(void *ctx)
+{
+    int sock = *(int *)ctx;
+    char beacon[96];
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_DISCOVERY_PORT),
+        .sin_addr.s_addr = htonl(INADDR_BROADCAST),
+    };
+
+    sendto(sock, beacon, format_beacon(beacon, sizeof(beacon)), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+}
+
+// Status port, UDP or TCP: any request gets one line of counters back
+static void status_handler(const net_conn_t *conn, const uint8_t *data, size_t len, void *ctx)
+{
+    char reply[256];
+    int n = snprintf(reply, sizeof(reply), "uptime_ms=%lld heap=%u min_heap=%u ",
+                     esp_timer_get_time() / 1000, (unsigned)esp_get_free_heap_size(),
+                     (unsigned)esp_get_minimum_free_heap_size());
+
+    n += net_server_format_stats(reply + n, sizeof(reply) - n - 1);
+    reply[n++] = '\n';
+    net_server_reply(conn, reply, n);
+}
+
+static void net_endpoints_start(void)
+{
+    static int s_discovery_sock;
+
+#if !CONFIG_UDP_RX_RAW_API
+    int sock = net_server_add_udp("control", CONFIG_LOCAL_PORT, control_handler, NULL);
+    if (sock >= 0 && CONFIG_MCAST_GROUP[0]) {
+        struct ip_mreq mreq = {
+            .imr_multiaddr.s_addr = inet_addr(CONFIG_MCAST_GROUP),
+            .imr_interface.s_addr = htonl(INADDR_ANY),
+        };
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            ESP_LOGE(TAG, "Unable to join multicast group %s: errno %d", CONFIG_MCAST_GROUP, errno);
+        } else {
+            ESP_LOGI(TAG, "Joined multicast group %s", CONFIG_MCAST_GROUP);
         }
     }
-    vTaskDelete(NULL);
+#endif
+
+    s_discovery_sock = net_server_add_udp("discovery", CONFIG_DISCOVERY_PORT, discovery_handler, NULL);
+    if (s_discovery_sock >= 0 && CONFIG_DISCOVERY_BEACON_MS) {
+        int one = 1;
+        setsockopt(s_discovery_sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        net_server_set_tick(CONFIG_DISCOVERY_BEACON_MS, discovery_beacon, &s_discovery_sock);
+    }
+    net_server_add_udp("status", CONFIG_STATUS_PORT, status_handler, NULL);
+    net_server_add_tcp("status_tcp", CONFIG_STATUS_PORT, status_handler, NULL);
+
+    net_server_start();
 }
 
 void app_main(void)
@@ -215,15 +256,37 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // Initialize GPIO for LED
-    gpio_reset_pin(LED_PIN);
-    gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
-    gpio_set_level(LED_PIN, 0); // Initially OFF
+    // Initialize every GPIO listed in gpio_table.h as an output, initially OFF
+    gpio_config_t io_conf = {
+        .pin_bit_mask = GPIO_TABLE_PIN_MASK,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    gpio_config(&io_conf);
+#define GPIO_TABLE_INIT_ENTRY(pin) gpio_set_level(pin, 0);
+    GPIO_PIN_TABLE(GPIO_TABLE_INIT_ENTRY)
+#undef GPIO_TABLE_INIT_ENTRY
 
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
     bool connected = wifi_init_sta();
 
     if (connected) {
-        xTaskCreate(udp_task, "udp_task", 4096, NULL, 5, NULL);
+        s_node_id = CONFIG_NODE_ID;
+        if (CONFIG_NODE_ID < 0) {
+            uint8_t mac[6];
+            esp_read_mac(mac, ESP_MAC_WIFI_STA);
+            s_node_id = (mac[4] << 8) | mac[5];
+        }
+        proto_set_node(s_node_id, CONFIG_NODE_GROUPS);
+        ESP_LOGI(TAG, "Node id %d, groups 0x%08x", s_node_id, (unsigned)CONFIG_NODE_GROUPS);
+
+        actuator_start();
+#if CONFIG_UDP_RX_RAW_API
+        ESP_ERROR_CHECK(udp_raw_rx_start(CONFIG_LOCAL_PORT, CONFIG_MCAST_GROUP, actuator_submit));
+#endif
+        // Control (unless received raw), discovery and status all share one select() task
+        net_endpoints_start();
     }
 }
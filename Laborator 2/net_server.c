@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rx_stats.h"
+#else
+// Host build for host/net_bench.c
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define CONFIG_UDP_RX_CYCLE_STATS 0
+#endif
+
+#include "net_server.h"
+
+static const char *TAG = "net_server";
+
+typedef struct {
+    const char *name;
+    int sock;
+    bool stream;
+    net_handler_t handler;
+    void *ctx;
+    uint32_t rx_count;
+#if CONFIG_UDP_RX_CYCLE_STATS
+    rx_stats_t stats;
+#endif
+} endpoint_t;
+
+typedef struct {
+    int sock;
+    int endpoint;
+    struct sockaddr_in peer;
+} client_t;
+
+static endpoint_t s_endpoints[NET_SERVER_MAX_ENDPOINTS];
+static int s_endpoint_count;
+static client_t s_clients[NET_SERVER_MAX_CLIENTS] = {
+    [0 ... NET_SERVER_MAX_CLIENTS - 1] = { .sock = -1 },
+};
+static uint8_t s_rx_buffer[NET_SERVER_RX_BUF_LEN];
+
+static net_tick_t s_tick;
+static void *s_tick_ctx;
+static int64_t s_tick_period_us;
+static int64_t s_next_tick_us;
+
+static int64_t now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static int add_endpoint(const char *name, uint16_t port, bool stream, net_handler_t handler, void *ctx)
+{
+    if (s_endpoint_count == NET_SERVER_MAX_ENDPOINTS) {
+        ESP_LOGE(TAG, "No free endpoint slot for %s", name);
+        return -1;
+    }
+
+    int sock = socket(AF_INET, stream ? SOCK_STREAM : SOCK_DGRAM, stream ? IPPROTO_TCP : IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create %s socket: errno %d", name, errno);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in local_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        ESP_LOGE(TAG, "Unable to bind %s to port %d: errno %d", name, port, errno);
+        close(sock);
+        return -1;
+    }
+    if (stream && listen(sock, NET_SERVER_MAX_CLIENTS) < 0) {
+        ESP_LOGE(TAG, "Unable to listen on %s port %d: errno %d", name, port, errno);
+        close(sock);
+        return -1;
+    }
+
+    s_endpoints[s_endpoint_count++] = (endpoint_t){
+        .name = name,
+        .sock = sock,
+        .stream = stream,
+        .handler = handler,
+        .ctx = ctx,
+#if CONFIG_UDP_RX_CYCLE_STATS
+        .stats = { .mode = name },
+#endif
+    };
+    ESP_LOGI(TAG, "%s listening on %s port %d", name, stream ? "TCP" : "UDP", port);
+    return sock;
+}
+
+int net_server_add_udp(const char *name, uint16_t port, net_handler_t handler, void *ctx)
+{
+    return add_endpoint(name, port, false, handler, ctx);
+}
+
+int net_server_add_tcp(const char *name, uint16_t port, net_handler_t handler, void *ctx)
+{
+    return add_endpoint(name, port, true, handler, ctx);
+}
+
+void net_server_set_tick(uint32_t period_ms, net_tick_t tick, void *ctx)
+{
+    s_tick = period_ms ? tick : NULL;
+    s_tick_ctx = ctx;
+    s_tick_period_us = (int64_t)period_ms * 1000;
+    s_next_tick_us = now_us() + s_tick_period_us;
+}
+
+int net_server_reply(const net_conn_t *conn, const void *data, size_t len)
+{
+    if (conn->stream) {
+        return send(conn->sock, data, len, 0);
+    }
+    return sendto(conn->sock, data, len, 0, (const struct sockaddr *)&conn->peer, sizeof(conn->peer));
+}
+
+static void service_udp(int idx)
+{
+    endpoint_t *ep = &s_endpoints[idx];
+
+    // The first read cannot block; the rest drain what queued up meanwhile without another select()
+    for (int i = 0; i < NET_SERVER_UDP_BURST; i++) {
+        net_conn_t conn = { .sock = ep->sock, .endpoint = idx };
+        socklen_t socklen = sizeof(conn.peer);
+#if CONFIG_UDP_RX_CYCLE_STATS
+        uint32_t start = rx_stats_begin();
+#endif
+        int len = recvfrom(ep->sock, s_rx_buffer, sizeof(s_rx_buffer), i ? MSG_DONTWAIT : 0,
+                           (struct sockaddr *)&conn.peer, &socklen);
+        if (len < 0) {
+            if (i == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                ESP_LOGE(TAG, "%s recvfrom failed: errno %d", ep->name, errno);
+            }
+            return;
+        }
+        ep->rx_count++;
+        ep->handler(&conn, s_rx_buffer, len, ep->ctx);
+#if CONFIG_UDP_RX_CYCLE_STATS
+        rx_stats_end(&ep->stats, start);
+#endif
+    }
+}
+
+static void service_accept(int idx)
+{
+    endpoint_t *ep = &s_endpoints[idx];
+    struct sockaddr_in peer;
+    socklen_t socklen = sizeof(peer);
+
+    int sock = accept(ep->sock, (struct sockaddr *)&peer, &socklen);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "%s accept failed: errno %d", ep->name, errno);
+        return;
+    }
+    for (int i = 0; i < NET_SERVER_MAX_CLIENTS; i++) {
+        if (s_clients[i].sock < 0) {
+            s_clients[i] = (client_t){ .sock = sock, .endpoint = idx, .peer = peer };
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "%s: all %d client slots busy, refusing connection", ep->name, NET_SERVER_MAX_CLIENTS);
+    close(sock);
+}
+
+static void service_client(client_t *client)
+{
+    endpoint_t *ep = &s_endpoints[client->endpoint];
+
+    int len = recv(client->sock, s_rx_buffer, sizeof(s_rx_buffer), 0);
+    if (len <= 0) {
+        // Orderly close or reset: free the slot for the next connection
+        shutdown(client->sock, 0);
+        close(client->sock);
+        client->sock = -1;
+        return;
+    }
+    net_conn_t conn = { .sock = client->sock, .stream = true, .endpoint = client->endpoint, .peer = client->peer };
+    ep->rx_count++;
+    ep->handler(&conn, s_rx_buffer, len, ep->ctx);
+}
+
+int net_server_poll(int timeout_ms)
+{
+    fd_set readfds;
+    int maxfd = -1;
+
+    FD_ZERO(&readfds);
+    for (int i = 0; i < s_endpoint_count; i++) {
+        FD_SET(s_endpoints[i].sock, &readfds);
+        if (s_endpoints[i].sock > maxfd) {
+            maxfd = s_endpoints[i].sock;
+        }
+    }
+    for (int i = 0; i < NET_SERVER_MAX_CLIENTS; i++) {
+        if (s_clients[i].sock >= 0) {
+            FD_SET(s_clients[i].sock, &readfds);
+            if (s_clients[i].sock > maxfd) {
+                maxfd = s_clients[i].sock;
+            }
+        }
+    }
+
+    // Sleep no longer than the next tick so beacons keep their period under load or idle
+    int64_t wait_us = timeout_ms < 0 ? -1 : (int64_t)timeout_ms * 1000;
+    if (s_tick) {
+        int64_t until_tick = s_next_tick_us - now_us();
+        if (until_tick < 0) {
+            until_tick = 0;
+        }
+        if (wait_us < 0 || until_tick < wait_us) {
+            wait_us = until_tick;
+        }
+    }
+    struct timeval tv = { .tv_sec = wait_us / 1000000, .tv_usec = wait_us % 1000000 };
+
+    int ready = select(maxfd + 1, &readfds, NULL, NULL, wait_us < 0 ? NULL : &tv);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        ESP_LOGE(TAG, "select failed: errno %d", errno);
+        return -1;
+    }
+
+    int serviced = 0;
+    for (int i = 0; i < s_endpoint_count && serviced < ready; i++) {
+        if (FD_ISSET(s_endpoints[i].sock, &readfds)) {
+            if (s_endpoints[i].stream) {
+                service_accept(i);
+            } else {
+                service_udp(i);
+            }
+            serviced++;
+        }
+    }
+    for (int i = 0; i < NET_SERVER_MAX_CLIENTS && serviced < ready; i++) {
+        // A slot filled by service_accept() above was not in this round's set
+        if (s_clients[i].sock >= 0 && FD_ISSET(s_clients[i].sock, &readfds)) {
+            service_client(&s_clients[i]);
+            serviced++;
+        }
+    }
+
+    int64_t now = now_us();
+    if (s_tick && now >= s_next_tick_us) {
+        s_next_tick_us += s_tick_period_us;
+        if (s_next_tick_us <= now) {
+            // A slow handler made us miss periods: skip them rather than firing a burst
+            s_next_tick_us = now + s_tick_period_us;
+        }
+        s_tick(s_tick_ctx);
+    }
+    return serviced;
+}
+
+size_t net_server_format_stats(char *buf, size_t len)
+{
+    size_t pos = 0;
+
+    if (len) {
+        buf[0] = '\0';
+    }
+    for (int i = 0; i < s_endpoint_count && pos < len; i++) {
+        int n = snprintf(buf + pos, len - pos, "%s%s=%u", i ? " " : "",
+                         s_endpoints[i].name, (unsigned)s_endpoints[i].rx_count);
+        if (n < 0) {
+            break;
+        }
+        pos += n;
+    }
+    return pos < len ? pos : len ? len - 1 : 0;
+}
+
+#ifdef ESP_PLATFORM
+static void net_server_task(void *pvParameters)
+{
+    while (1) {
+        if (net_server_poll(-1) < 0) {
+            // select() only fails on a closed descriptor or out of memory, back off instead of spinning
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+
+void net_server_start(void)
+{
+    xTaskCreate(net_server_task, "net_server", NET_SERVER_TASK_STACK, NULL, NET_SERVER_TASK_PRIORITY, NULL);
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef NET_SERVER_H
+#define NET_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "lwip/sockets.h"
+#else
+#include <netinet/in.h>
+#endif
+
+// Sockets are kept in fixed tables, so adding an endpoint costs a table slot, not a task stack
+#define NET_SERVER_MAX_ENDPOINTS 6
+// Accepted TCP connections, shared by all TCP endpoints
+#define NET_SERVER_MAX_CLIENTS   4
+// One receive buffer for every socket: the largest UDP payload that fits a 1500 byte MTU
+#define NET_SERVER_RX_BUF_LEN    1472
+// Datagrams read from one ready UDP socket before the others get their turn
+#define NET_SERVER_UDP_BURST     8
+#define NET_SERVER_TASK_STACK    4096
+#define NET_SERVER_TASK_PRIORITY 5
+
+// Where a received datagram or stream chunk came from; pass it back to net_server_reply()
+typedef struct {
+    int sock;
+    bool stream;
+    int endpoint;
+    struct sockaddr_in peer;
+} net_conn_t;
+
+// Called from the server task with the data read from one socket
+typedef void (*net_handler_t)(const net_conn_t *conn, const uint8_t *data, size_t len, void *ctx);
+
+// Called from the server task every `period_ms`, between socket events
+typedef void (*net_tick_t)(void *ctx);
+
+// Bind a UDP endpoint on `port`. Returns the socket so the caller can add options such as
+// multicast membership, or -1 on error. Endpoints must be added before the server runs.
+int net_server_add_udp(const char *name, uint16_t port, net_handler_t handler, void *ctx);
+
+// Listen for TCP connections on `port`; every chunk read from an accepted connection goes to
+// `handler`. Returns the listening socket or -1 on error.
+int net_server_add_tcp(const char *name, uint16_t port, net_handler_t handler, void *ctx);
+
+// Run `tick` every `period_ms` from the server task (0 disables). Used for periodic beacons.
+void net_server_set_tick(uint32_t period_ms, net_tick_t tick, void *ctx);
+
+// Send `len` bytes back to the sender of `conn`
+int net_server_reply(const net_conn_t *conn, const void *data, size_t len);
+
+// Wait up to `timeout_ms` (-1 forever) for socket events and dispatch them.
+// Returns the number of sockets serviced, or -1 if select() failed.
+int net_server_poll(int timeout_ms);
+
+// Write "name=rx_count" for every endpoint into `buf`. Returns the length written.
+size_t net_server_format_stats(char *buf, size_t len);
+
+#ifdef ESP_PLATFORM
+// Start the single task that services every registered endpoint
+void net_server_start(void);
+#endif
+
+#endif /* NET_SERVER_H */
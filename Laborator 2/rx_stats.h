@@ -0,0 +1,45 @@
+#ifndef RX_STATS_H
+#define RX_STATS_H
+
+#include <stdint.h>
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+// 1: count CPU cycles per received packet in both receive modes
+#define CONFIG_UDP_RX_CYCLE_STATS 0
+// Report the averages every this many packets
+#define RX_STATS_REPORT_EVERY 1000
+
+// Per-packet CPU cycle counter for the UDP receive paths
+typedef struct {
+    const char *mode;
+    uint32_t packets;
+    uint64_t total_cycles;
+    uint32_t max_cycles;
+} rx_stats_t;
+
+static inline uint32_t rx_stats_begin(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+static inline void rx_stats_end(rx_stats_t *stats, uint32_t start)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+    stats->packets++;
+    stats->total_cycles += cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+    if (stats->packets == RX_STATS_REPORT_EVERY) {
+        ESP_LOGI("rx_stats", "%s: %u packets, avg %u cycles/packet, max %u",
+                 stats->mode, (unsigned)stats->packets,
+                 (unsigned)(stats->total_cycles / stats->packets), (unsigned)stats->max_cycles);
+        stats->packets = 0;
+        stats->total_cycles = 0;
+        stats->max_cycles = 0;
+    }
+}
+
+#endif /* RX_STATS_H */
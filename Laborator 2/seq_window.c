@@ -0,0 +1,46 @@
+#include <string.h>
+
+#include "seq_window.h"
+
+static seq_sender_t *find_sender(seq_window_t *w, uint32_t addr, uint16_t port)
+{
+    seq_sender_t *victim = &w->senders[0];
+
+    for (int i = 0; i < SEQ_WINDOW_SENDERS; i++) {
+        seq_sender_t *s = &w->senders[i];
+        if (s->used && s->addr == addr && s->port == port) {
+            return s;
+        }
+        if (!s->used || (victim->used && s->last_use < victim->last_use)) {
+            victim = s;
+        }
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->addr = addr;
+    victim->port = port;
+    return victim;
+}
+
+seq_result_t seq_window_check(seq_window_t *w, uint32_t addr, uint16_t port, uint32_t seq)
+{
+    seq_sender_t *s = find_sender(w, addr, port);
+    s->last_use = ++w->clock;
+
+    // Serial number arithmetic so the window survives the counter wrapping
+    int32_t diff = (int32_t)(seq - s->highest);
+
+    if (!s->used || diff > 0 || diff <= -SEQ_WINDOW_SIZE) {
+        if (s->used && diff > 0 && diff < SEQ_WINDOW_SIZE) {
+            s->seen = (s->seen << diff) | 1;
+        } else {
+            s->seen = 1;
+        }
+        s->highest = seq;
+        s->used = true;
+        return SEQ_NEW;
+    }
+
+    uint64_t bit = 1ULL << -diff;
+    return (s->seen & bit) ? SEQ_DUPLICATE : SEQ_STALE;
+}
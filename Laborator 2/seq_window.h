@@ -0,0 +1,36 @@
+#ifndef SEQ_WINDOW_H
+#define SEQ_WINDOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sequence numbers remembered behind the newest one
+#define SEQ_WINDOW_SIZE 64
+// Distinct senders tracked at once; the least recently heard one is evicted
+#define SEQ_WINDOW_SENDERS 8
+
+typedef enum {
+    SEQ_NEW,        // newest so far, apply it
+    SEQ_DUPLICATE,  // seen before
+    SEQ_STALE,      // older than the newest and not seen, applying it would undo newer state
+} seq_result_t;
+
+typedef struct {
+    uint32_t addr;
+    uint16_t port;
+    bool used;
+    uint32_t last_use;
+    uint32_t highest;
+    uint64_t seen;      // bit i set: highest - i was received
+} seq_sender_t;
+
+typedef struct {
+    seq_sender_t senders[SEQ_WINDOW_SENDERS];
+    uint32_t clock;
+} seq_window_t;
+
+// Classify `seq` from sender addr:port and record it. A sequence number more than
+// SEQ_WINDOW_SIZE behind the newest is taken as a restarted sender and starts a new window.
+seq_result_t seq_window_check(seq_window_t *w, uint32_t addr, uint16_t port, uint32_t seq);
+
+#endif /* SEQ_WINDOW_H */
@@ -0,0 +1,228 @@
+#include <string.h>
+
+#include "gpio_table.h"
+#include "udp_proto.h"
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static inline void wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static proto_node_t s_node = { .id = 0, .groups = 0 };
+
+void proto_set_node(uint16_t id, uint32_t groups)
+{
+    s_node.id = id;
+    s_node.groups = groups;
+}
+
+static inline int selector_matches(uint8_t kind, uint16_t value)
+{
+    switch (kind) {
+    case PROTO_SELECT_ALL:
+        return 1;
+    case PROTO_SELECT_NODE:
+        return value == s_node.id;
+    case PROTO_SELECT_GROUP:
+        return value < 32 && (s_node.groups & (1UL << value));
+    default:
+        return 0;
+    }
+}
+
+static int decode_binary(const uint8_t *buf, size_t len, proto_cmd_t *cmds, size_t max_cmds, uint32_t *seq)
+{
+    if (len < PROTO_HEADER_LEN || buf[2] != PROTO_VERSION) {
+        return -1;
+    }
+
+    size_t count = buf[3];
+    if (count > max_cmds || len != PROTO_HEADER_LEN + count * PROTO_RECORD_LEN) {
+        return -1;
+    }
+
+    *seq = rd32(buf + 4);
+
+    // Records apply to every node until a run of SELECT records narrows them down
+    // to the nodes matching any selector in the run
+    int selected = 1;
+    int in_select = 0;
+    int targeted = 0;
+    size_t n = 0;
+
+    const uint8_t *rec = buf + PROTO_HEADER_LEN;
+    for (size_t i = 0; i < count; i++, rec += PROTO_RECORD_LEN) {
+        if (rec[0] == PROTO_OP_SELECT) {
+            if (!in_select) {
+                selected = 0;
+                in_select = 1;
+            }
+            selected |= selector_matches(rec[1], rd16(rec + 2));
+            targeted = 1;
+            continue;
+        }
+        in_select = 0;
+        if (!selected) {
+            continue;
+        }
+        if (rec[0] == PROTO_OP_ARG) {
+            if (n > 0) {
+                cmds[n - 1].arg = ((uint32_t)rec[1] << 16) | rd16(rec + 2);
+            }
+            continue;
+        }
+        cmds[n].opcode = rec[0];
+        cmds[n].pin = rec[1];
+        cmds[n].value = rd16(rec + 2);
+        cmds[n].arg = 0;
+        n++;
+    }
+
+    // A frame addressed only to other nodes is neither acked nor tracked here
+    if (targeted && n == 0) {
+        *seq = 0;
+    }
+    return (int)n;
+}
+
+static inline int is_separator(char c)
+{
+    return c == ';' || c == ',' || c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+// Text commands "GPIO<pin>=<0|1>", several per datagram separated by ';', ',' or whitespace,
+// optionally with a "SEQ=<n>" token. Each token is decoded in one forward pass; pins are
+// validated against gpio_table.h.
+static int decode_text(const char *buf, size_t len, proto_cmd_t *cmds, size_t max_cmds, uint32_t *seq)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    size_t n = 0;
+
+    while (p < end && n < max_cmds) {
+        while (p < end && is_separator(*p)) {
+            p++;
+        }
+        const char *tok = p;
+        while (p < end && !is_separator(*p)) {
+            p++;
+        }
+        size_t tok_len = p - tok;
+
+        if (tok_len > 4 && memcmp(tok, "SEQ=", 4) == 0) {
+            uint32_t value = 0;
+            const char *q = tok + 4;
+            while (q < p && (unsigned)(*q - '0') <= 9) {
+                value = value * 10 + (*q++ - '0');
+            }
+            if (q == p) {
+                *seq = value;
+            }
+            continue;
+        }
+
+        // Shortest token is "GPIOn=v", longest "GPIOnn=v"
+        if (tok_len < 7 || tok_len > 8 || memcmp(tok, "GPIO", 4) != 0) {
+            continue;
+        }
+
+        unsigned pin = tok[4] - '0';
+        const char *q = tok + 5;
+        if (pin > 9) {
+            continue;
+        }
+        if (tok_len == 8) {
+            unsigned digit = *q++ - '0';
+            if (digit > 9) {
+                continue;
+            }
+            pin = pin * 10 + digit;
+        }
+        if (q[0] != '=' || (q[1] != '0' && q[1] != '1') || !gpio_table_has(pin)) {
+            continue;
+        }
+
+        cmds[n].opcode = PROTO_OP_SET_LEVEL;
+        cmds[n].pin = pin;
+        cmds[n].value = q[1] - '0';
+        cmds[n].arg = 0;
+        n++;
+    }
+    return (int)n;
+}
+
+int proto_decode(const uint8_t *buf, size_t len, proto_cmd_t *cmds, size_t max_cmds, uint32_t *seq)
+{
+    *seq = 0;
+    if (len >= 2 && buf[0] == PROTO_MAGIC0 && buf[1] == PROTO_MAGIC1) {
+        return decode_binary(buf, len, cmds, max_cmds, seq);
+    }
+    return decode_text((const char *)buf, len, cmds, max_cmds, seq);
+}
+
+size_t proto_encode_ack(uint8_t *buf, size_t buf_len, uint32_t seq, proto_ack_status_t status, uint32_t actuate_us)
+{
+    if (buf_len < PROTO_ACK_LEN) {
+        return 0;
+    }
+
+    buf[0] = PROTO_MAGIC0;
+    buf[1] = PROTO_ACK_MAGIC1;
+    buf[2] = PROTO_VERSION;
+    buf[3] = (uint8_t)status;
+    wr32(buf + 4, seq);
+    wr32(buf + 8, actuate_us);
+    return PROTO_ACK_LEN;
+}
+
+size_t proto_encode(uint8_t *buf, size_t buf_len, uint32_t seq, const proto_cmd_t *cmds, size_t count)
+{
+    size_t records = count;
+    for (size_t i = 0; i < count; i++) {
+        records += cmds[i].opcode == PROTO_OP_FADE;
+    }
+
+    size_t len = PROTO_HEADER_LEN + records * PROTO_RECORD_LEN;
+    if (records > PROTO_MAX_RECORDS || len > buf_len) {
+        return 0;
+    }
+
+    buf[0] = PROTO_MAGIC0;
+    buf[1] = PROTO_MAGIC1;
+    buf[2] = PROTO_VERSION;
+    buf[3] = (uint8_t)records;
+    wr32(buf + 4, seq);
+
+    uint8_t *rec = buf + PROTO_HEADER_LEN;
+    for (size_t i = 0; i < count; i++, rec += PROTO_RECORD_LEN) {
+        rec[0] = cmds[i].opcode;
+        rec[1] = cmds[i].pin;
+        wr16(rec + 2, cmds[i].value);
+        if (cmds[i].opcode == PROTO_OP_FADE) {
+            rec += PROTO_RECORD_LEN;
+            rec[0] = PROTO_OP_ARG;
+            rec[1] = (cmds[i].arg >> 16) & 0xff;
+            wr16(rec + 2, cmds[i].arg & 0xffff);
+        }
+    }
+    return len;
+}
@@ -0,0 +1,105 @@
+#ifndef UDP_PROTO_H
+#define UDP_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary command frame (all multi-byte fields little-endian):
+ *   header : magic "IO" | version (1) | record count (1) | sequence number (4)
+ *   record : opcode (1) | pin (1) | value (2), repeated `count` times
+ * Anything that does not start with the magic is parsed as text "GPIO<pin>=<0|1>" commands,
+ * optionally with a "SEQ=<n>" token.
+ *
+ * SELECT records address part of a fleet listening on a multicast group: a run of consecutive
+ * SELECT records (pin = selector kind, value = node id or group index) limits the records that
+ * follow, up to the next run, to the nodes matching any of them. Records before the first
+ * SELECT apply to every node.
+ *
+ * A PROGRAM record (value = passes, 0 = loop forever) uploads every record after it as a timed
+ * program of SET_LEVEL and DELAY steps (pin = PROTO_DELAY_US or PROTO_DELAY_MS, value = amount)
+ * that the device runs locally; STOP halts it.
+ *
+ * SET_DUTY (value = duty, 0..65535 full scale) drives a pin with hardware PWM; FADE (value = target
+ * duty) starts a fade (led_driver.h) whose duration in ms is carried by the ARG record that must follow it
+ * (pin = bits 23..16, value = bits 15..0).
+ *
+ * A non-zero sequence number asks the device for an ack once the commands were actuated:
+ *   ack    : magic "IA" | version (1) | status (1) | sequence number (4) | receive-to-actuate us (4) */
+#define PROTO_MAGIC0        'I'
+#define PROTO_MAGIC1        'O'
+#define PROTO_VERSION       1
+#define PROTO_HEADER_LEN    8
+#define PROTO_RECORD_LEN    4
+#define PROTO_MAX_RECORDS   64
+
+#define PROTO_ACK_MAGIC1    'A'
+#define PROTO_ACK_LEN       12
+
+#define PROTO_MAX_FRAME_LEN (PROTO_HEADER_LEN + PROTO_MAX_RECORDS * PROTO_RECORD_LEN)
+
+typedef enum {
+    PROTO_OP_SET_LEVEL = 1,
+    PROTO_OP_SELECT = 2,
+    PROTO_OP_PROGRAM = 3,
+    PROTO_OP_DELAY = 4,
+    PROTO_OP_STOP = 5,
+    PROTO_OP_SET_DUTY = 6,
+    PROTO_OP_FADE = 7,
+    PROTO_OP_ARG = 8,
+} proto_opcode_t;
+
+typedef enum {
+    PROTO_DELAY_US = 0,
+    PROTO_DELAY_MS = 1,
+} proto_delay_unit_t;
+
+typedef enum {
+    PROTO_SELECT_ALL = 0,
+    PROTO_SELECT_NODE = 1,      // value: node id
+    PROTO_SELECT_GROUP = 2,     // value: group index 0..31
+} proto_select_t;
+
+typedef struct {
+    uint16_t id;
+    uint32_t groups;    // bit i set: member of group i
+} proto_node_t;
+
+typedef enum {
+    PROTO_ACK_OK = 0,           // commands actuated
+    PROTO_ACK_DUPLICATE = 1,    // already actuated earlier, not applied again
+    PROTO_ACK_STALE = 2,        // older than a sequence already applied, dropped
+    PROTO_ACK_EMPTY = 3,        // nothing applicable in the datagram
+    PROTO_ACK_BUSY = 4,         // command queue full, nothing applied: send it again
+} proto_ack_status_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t pin;
+    uint16_t value;
+    uint32_t arg;       // folded in from a following ARG record, 0 otherwise
+} proto_cmd_t;
+
+// Where and when a datagram was received
+typedef struct {
+    uint32_t seq;       // 0 when the sender did not ask for an ack
+    int64_t rx_time;    // esp_timer_get_time() at receive
+    uint32_t addr;      // IPv4 source address, network byte order
+    uint16_t port;      // source port, network byte order
+} proto_rx_info_t;
+
+// Set the node id and group membership SELECT records are matched against
+void proto_set_node(uint16_t id, uint32_t groups);
+
+// Decode one datagram into at most `max_cmds` commands.
+// `buf` is only read, so it can point straight into a network buffer.
+// Returns the number of decoded commands for this node, or -1 if the datagram is malformed.
+int proto_decode(const uint8_t *buf, size_t len, proto_cmd_t *cmds, size_t max_cmds, uint32_t *seq);
+
+// Encode an ack into `buf`; returns PROTO_ACK_LEN or 0 if it does not fit.
+size_t proto_encode_ack(uint8_t *buf, size_t buf_len, uint32_t seq, proto_ack_status_t status, uint32_t actuate_us);
+
+// Encode a binary frame into `buf`, adding the ARG record after every FADE;
+// returns the frame length or 0 if it does not fit.
+size_t proto_encode(uint8_t *buf, size_t buf_len, uint32_t seq, const proto_cmd_t *cmds, size_t count);
+
+#endif /* UDP_PROTO_H */
@@ -0,0 +1,107 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/igmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+#include "rx_stats.h"
+#include "udp_raw_rx.h"
+
+static const char *TAG = "udp_raw_rx";
+
+static struct udp_pcb *s_pcb;
+static udp_raw_rx_handler_t s_handler;
+static uint16_t s_port;
+static const char *s_mcast_group;
+#if CONFIG_UDP_RX_CYCLE_STATS
+static rx_stats_t s_stats = { .mode = "raw" };
+#endif
+
+// Runs in the tcpip thread for every datagram that reaches our port
+static void udp_raw_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+#if CONFIG_UDP_RX_CYCLE_STATS
+    uint32_t start = rx_stats_begin();
+#endif
+    proto_rx_info_t rx = {
+        .rx_time = esp_timer_get_time(),
+        .addr = ip_2_ip4(addr)->addr,
+        .port = lwip_htons(port),
+    };
+    // Static: only the tcpip thread runs this, and its stack is small for what the handler
+    // goes on to do (actuator_submit(), programs, logging)
+    static proto_cmd_t cmds[PROTO_MAX_RECORDS];
+    static uint8_t chained[PROTO_MAX_FRAME_LEN];
+    const uint8_t *data = p->payload;
+
+    if (esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+        char addr_str[IPADDR_STRLEN_MAX];
+        ipaddr_ntoa_r(addr, addr_str, sizeof(addr_str));
+        ESP_LOGD(TAG, "Received %d bytes from %s:%d", p->tot_len, addr_str, port);
+    }
+
+    // Small datagrams fit in one pbuf; only a chained one needs copying to be contiguous
+    if (p->len != p->tot_len) {
+        if (p->tot_len > sizeof(chained)) {
+            ESP_LOGW(TAG, "Dropping oversized %d byte datagram", p->tot_len);
+            pbuf_free(p);
+            return;
+        }
+        pbuf_copy_partial(p, chained, p->tot_len, 0);
+        data = chained;
+    }
+
+    int n = proto_decode(data, p->tot_len, cmds, PROTO_MAX_RECORDS, &rx.seq);
+    if (n < 0) {
+        ESP_LOGW(TAG, "Dropping malformed %d byte datagram", p->tot_len);
+    } else {
+        s_handler(cmds, n, &rx);
+    }
+    pbuf_free(p);
+#if CONFIG_UDP_RX_CYCLE_STATS
+    rx_stats_end(&s_stats, start);
+#endif
+}
+
+static void udp_raw_setup(void *ctx)
+{
+    err_t err = ERR_MEM;
+
+    s_pcb = udp_new();
+    if (s_pcb) {
+        err = udp_bind(s_pcb, IP_ADDR_ANY, s_port);
+    }
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Unable to bind raw UDP port %d: %d", s_port, err);
+        if (s_pcb) {
+            udp_remove(s_pcb);
+            s_pcb = NULL;
+        }
+        return;
+    }
+    udp_recv(s_pcb, udp_raw_recv, NULL);
+    ESP_LOGI(TAG, "Raw UDP receive bound, port %d", s_port);
+
+    ip4_addr_t group;
+    if (s_mcast_group && s_mcast_group[0] && ip4addr_aton(s_mcast_group, &group)) {
+        err = igmp_joingroup(IP4_ADDR_ANY4, &group);
+        if (err != ERR_OK) {
+            ESP_LOGE(TAG, "Unable to join multicast group %s: %d", s_mcast_group, err);
+        } else {
+            ESP_LOGI(TAG, "Joined multicast group %s", s_mcast_group);
+        }
+    }
+}
+
+esp_err_t udp_raw_rx_start(uint16_t port, const char *mcast_group, udp_raw_rx_handler_t handler)
+{
+    s_handler = handler;
+    s_port = port;
+    s_mcast_group = mcast_group;
+
+    // The raw API may only be used from the tcpip thread
+    return tcpip_callback(udp_raw_setup, NULL) == ERR_OK ? ESP_OK : ESP_FAIL;
+}
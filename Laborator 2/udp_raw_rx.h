@@ -0,0 +1,16 @@
+#ifndef UDP_RAW_RX_H
+#define UDP_RAW_RX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "udp_proto.h"
+
+// Called from the lwIP thread with the commands decoded from one datagram
+typedef bool (*udp_raw_rx_handler_t)(const proto_cmd_t *cmds, int count, const proto_rx_info_t *rx);
+
+// Receive UDP commands on `port` through the lwIP raw API, decoding straight out of the pbuf.
+// If `mcast_group` is a non-empty dotted address, that IPv4 multicast group is joined as well.
+esp_err_t udp_raw_rx_start(uint16_t port, const char *mcast_group, udp_raw_rx_handler_t handler);
+
+#endif /* UDP_RAW_RX_H */
@@ -1,20 +1,365 @@
+"""Load generator and latency profiler for the UDP control protocol (see udp_proto.h).
+
+Without arguments it behaves like the original script: toggle GPIO4 on PEER_IP once per second.
+Every command carries a sequence number, so the device acks it and the tool can report loss,
+RTT percentiles and the device-side receive-to-actuate time.
+
+Examples:
+  python udp_sender.py                                    # 1 cmd/s to PEER_IP, like before
+  python udp_sender.py --stand-in --rate 5000 --duration 10
+  python udp_sender.py -t 192.168.89.31 -t 192.168.89.32 --rate 200 --mix text:1,binary:3 \\
+      --batch 8 --pins 4,5,18 --csv run.csv --json run.json
+  python udp_sender.py --group 239.10.0.1 --select group:0 --mix binary --expect 24 --rate 50
+  python udp_sender.py --program "4=1,100ms,4=0,400ms" --repeat 0   # device blinks on its own
+"""
+import argparse
+import asyncio
+import csv
+import json
+import random
+import signal
 import socket
+import struct
 import time
 
 # Update with the IP address of your ESP32
 PEER_IP = "192.168.89.31"  # Replace with actual IP address
 PEER_PORT = 10001
 
-commands = ["GPIO4=0", "GPIO4=1"]
-i = 0
+OP_SET_LEVEL = 1
+OP_SELECT = 2
+OP_PROGRAM = 3
+OP_DELAY = 4
+OP_STOP = 5
+OP_SET_DUTY = 6
+OP_FADE = 7
+OP_ARG = 8
+DELAY_US = 0
+DELAY_MS = 1
+SELECTORS = {"all": 0, "node": 1, "group": 2}
+ACK_STATUS = {0: "ok", 1: "duplicate", 2: "stale", 3: "empty", 4: "busy"}
+PERCENTILES = (("p50", 50), ("p99", 99), ("p999", 99.9))
+
+
+def encode_frame(seq, records):
+    """Build a binary frame from (opcode, pin, value) records."""
+    frame = struct.pack("<2sBBI", b"IO", 1, len(records), seq)
+    for opcode, pin, value in records:
+        frame += struct.pack("<BBH", opcode, pin, value)
+    return frame
+
+
+def encode_ack(seq, status, actuate_us):
+    return struct.pack("<2sBBII", b"IA", 1, status, seq, actuate_us)
+
+
+def decode_ack(data):
+    """Return (seq, status, actuate_us) or None if `data` is not an ack."""
+    if len(data) != 12 or data[:2] != b"IA":
+        return None
+    _, _, status, seq, actuate_us = struct.unpack("<2sBBII", data)
+    return seq, status, actuate_us
+
+
+def decode_seq(data):
+    """Sequence number of a command datagram, 0 if it has none."""
+    if data[:2] == b"IO" and len(data) >= 8:
+        return struct.unpack_from("<I", data, 4)[0]
+    for token in data.replace(b",", b";").split(b";"):
+        token = token.strip()
+        if token.startswith(b"SEQ=") and token[4:].isdigit():
+            return int(token[4:])
+    return 0
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return None
+    k = max(0, min(len(sorted_values) - 1, int(round(p / 100.0 * len(sorted_values) + 0.5)) - 1))
+    return sorted_values[k]
+
+
+class StandInDevice(asyncio.DatagramProtocol):
+    """Local stand-in for the ESP32: acks every sequenced command immediately."""
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        seq = decode_seq(data)
+        if seq:
+            self.transport.sendto(encode_ack(seq, 0, 0), addr)
+
+
+class Target(asyncio.DatagramProtocol):
+    """One device (or multicast group) under load: sends commands and matches acks to them.
+
+    A multicast target keeps each command pending until the ack timeout and records one row
+    per responding device."""
+
+    def __init__(self, host, port, records, multicast=False):
+        self.host = host
+        self.port = port
+        self.records = records
+        self.multicast = multicast
+        self.pending = {}
+        self.next_seq = 1
+        self.sent = 0
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def send(self, payload, seq, kind, ncmds):
+        self.pending[seq] = [time.perf_counter_ns(), kind, ncmds, 0]
+        self.transport.sendto(payload, (self.host, self.port))
+        self.sent += 1
+
+    def record(self, responder, seq, entry, rtt_us, status, actuate_us):
+        sent_ns, kind, ncmds, _ = entry
+        self.records.append({
+            "target": responder, "seq": seq, "kind": kind, "commands": ncmds, "sent_ns": sent_ns,
+            "rtt_us": rtt_us, "status": status, "actuate_us": actuate_us,
+        })
+
+    def datagram_received(self, data, addr):
+        ack = decode_ack(data)
+        if not ack or ack[0] not in self.pending:
+            return
+        seq, status, actuate_us = ack
+        entry = self.pending[seq] if self.multicast else self.pending.pop(seq)
+        entry[3] += 1
+        rtt_us = round((time.perf_counter_ns() - entry[0]) / 1000.0, 1)
+        self.record("{}:{}".format(*addr), seq, entry, rtt_us, ACK_STATUS.get(status, status), actuate_us)
+
+    def expire(self, timeout_s):
+        """Record commands nobody acked within `timeout_s` as lost."""
+        deadline = time.perf_counter_ns() - int(timeout_s * 1e9)
+        for seq in [s for s, e in self.pending.items() if e[0] < deadline]:
+            entry = self.pending.pop(seq)
+            if not entry[3]:
+                self.record("{}:{}".format(self.host, self.port), seq, entry, None, "lost", None)
+
+
+def parse_selectors(specs):
+    """--select all | node:<id> | group:<index> -> SELECT records."""
+    records = []
+    for spec in specs or []:
+        kind, _, value = spec.partition(":")
+        records.append((OP_SELECT, SELECTORS[kind], int(value or 0)))
+    return records
+
+
+def parse_program(text):
+    """"4=1,100ms,4=0,250us" -> SET_LEVEL and DELAY records."""
+    records = []
+    for step in text.split(","):
+        step = step.strip()
+        if "=" in step:
+            pin, _, value = step.partition("=")
+            records.append((OP_SET_LEVEL, int(pin.replace("GPIO", "")), int(value)))
+        elif step.endswith("ms"):
+            records.append((OP_DELAY, DELAY_MS, int(step[:-2])))
+        elif step.endswith("us"):
+            records.append((OP_DELAY, DELAY_US, int(step[:-2])))
+        else:
+            raise ValueError("bad program step: " + step)
+    return records
+
+
+def send_once(args, records):
+    """Send a single sequenced frame to every target and report its ack."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(args.ack_timeout)
+    seq = random.randint(1, 2 ** 31)
+    frame = encode_frame(seq, parse_selectors(args.select) + records)
+    targets = args.target or ["{}:{}".format(PEER_IP, PEER_PORT)]
+    for spec in targets:
+        host, _, port = spec.partition(":")
+        sock.sendto(frame, (host, int(port or PEER_PORT)))
+    print("Sent {} byte frame with {} records to {} target(s)".format(len(frame), len(records), len(targets)))
+    for _ in targets:
+        try:
+            data, addr = sock.recvfrom(64)
+        except socket.timeout:
+            print("no ack")
+            return
+        ack = decode_ack(data)
+        if ack and ack[0] == seq:
+            print("ack from {}: {}".format(addr[0], ACK_STATUS.get(ack[1], ack[1])))
+
+
+def make_command(target, kind, batch, pins, verbose, selectors=()):
+    seq = target.next_seq
+    target.next_seq += 1
+    if kind in ("binary", "duty", "fade"):
+        if kind == "binary":
+            records = [(OP_SET_LEVEL, random.choice(pins), random.getrandbits(1)) for _ in range(batch)]
+        elif kind == "duty":
+            records = [(OP_SET_DUTY, random.choice(pins), random.getrandbits(16)) for _ in range(batch)]
+        else:
+            # One hardware fade per pin, its duration in the ARG record that follows
+            records = []
+            for pin in pins[:batch]:
+                fade_ms = random.randint(100, 2000)
+                records += [(OP_FADE, pin, random.getrandbits(16)), (OP_ARG, fade_ms >> 16, fade_ms & 0xffff)]
+        payload = encode_frame(seq, list(selectors) + records)
+        text = "frame seq={} records={}".format(seq, len(records))
+        # ARG records only carry a fade's duration, they are not commands of their own
+        ncmds = sum(1 for record in records if record[0] != OP_ARG)
+    else:
+        # Text commands toggle GPIO4-style like the original script, one pin per datagram
+        command = "GPIO{}={}".format(pins[seq % len(pins)], seq % 2)
+        payload = "SEQ={};{}".format(seq, command).encode()
+        text = command
+        ncmds = 1
+    if verbose:
+        print("Sent command:", text)
+    return payload, seq, kind, ncmds
+
+
+async def run(args):
+    loop = asyncio.get_running_loop()
+    records = []
+    stop = asyncio.Event()
+    try:
+        loop.add_signal_handler(signal.SIGINT, stop.set)
+    except NotImplementedError:
+        pass  # Windows: Ctrl-C aborts without a summary
+
+    if args.stand_in:
+        await loop.create_datagram_endpoint(StandInDevice, local_addr=("127.0.0.1", args.stand_in_port))
+        targets = ["127.0.0.1:{}".format(args.stand_in_port)]
+    elif args.group:
+        targets = args.target or []
+    else:
+        targets = args.target or ["{}:{}".format(PEER_IP, PEER_PORT)]
+
+    devices = []
+    for spec in targets:
+        host, _, port = spec.partition(":")
+        port = int(port or PEER_PORT)
+        transport, proto = await loop.create_datagram_endpoint(
+            lambda h=host, p=port: Target(h, p, records), local_addr=("0.0.0.0", 0))
+        devices.append(proto)
+
+    if args.group:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, args.ttl)
+        if args.mcast_if:
+            sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(args.mcast_if))
+        sock.bind(("0.0.0.0", 0))
+        _, proto = await loop.create_datagram_endpoint(
+            lambda: Target(args.group, PEER_PORT, records, multicast=True), sock=sock)
+        devices.append(proto)
+    selectors = parse_selectors(args.select)
+
+    mix = []
+    for item in args.mix.split(","):
+        kind, _, weight = item.partition(":")
+        mix += [kind] * int(weight or 1)
+    pins = [int(p) for p in args.pins.split(",")]
+    verbose = args.rate <= 10
+
+    # Send whatever the schedule says is due on each tick, so rates above the
+    # event loop's timer resolution still come out right on average
+    start = time.perf_counter()
+    total = args.count if args.count else args.rate * args.duration
+    issued = 0
+    while issued < total and not stop.is_set():
+        due = min(total, int((time.perf_counter() - start) * args.rate) + 1)
+        while issued < due:
+            for device in devices:
+                device.send(*make_command(device, random.choice(mix), args.batch, pins, verbose, selectors))
+            issued += 1
+        for device in devices:
+            device.expire(args.ack_timeout)
+        next_due = start + issued / args.rate
+        await asyncio.sleep(min(0.05, max(0.0005, next_due - time.perf_counter())))
+    elapsed = time.perf_counter() - start
+
+    await asyncio.sleep(args.ack_timeout)
+    for device in devices:
+        device.expire(0)
+    return records, sum(d.sent for d in devices), elapsed
+
+
+def summarize(records, sent, elapsed, args):
+    acked = [r for r in records if r["rtt_us"] is not None]
+    rtts = sorted(r["rtt_us"] for r in acked)
+    actuate = sorted(r["actuate_us"] for r in acked if r["status"] == "ok")
+    responders = {r["target"] for r in acked}
+    # Every datagram should be acked once per device; a multicast datagram once per group member
+    expected = sent * (args.expect or max(1, len(responders))) if args.group else sent
+    return {
+        "targets": len(responders),
+        "datagrams_sent": sent,
+        "acks_expected": expected,
+        "acks_received": len(acked),
+        "loss_pct": round(100.0 * (expected - len(acked)) / expected, 3) if expected else 0.0,
+        "commands_per_sec": round(sum(r["commands"] for r in acked) / elapsed, 1) if elapsed else 0.0,
+        "statuses": {s: sum(1 for r in records if r["status"] == s) for s in sorted({r["status"] for r in records})},
+        "rtt_us": {p: percentile(rtts, q) for p, q in PERCENTILES},
+        "actuate_us": {p: percentile(actuate, q) for p, q in PERCENTILES},
+        "rate": args.rate,
+        "mix": args.mix,
+        "batch": args.batch,
+    }
+
+
+def positive_float(text):
+    value = float(text)
+    if not value > 0:
+        raise argparse.ArgumentTypeError("must be greater than 0")
+    return value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-t", "--target", action="append", help="device ip[:port], repeatable")
+    parser.add_argument("--rate", type=positive_float, default=1.0, help="datagrams/sec per target")
+    parser.add_argument("--duration", type=float, default=float("inf"), help="seconds to run")
+    parser.add_argument("--count", type=int, default=0, help="datagrams per target (overrides --duration)")
+    parser.add_argument("--mix", default="text:1", help="payload mix of text, binary, duty and fade, e.g. text:1,binary:3")
+    parser.add_argument("--batch", type=int, default=1, help="records per binary frame")
+    parser.add_argument("--pins", default="4", help="comma separated GPIOs to drive")
+    parser.add_argument("--ack-timeout", type=float, default=0.5, help="seconds before a command counts as lost")
+    parser.add_argument("--group", help="also send to this IPv4 multicast group at PEER_PORT")
+    parser.add_argument("--select", action="append", help="binary frames only: all | node:<id> | group:<n>, repeatable")
+    parser.add_argument("--expect", type=int, default=0, help="devices expected to ack each multicast datagram")
+    parser.add_argument("--mcast-if", help="local interface address for multicast, e.g. 127.0.0.1")
+    parser.add_argument("--ttl", type=int, default=1, help="multicast TTL")
+    parser.add_argument("--program", help="upload a timed program, e.g. \"4=1,100ms,4=0,400ms\"")
+    parser.add_argument("--repeat", type=int, default=1, help="program passes, 0 loops forever")
+    parser.add_argument("--stop", action="store_true", help="stop the running program")
+    parser.add_argument("--stand-in", action="store_true", help="run against a local stand-in device")
+    parser.add_argument("--stand-in-port", type=int, default=PEER_PORT)
+    parser.add_argument("--csv", help="write one row per datagram")
+    parser.add_argument("--json", help="write the summary")
+    args = parser.parse_args()
+
+    if args.program:
+        send_once(args, [(OP_PROGRAM, 0, args.repeat)] + parse_program(args.program))
+        return
+    if args.stop:
+        send_once(args, [(OP_STOP, 0, 0)])
+        return
 
-sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-while 1:
     try:
-        command = commands[i % 2]
-        sock.sendto(command.encode(), (PEER_IP, PEER_PORT))
-        print("Sent command:", command)
-        i = i + 1
-        time.sleep(1)
+        records, sent, elapsed = asyncio.run(run(args))
     except KeyboardInterrupt:
-        break
+        return
+
+    summary = summarize(records, sent, elapsed, args)
+    print(json.dumps(summary, indent=2))
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(records[0].keys()) if records else ["seq"])
+            writer.writeheader()
+            writer.writerows(sorted(records, key=lambda r: r["sent_ns"]))
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(summary, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,320 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_http_client.h"
+#include "spi_flash_mmap.h"
+
+#include "compressed_ota.h"
+#include "ota_inflate.h"
+#include "ota_pipeline.h"
+#include "ota_resume.h"
+#include "ota_stats.h"
+#include "ota_verify.h"
+
+static const char *TAG = "compressed_ota";
+
+// Writes the image at increasing offsets, erasing each flash sector just before its first
+// write. Unlike esp_ota_write() this can start anywhere, which is what resuming needs.
+typedef struct {
+    esp_ota_handle_t handle;
+    const esp_partition_t *partition;
+    uint32_t offset;
+    uint32_t erased_end;
+    ota_verify_t *verify;  // manifest chunk digests, NULL when there are none
+    ota_stats_t *stats;    // verify, erase and write phases, timed on the writer task
+    esp_err_t err;         // why the last write failed
+} flash_writer_t;
+
+static esp_err_t flash_write_checked(flash_writer_t *w, const void *buf, size_t len)
+{
+    int64_t start_us;
+
+    if (w->verify) {
+        start_us = ota_stats_now();
+        int result = ota_verify_update(w->verify, buf, len);
+        ota_stats_add(w->stats, OTA_PHASE_VERIFY, ota_stats_now() - start_us, len);
+        if (result != 0) {
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+    if (w->offset + len > w->partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (w->erased_end < w->offset + len) {
+        start_us = ota_stats_now();
+        esp_err_t err = esp_partition_erase_range(w->partition, w->erased_end, SPI_FLASH_SEC_SIZE);
+        ota_stats_add(w->stats, OTA_PHASE_ERASE, ota_stats_now() - start_us, SPI_FLASH_SEC_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        w->erased_end += SPI_FLASH_SEC_SIZE;
+    }
+    start_us = ota_stats_now();
+    esp_err_t err = esp_ota_write_with_offset(w->handle, buf, len, w->offset);
+    ota_stats_add(w->stats, OTA_PHASE_WRITE, ota_stats_now() - start_us, len);
+    if (err == ESP_OK) {
+        w->offset += len;
+    }
+    return err;
+}
+
+static esp_err_t flash_write(flash_writer_t *w, const void *buf, size_t len)
+{
+    w->err = flash_write_checked(w, buf, len);
+    return w->err;
+}
+
+static int inflate_write(const uint8_t *buf, size_t len, void *ctx)
+{
+    return flash_write(ctx, buf, len) == ESP_OK ? 0 : -1;
+}
+
+// Everything the writer task touches while the download task keeps receiving
+typedef struct {
+    flash_writer_t writer;
+    ota_inflate_t *inflate;
+    ota_resume_t progress;
+    uint32_t in_offset;      // response body bytes written (or decompressed) so far
+    uint32_t body_len;       // whole response body, UINT32_MAX when the server did not say
+    ota_inflate_status_t inflate_status;
+    esp_err_t err;
+} download_t;
+
+// Writer task: one received buffer into flash, checkpointing as it goes
+static int write_chunk(const uint8_t *buf, size_t len, void *ctx)
+{
+    download_t *d = ctx;
+
+    // A checkpoint at the end of the body would resume with an empty range (HTTP 416) and
+    // skip the check of the last chunk, so only the ones before it are saved
+    if (!d->progress.compressed) {
+        d->err = flash_write(&d->writer, buf, len);
+        d->in_offset += len;
+        uint32_t checkpoint = d->writer.offset - d->writer.offset % OTA_RESUME_CHECKPOINT;
+        if (d->err == ESP_OK && checkpoint != d->progress.out_offset && checkpoint < d->body_len) {
+            d->progress.out_offset = checkpoint;
+            d->progress.in_offset = checkpoint;
+            ota_resume_save(&d->progress);
+        }
+        return d->err == ESP_OK ? 0 : -1;
+    }
+    // The decompressor writes flash as it goes; that time is already counted by flash_write()
+    const uint32_t nested = OTA_PHASE_BIT(OTA_PHASE_VERIFY) | OTA_PHASE_BIT(OTA_PHASE_ERASE) |
+                            OTA_PHASE_BIT(OTA_PHASE_WRITE);
+    for (size_t pos = 0; pos < len; ) {
+        size_t used;
+        int64_t start_us = ota_stats_now();
+        int64_t nested_us = ota_stats_nested_us(d->writer.stats, nested);
+        d->inflate_status = ota_inflate_feed(d->inflate, buf + pos, len - pos, &used);
+        ota_stats_add(d->writer.stats, OTA_PHASE_INFLATE, ota_stats_now() - start_us -
+                      (ota_stats_nested_us(d->writer.stats, nested) - nested_us), used);
+        pos += used;
+        d->in_offset += used;
+        if (d->inflate_status == OTA_INFLATE_ERROR) {
+            // A corrupt stream, or the flash write under the decompressor failed
+            d->err = d->writer.err != ESP_OK ? d->writer.err : ESP_ERR_INVALID_RESPONSE;
+            return -1;
+        }
+        // Segment ends on a chunk boundary, where ota_verify_new() can pick up again
+        if (d->inflate_status == OTA_INFLATE_SEGMENT && d->writer.offset % OTA_VERIFY_CHUNK_LEN == 0 &&
+            d->in_offset < d->body_len) {
+            d->progress.in_offset = d->in_offset;
+            d->progress.out_offset = d->writer.offset;
+            ota_resume_save(&d->progress);
+        }
+    }
+    return 0;
+}
+
+esp_err_t compressed_ota_run(ota_session_t *s, const char *path, const ota_manifest_t *manifest)
+{
+    esp_http_client_handle_t client = s->client;
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    download_t d = { .inflate_status = OTA_INFLATE_MORE };
+    ota_resume_t *progress = &d.progress;
+    char range[32];
+
+    bool resuming = ota_resume_load(progress) == ESP_OK && progress->partition == update->address;
+
+    ota_session_request(s, path);
+    esp_http_client_set_header(client, "Accept-Encoding", OTA_INFLATE_ENCODING);
+    if (resuming) {
+        // If-Range: the server only sends the rest if the file is still the one we started on
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned)progress->in_offset);
+        esp_http_client_set_header(client, "Range", range);
+        esp_http_client_set_header(client, "If-Range", progress->etag);
+    }
+
+    int status;
+    int64_t content_len;
+    esp_err_t err = ota_session_send(s, &status, &content_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    char *encoding = NULL;
+    char *etag = NULL;
+    esp_http_client_get_header(client, "Content-Encoding", &encoding);
+    esp_http_client_get_header(client, "ETag", &etag);
+
+    if (status == 206 && resuming) {
+        ESP_LOGI(TAG, "Resuming at byte %u of the download, %u bytes already flashed",
+                 (unsigned)progress->in_offset, (unsigned)progress->out_offset);
+    } else if (status == 200) {
+        if (resuming) {
+            ESP_LOGI(TAG, "Firmware changed since the interrupted download, starting over");
+        }
+        memset(progress, 0, sizeof(*progress));
+        progress->compressed = encoding && strcmp(encoding, OTA_INFLATE_ENCODING) == 0;
+        progress->partition = update->address;
+        if (etag) {
+            strlcpy(progress->etag, etag, sizeof(progress->etag));
+        }
+    } else if (status == 416 && resuming) {
+        // The saved offset is past the end of the body: the progress is useless, start over.
+        // Only once, the progress is gone now.
+        ESP_LOGW(TAG, "Saved progress is past the end of the download, starting over");
+        ota_resume_clear();
+        ota_session_finish(s);
+        return compressed_ota_run(s, path, manifest);
+    } else if (s->retry_after_ms) {
+        // Not a failed attempt: any progress stays for when the server has room
+        ESP_LOGW(TAG, "Server busy (HTTP %d), retry in %u s", status, (unsigned)(s->retry_after_ms / 1000));
+        ota_session_finish(s);
+        return ESP_ERR_NOT_FINISHED;
+    } else {
+        ESP_LOGE(TAG, "Firmware download failed: HTTP %d", status);
+        ota_session_finish(s);
+        return ESP_FAIL;
+    }
+
+    d.writer.partition = update;
+    d.writer.stats = &s->stats;
+    d.writer.offset = progress->out_offset;
+    d.writer.erased_end = progress->out_offset;
+    d.in_offset = progress->in_offset;
+    d.body_len = content_len > 0 ? progress->in_offset + content_len : UINT32_MAX;
+    ota_pipeline_t *pipeline = NULL;
+    ESP_LOGI(TAG, "Downloading %lld byte %s image to partition %s",
+             content_len, progress->compressed ? "compressed" : "raw", update->label);
+
+    // Sequential-writes mode erases nothing up front, flash_write() erases as it goes
+    err = esp_ota_begin(update, OTA_WITH_SEQUENTIAL_WRITES, &d.writer.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        goto cleanup;
+    }
+    if (progress->compressed) {
+        d.inflate = ota_inflate_new(inflate_write, &d.writer);
+        if (d.inflate == NULL) {
+            err = ESP_ERR_NO_MEM;
+            goto cleanup;
+        }
+    }
+    // Checkpoints are chunk aligned, so a resumed download picks up at a chunk boundary
+    if (manifest && manifest->chunk_count) {
+        d.writer.verify = ota_verify_new(manifest->chunks, manifest->chunk_count, d.writer.offset);
+    }
+    if (d.writer.verify == NULL) {
+        ESP_LOGW(TAG, "No chunk digests, the image is only checked once it is complete");
+    }
+    // Buffers the heap can spare, in one block; a busy heap gets a shallower pipeline
+    int count = ota_memory_buffers(COMPRESSED_OTA_BUF_LEN, COMPRESSED_OTA_BUF_COUNT);
+    if (count == 0) {
+        ESP_LOGE(TAG, "Not enough heap for a %d byte receive buffer", COMPRESSED_OTA_BUF_LEN);
+        err = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    if (count < COMPRESSED_OTA_BUF_COUNT) {
+        ESP_LOGW(TAG, "Heap is short, receiving into %d buffers instead of %d", count,
+                 COMPRESSED_OTA_BUF_COUNT);
+    }
+    pipeline = ota_pipeline_new(COMPRESSED_OTA_BUF_LEN, count, write_chunk, &d);
+    if (pipeline == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    // This task only receives; erasing, writing, decompressing and checkpointing happen on
+    // the pipeline's writer task while the next buffers arrive
+    bool interrupted = false;
+    for (int reads = 0; ; reads++) {
+        if (reads % 16 == 0) {
+            ota_memory_sample(&s->memory);
+        }
+        uint8_t *buf = ota_pipeline_acquire(pipeline);
+        if (buf == NULL) {
+            break;
+        }
+        int64_t start_us = ota_stats_now();
+        int len = esp_http_client_read(client, (char *)buf, ota_pipeline_buf_len(pipeline));
+        ota_stats_add(&s->stats, OTA_PHASE_RECEIVE, ota_stats_now() - start_us, len > 0 ? len : 0);
+        if (len <= 0) {
+            ota_pipeline_submit(pipeline, buf, 0);
+            interrupted = len < 0;
+            break;
+        }
+        ota_session_first_byte(s);
+        ota_pipeline_submit(pipeline, buf, len);
+    }
+    ota_pipeline_drain(pipeline);
+    if (d.err == ESP_ERR_INVALID_CRC) {
+        // Nothing past the last checkpoint is kept, and everything before it matched; the next
+        // attempt downloads this chunk again
+        err = d.err;
+        ESP_LOGE(TAG, "Image chunk %d does not match the manifest, stopped at byte %u",
+                 ota_verify_chunk(d.writer.verify), (unsigned)d.in_offset);
+        goto cleanup;
+    }
+    if (d.err != ESP_OK) {
+        err = d.err;
+        ESP_LOGE(TAG, "Image rejected at byte %u: %s", (unsigned)d.in_offset, esp_err_to_name(err));
+        ota_resume_clear();
+        goto cleanup;
+    }
+    if (interrupted) {
+        // Progress stays in NVS, the next attempt continues from the last checkpoint
+        ESP_LOGE(TAG, "Download interrupted at byte %u", (unsigned)d.in_offset);
+        err = ESP_ERR_TIMEOUT;
+        goto cleanup;
+    }
+    if (!esp_http_client_is_complete_data_received(client) ||
+        (progress->compressed && d.inflate_status != OTA_INFLATE_SEGMENT)) {
+        ESP_LOGE(TAG, "Download truncated at byte %u", (unsigned)d.in_offset);
+        err = ESP_ERR_TIMEOUT;
+        goto cleanup;
+    }
+    if (d.writer.verify && ota_verify_finish(d.writer.verify) != 0) {
+        ESP_LOGE(TAG, "Image chunk %d does not match the manifest", ota_verify_chunk(d.writer.verify));
+        err = ESP_ERR_INVALID_CRC;
+        goto cleanup;
+    }
+
+    // A bad image must not be resumed either; whatever happens next starts from scratch
+    ota_resume_clear();
+    int64_t finalize_us = ota_stats_now();
+    err = esp_ota_end(d.writer.handle);
+    d.writer.handle = 0;
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(update);
+    }
+    ota_stats_add(&s->stats, OTA_PHASE_FINALIZE, ota_stats_now() - finalize_us, d.writer.offset);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Image written: %u bytes flashed", (unsigned)d.writer.offset);
+    } else {
+        ESP_LOGE(TAG, "Downloaded image invalid: %s", esp_err_to_name(err));
+    }
+
+cleanup:
+    if (err != ESP_OK) {
+        // The response may be half read; the next request has to start on a fresh connection
+        esp_http_client_close(client);
+    }
+    // The writer task goes first, it may still be using the decompressor and the OTA handle
+    ota_pipeline_free(pipeline);
+    ota_inflate_free(d.inflate);
+    ota_verify_free(d.writer.verify);
+    if (d.writer.handle) {
+        esp_ota_abort(d.writer.handle);
+    }
+    return err;
+}
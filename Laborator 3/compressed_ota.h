@@ -0,0 +1,34 @@
+#ifndef COMPRESSED_OTA_H
+#define COMPRESSED_OTA_H
+
+#include "esp_err.h"
+#include "ota_manifest.h"
+#include "ota_memory.h"
+#include "ota_session.h"
+
+// Receive buffers shared between the download and the flash writer (ota_pipeline.h): while
+// one is written, the others keep filling. 1 buffer means no overlap. Fewer are allocated
+// when the heap cannot spare them all (OTA_MEMORY_RESERVE).
+#ifndef COMPRESSED_OTA_BUF_LEN
+#define COMPRESSED_OTA_BUF_LEN   (OTA_LOW_RAM ? 2048 : 4096)
+#endif
+#ifndef COMPRESSED_OTA_BUF_COUNT
+#define COMPRESSED_OTA_BUF_COUNT (OTA_LOW_RAM ? 2 : 4)
+#endif
+
+// Download the firmware image at `path` on the session's connection, asking for the compressed variant with
+// "Accept-Encoding: x-zseg", and write it to the next OTA partition as it arrives. A response
+// without that Content-Encoding is written as is. RAM use is bounded by the receive buffers and
+// the OTA_INFLATE_WINDOW history, whatever the image size.
+// Progress is checkpointed in NVS (ota_resume.h); after an interruption, including a reset,
+// the next call asks for the rest with Range/If-Range and carries on from the checkpoint.
+// With the manifest's chunk digests (`manifest` may be NULL) the image is hashed as it is
+// written and the download stops at the first chunk that does not match.
+// Returns ESP_ERR_TIMEOUT or an HTTP error when the download was cut off and can be resumed,
+// ESP_ERR_INVALID_CRC when a chunk was corrupt (the retry resumes before it),
+// ESP_ERR_INVALID_RESPONSE or ESP_ERR_OTA_VALIDATE_FAILED when the image itself is bad,
+// ESP_ERR_NOT_FINISHED when the server is throttling downloads: nothing was written, try again
+// after s->retry_after_ms. ESP_ERR_NO_MEM when not even one receive buffer fits the heap.
+esp_err_t compressed_ota_run(ota_session_t *s, const char *path, const ota_manifest_t *manifest);
+
+#endif /* COMPRESSED_OTA_H */
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_delta_ota.h"
+
+#include "delta_ota.h"
+#include "ota_stats.h"
+#include "ota_verify.h"
+#include "version.h"
+
+static const char *TAG = "delta_ota";
+
+static const esp_partition_t *s_running;
+
+// detools asks for arbitrary ranges of the old image while it rebuilds the new one
+static esp_err_t read_running(uint8_t *buf, size_t size, int src_offset)
+{
+    if (src_offset < 0 || src_offset + size > s_running->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return esp_partition_read(s_running, src_offset, buf, size);
+}
+
+typedef struct {
+    esp_ota_handle_t handle;
+    ota_verify_t *verify;  // manifest chunk digests, NULL when there are none
+    ota_stats_t *stats;
+} update_t;
+
+// The rebuilt image is checked against the manifest as it is written, so a patch applied to
+// the wrong base stops at the first bad chunk
+static esp_err_t write_update(const uint8_t *buf, size_t size, void *user_data)
+{
+    update_t *u = user_data;
+    int64_t start_us;
+    if (u->verify) {
+        start_us = ota_stats_now();
+        int result = ota_verify_update(u->verify, buf, size);
+        ota_stats_add(u->stats, OTA_PHASE_VERIFY, ota_stats_now() - start_us, size);
+        if (result != 0) {
+            ESP_LOGE(TAG, "Patched image chunk %d does not match the manifest", ota_verify_chunk(u->verify));
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+    // esp_ota_write() erases each sector as it reaches it, so erasing counts as writing here
+    start_us = ota_stats_now();
+    esp_err_t err = esp_ota_write(u->handle, buf, size);
+    ota_stats_add(u->stats, OTA_PHASE_WRITE, ota_stats_now() - start_us, size);
+    return err;
+}
+
+// Phases write_update() times while the patcher calls it
+#define PATCH_NESTED (OTA_PHASE_BIT(OTA_PHASE_VERIFY) | OTA_PHASE_BIT(OTA_PHASE_WRITE))
+
+// Patching time without the writes of the rebuilt image it makes
+static void record_patch(ota_stats_t *st, int64_t start_us, int64_t nested_us, size_t len)
+{
+    ota_stats_add(st, OTA_PHASE_PATCH, ota_stats_now() - start_us -
+                  (ota_stats_nested_us(st, PATCH_NESTED) - nested_us), len);
+}
+
+esp_err_t delta_ota_run(ota_session_t *s, const char *path, const ota_manifest_t *manifest)
+{
+    esp_http_client_handle_t client = s->client;
+    int status;
+    int64_t patch_len;
+
+    ota_session_request(s, path);
+    esp_err_t err = ota_session_send(s, &status, &patch_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (s->retry_after_ms) {
+        ESP_LOGW(TAG, "Server busy (HTTP %d), retry in %u s", status, (unsigned)(s->retry_after_ms / 1000));
+        ota_session_finish(s);
+        return ESP_ERR_NOT_FINISHED;
+    }
+    if (status != 200) {
+        ESP_LOGI(TAG, "No patch from %s (HTTP %d)", VERSION_SHORT, status);
+        ota_session_finish(s);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    s_running = esp_ota_get_running_partition();
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    update_t out = { .stats = &s->stats };
+    esp_delta_ota_handle_t delta = NULL;
+    char *buf = NULL;
+    ESP_LOGI(TAG, "Applying %lld byte patch from %s onto partition %s",
+             patch_len, VERSION_SHORT, update->label);
+
+    err = esp_ota_begin(update, OTA_SIZE_UNKNOWN, &out.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        goto cleanup;
+    }
+
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = read_running,
+        .write_cb_with_user_data = write_update,
+        .user_data = &out,
+    };
+    if (manifest && manifest->chunk_count) {
+        out.verify = ota_verify_new(manifest->chunks, manifest->chunk_count, 0);
+    }
+    delta = esp_delta_ota_init(&cfg);
+    if (delta == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    // On the heap: the OTA task's stack is kept for the TLS handshake
+    buf = malloc(DELTA_OTA_CHUNK_LEN);
+    if (buf == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    int64_t received = 0;
+    while (1) {
+        int64_t start_us = ota_stats_now();
+        int len = esp_http_client_read(client, buf, DELTA_OTA_CHUNK_LEN);
+        ota_stats_add(&s->stats, OTA_PHASE_RECEIVE, ota_stats_now() - start_us, len > 0 ? len : 0);
+        if (len < 0) {
+            ESP_LOGE(TAG, "Patch download failed after %lld bytes", received);
+            err = ESP_FAIL;
+            goto cleanup;
+        }
+        if (len == 0) {
+            break;
+        }
+        ota_session_first_byte(s);
+        received += len;
+        start_us = ota_stats_now();
+        int64_t nested_us = ota_stats_nested_us(&s->stats, PATCH_NESTED);
+        err = esp_delta_ota_feed_patch(delta, (const uint8_t *)buf, len);
+        record_patch(&s->stats, start_us, nested_us, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Patch rejected at byte %lld: %s", received, esp_err_to_name(err));
+            goto cleanup;
+        }
+    }
+    if (!esp_http_client_is_complete_data_received(client)) {
+        ESP_LOGE(TAG, "Patch truncated at %lld bytes", received);
+        err = ESP_FAIL;
+        goto cleanup;
+    }
+
+    int64_t start_us = ota_stats_now();
+    int64_t nested_us = ota_stats_nested_us(&s->stats, PATCH_NESTED);
+    err = esp_delta_ota_finalize(delta);
+    record_patch(&s->stats, start_us, nested_us, 0);
+    if (err == ESP_OK && out.verify && ota_verify_finish(out.verify) != 0) {
+        err = ESP_ERR_INVALID_CRC;
+    }
+    start_us = ota_stats_now();
+    if (err == ESP_OK) {
+        // esp_ota_end() validates the rebuilt image before it can be booted
+        err = esp_ota_end(out.handle);
+        out.handle = 0;
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(update);
+    }
+    ota_stats_add(&s->stats, OTA_PHASE_FINALIZE, ota_stats_now() - start_us, 0);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Patch applied: %lld bytes downloaded", received);
+    } else {
+        ESP_LOGE(TAG, "Patched image invalid: %s", esp_err_to_name(err));
+    }
+
+cleanup:
+    if (err != ESP_OK) {
+        // The response may be half read; the next request has to start on a fresh connection
+        esp_http_client_close(client);
+    }
+    if (delta) {
+        esp_delta_ota_deinit(delta);
+    }
+    if (out.handle) {
+        esp_ota_abort(out.handle);
+    }
+    ota_verify_free(out.verify);
+    free(buf);
+    return err;
+}
@@ -0,0 +1,21 @@
+#ifndef DELTA_OTA_H
+#define DELTA_OTA_H
+
+#include "esp_err.h"
+#include "ota_manifest.h"
+#include "ota_session.h"
+
+// Patch download chunk; the patch is applied as it arrives, this is all that is buffered
+#define DELTA_OTA_CHUNK_LEN 1024
+
+// Download the patch from the running version at `path` (e.g. "/firmware.patch?from=v0.1.4")
+// on the session's connection and apply it in one streaming pass: the old image is read from
+// the running partition, the new one is written to the next OTA partition, which is then set
+// as the boot partition.
+// Returns ESP_ERR_NOT_FOUND if the server has no patch for this base, so the caller can fall
+// back to a full download on the same connection, and ESP_ERR_NOT_FINISHED when the server is
+// throttling downloads (wait s->retry_after_ms). With the manifest's chunk digests
+// (`manifest` may be NULL) the rebuilt image is checked as it is written.
+esp_err_t delta_ota_run(ota_session_t *s, const char *path, const ota_manifest_t *manifest);
+
+#endif /* DELTA_OTA_H */
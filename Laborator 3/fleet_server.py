@@ -0,0 +1,444 @@
+"""Production OTA server: the device routes of server.py on asyncio, for a fleet that checks
+for updates all at once.
+
+server.py runs Flask's development server: a thread per connection, the version files read
+and the image reopened on every request. Here one process holds thousands of TLS connections:
+
+- every artifact (image, compressed image, patches) is memory-mapped once per version of the
+  file and shared by all connections, so a download costs no file reads and no copies of the
+  image; without TLS (--no-tls, behind a TLS-terminating proxy) bodies go out with sendfile()
+- the version, the digests and ETags and the rendered manifests are computed when a file
+  changes, not per request (files are checked at most every REFRESH_INTERVAL seconds)
+- a connection holds at most MAX_HEADER_LEN bytes of request and WRITE_HIGH_WATER bytes of
+  unsent response; a slow device stalls its own download, not the server's memory
+- --workers forks processes that share the port (SO_REUSEPORT) and the TLS ticket keys, so a
+  device resumes its session on whichever worker it reaches; the download budget of
+  channels.json is divided between them
+- devices long-polling /manifest?wait= cost an idle connection each and no work until a
+  file changes; the release files are watched once every REFRESH_INTERVAL, not per device
+
+Routes, headers and conditional requests behave as in server.py, which shares its artifact
+helpers with this module and remains the development server.
+
+    python fleet_server.py [--port 5000] [--workers N] [--no-tls]
+
+Needs Python 3.11 or later for the TLS read buffer limit (TLS_READ_BUFFER) and the memory
+it saves; older versions serve the same routes with asyncio's own TLS buffering.
+"""
+import argparse
+import asyncio
+import asyncio.sslproto
+import email.utils
+import json
+import math
+import mmap
+import os
+import time
+import urllib.parse
+
+import release
+import server
+
+# Idle keep-alive connections are closed after this long, as KeepAliveHandler.timeout
+IDLE_TIMEOUT = 30
+TLS_HANDSHAKE_TIMEOUT = 10
+MAX_HEADER_LEN = 8192
+# Unsent response bytes a connection may hold before its writer waits for the device
+WRITE_HIGH_WATER = 64 * 1024
+WRITE_BLOCK = 16 * 1024  # one TLS record
+# Decrypted bytes read from a connection at a time. asyncio allocates 256 KB per TLS
+# connection for this by default, which for a thousand devices is most of the server's memory;
+# requests are a few hundred bytes. Set through SSLProtocol.max_size, a private attribute of
+# the TLS transport rewritten in Python 3.11; earlier versions have no such limit.
+TLS_READ_BUFFER = 16 * 1024
+REFRESH_INTERVAL = 1.0
+# Manifests for this many different ?from= versions are kept rendered
+MAX_CACHED_MANIFESTS = 64
+
+STATUS_TEXT = {200: "OK", 206: "Partial Content", 304: "Not Modified", 400: "Bad Request",
+               404: "Not Found", 405: "Method Not Allowed", 413: "Payload Too Large",
+               416: "Range Not Satisfiable", 503: "Service Unavailable"}
+
+
+def file_key(path):
+    try:
+        st = os.stat(path)
+    except OSError:
+        return None
+    return st.st_mtime_ns, st.st_size
+
+
+class Artifact:
+    """One file, mapped and hashed once per version of the file"""
+
+    def __init__(self, path):
+        st = os.stat(path)
+        self.path = path
+        self.key = (st.st_mtime_ns, st.st_size)
+        self.size = st.st_size
+        self.etag = '"%s"' % server.file_etag(path)
+        self.last_modified = email.utils.formatdate(st.st_mtime, usegmt=True)
+        self.file = open(path, 'rb')
+        if self.size == 0:
+            self.data = b''
+        elif os.name == 'nt':
+            # Windows cannot replace a mapped file, and the build overwrites firmware.bin
+            self.data = self.file.read()
+        else:
+            self.data = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+
+    def changed(self):
+        return file_key(self.path) != self.key
+
+
+class Catalog:
+    """What server.py works out per request, kept until a file changes"""
+
+    def __init__(self):
+        self.version = None
+        self.channels = None     # channels.json
+        self.download_limit = 0  # this worker's share of max_downloads, 0: none
+        self.workers = 1
+        self.release_key = None  # what the manifests are rendered from
+        self.changed = None  # asyncio.Event set, and replaced, when release_key changes
+        self.artifacts = {}  # path -> Artifact
+        self.manifests = {}  # (offered version, ?from= version) -> rendered manifest body
+        self.checked = 0
+
+    def refresh(self):
+        now = time.monotonic()
+        if now - self.checked < REFRESH_INTERVAL:
+            return
+        self.checked = now
+        self.version = server.current_version()
+        self.channels = server.load_channels()
+        limit = (self.channels or {}).get("max_downloads", 0)
+        self.download_limit = math.ceil(limit / self.workers)
+        for path in [path for path, a in self.artifacts.items() if a.changed()]:
+            # Transfers still running keep their mapping of the old file
+            del self.artifacts[path]
+        # A new release or patch changes its directory's mtime
+        key = (self.version, file_key(server.CHANNELS_PATH), file_key(server.FIRMWARE_PATH),
+               file_key(release.RELEASES_DIR), file_key(release.PATCHES_DIR))
+        if key != self.release_key:
+            self.release_key = key
+            self.manifests.clear()
+            if self.changed:
+                self.changed.set()
+                self.changed = asyncio.Event()
+
+    def artifact(self, path):
+        a = self.artifacts.get(path)
+        if a is None and path and os.path.exists(path):
+            a = self.artifacts[path] = Artifact(path)
+        return a
+
+    def offer(self, device_id, base):
+        return server.offered_version(self.channels, self.version, device_id, base)
+
+    def manifest(self, version, base):
+        body = self.manifests.get((version, base))
+        if body is None:
+            body = json.dumps(server.manifest_body(version, base)).encode()
+            if len(self.manifests) < MAX_CACHED_MANIFESTS:
+                self.manifests[(version, base)] = body
+        return body
+
+
+class Stats:
+    def __init__(self):
+        self.connections = 0
+        self.peak_connections = 0
+        self.requests = 0
+        self.bytes_sent = 0
+        self.downloads = 0  # connections holding a place in the download budget
+        self.throttled = 0
+        self.waiting = 0  # devices holding /manifest?wait= open
+        self.woken = 0    # of those, answered because a release was published
+
+
+catalog = Catalog()
+stats = Stats()
+
+
+def etag_matches(header, etag):
+    if header is None:
+        return False
+    tags = [t.strip() for t in header.split(',')]
+    return '*' in tags or etag in tags or 'W/' + etag in tags
+
+
+def parse_range(header, size):
+    """(start, end) of a single "bytes=" range, end exclusive; None to send everything,
+    False when it cannot be satisfied"""
+    if not header or not header.startswith('bytes=') or ',' in header:
+        return None
+    first, _, last = header[6:].partition('-')
+    try:
+        if first == '':
+            start, end = max(size - int(last), 0), size
+        else:
+            start = int(first)
+            end = min(int(last) + 1, size) if last else size
+    except ValueError:
+        return None
+    if start >= size or start >= end:
+        return False
+    return start, end
+
+
+class Connection:
+    def __init__(self, reader, writer, sendfile):
+        self.reader = reader
+        self.writer = writer
+        self.sendfile = sendfile and writer.get_extra_info('sslcontext') is None
+        self.downloading = False
+        writer.transport.set_write_buffer_limits(high=WRITE_HIGH_WATER)
+
+    async def read_request(self):
+        """(method, target, headers), None when the device closed the connection"""
+        header_len = 0
+        line = await asyncio.wait_for(self.reader.readline(), IDLE_TIMEOUT)
+        if not line:
+            return None
+        parts = line.decode('latin-1').split()
+        if len(parts) != 3:
+            raise ValueError("bad request line")
+        headers = {}
+        while True:
+            line = await asyncio.wait_for(self.reader.readline(), IDLE_TIMEOUT)
+            header_len += len(line)
+            if header_len > MAX_HEADER_LEN:
+                raise ValueError("headers too long")
+            if line in (b'\r\n', b'\n', b''):
+                break
+            name, _, value = line.decode('latin-1').partition(':')
+            headers[name.strip().lower()] = value.strip()
+        return parts[0], parts[1], headers
+
+    def start_response(self, status, headers, length):
+        lines = ["HTTP/1.1 %d %s" % (status, STATUS_TEXT[status]),
+                 "Content-Length: %d" % length]
+        lines += ["%s: %s" % h for h in headers]
+        self.writer.write(("\r\n".join(lines) + "\r\n\r\n").encode('latin-1'))
+
+    async def respond(self, status, headers=(), body=b''):
+        self.start_response(status, headers, len(body))
+        self.writer.write(body)
+        stats.bytes_sent += len(body)
+        await self.writer.drain()
+
+    async def send_artifact(self, a, request_headers, extra_headers=()):
+        """server.send_firmware(): 503 past the download budget, else 304, 206 or the file.
+
+        The socket buffer takes most of an image long before the device has read it, so a
+        download keeps its place in the budget until the device sends its next request or
+        closes the connection, as it does once the image is written."""
+        if catalog.download_limit and stats.downloads >= catalog.download_limit:
+            stats.throttled += 1
+            return await self.respond(503, [("Retry-After", server.retry_after(catalog.channels))])
+        self.downloading = True
+        stats.downloads += 1
+        await self.send_conditional(a, request_headers, extra_headers)
+
+    def end_download(self):
+        if self.downloading:
+            self.downloading = False
+            stats.downloads -= 1
+
+    async def send_conditional(self, a, request_headers, extra_headers):
+        """send_file(conditional=True): 304, 206 or the whole file"""
+        headers = [("Content-Type", "application/octet-stream"), ("ETag", a.etag),
+                   ("Last-Modified", a.last_modified), ("Cache-Control", "no-cache"),
+                   ("Accept-Ranges", "bytes"), ("Vary", "Accept-Encoding")] + list(extra_headers)
+        if etag_matches(request_headers.get('if-none-match'), a.etag):
+            return await self.respond(304, headers)
+
+        status, start, end = 200, 0, a.size
+        if_range = request_headers.get('if-range')
+        if if_range is None or if_range == a.etag:
+            span = parse_range(request_headers.get('range'), a.size)
+            if span is False:
+                return await self.respond(416, [("Content-Range", "bytes */%d" % a.size)])
+            if span:
+                status, (start, end) = 206, span
+                headers.append(("Content-Range", "bytes %d-%d/%d" % (start, end - 1, a.size)))
+
+        self.start_response(status, headers, end - start)
+        if self.sendfile:
+            try:
+                await self.writer.drain()
+                await asyncio.get_running_loop().sendfile(self.writer.transport, a.file, start,
+                                                          end - start, fallback=False)
+                stats.bytes_sent += end - start
+                return
+            except asyncio.SendfileNotAvailableError:
+                self.sendfile = False
+        view = memoryview(a.data)
+        for offset in range(start, end, WRITE_BLOCK):
+            self.writer.write(view[offset:min(offset + WRITE_BLOCK, end)])
+            await self.writer.drain()
+        stats.bytes_sent += end - start
+
+    async def held_offer(self, device_id, base, wait):
+        """server.held_offer(), woken by Catalog.changed instead of looking at the files"""
+        loop = asyncio.get_running_loop()
+        deadline = loop.time() + wait
+        waited = False
+        stats.waiting += 1
+        try:
+            while True:
+                offered = catalog.offer(device_id, base)
+                remaining = deadline - loop.time()
+                if server.is_newer(offered, base) or remaining <= 0:
+                    break
+                waited = True
+                try:
+                    await asyncio.wait_for(catalog.changed.wait(), remaining)
+                except asyncio.TimeoutError:
+                    pass
+        finally:
+            stats.waiting -= 1
+        if waited and server.is_newer(offered, base):
+            stats.woken += 1
+            await asyncio.sleep(min(server.push_delay(catalog.channels), max(remaining, 0)))
+        return offered
+
+    async def handle(self, method, target, headers):
+        url = urllib.parse.urlsplit(target)
+        query = urllib.parse.parse_qs(url.query)
+        base = query.get('from', [''])[0]
+        catalog.refresh()
+        # The release a download is for: the one the manifest offered, or the current build
+        version = query.get('version', [catalog.version])[0]
+
+        if method != 'GET':
+            return await self.respond(405, [("Allow", "GET")])
+        if url.path == '/manifest':
+            try:
+                wait = min(int(query.get('wait', ['0'])[0]), server.PUSH_MAX_WAIT)
+            except ValueError:
+                wait = 0
+            offered = await self.held_offer(headers.get('x-device-id', ''), base, wait)
+            headers_out = [("Content-Type", "application/json"), ("ETag", '"%s"' % offered),
+                           ("Cache-Control", "no-cache")]
+            if etag_matches(headers.get('if-none-match'), '"%s"' % offered):
+                return await self.respond(304, headers_out)
+            return await self.respond(200, headers_out, catalog.manifest(offered, base))
+        if url.path == '/firmware.bin':
+            path, encoding = server.firmware_file(headers.get('accept-encoding', ''), version)
+            a = catalog.artifact(path)
+            if a is not None:
+                extra = [("Content-Encoding", encoding)] if encoding else []
+                return await self.send_artifact(a, headers, extra)
+        elif url.path == '/firmware.patch':
+            a = catalog.artifact(server.patch_file(base, version))
+            if a is not None:
+                return await self.send_artifact(a, headers, [("X-Delta-Base", base),
+                                                             ("X-Firmware-Version", version)])
+        elif url.path == '/version':
+            return await self.respond(200, [("Content-Type", "text/plain")],
+                                      catalog.version.encode())
+        await self.respond(404)
+
+
+async def serve_connection(reader, writer, sendfile):
+    stats.connections += 1
+    stats.peak_connections = max(stats.peak_connections, stats.connections)
+    conn = Connection(reader, writer, sendfile)
+    try:
+        while True:
+            request = await conn.read_request()
+            if request is None:
+                break
+            method, target, headers = request
+            stats.requests += 1
+            # Devices send no request bodies; anything else would leave the stream unreadable
+            if headers.get('content-length', '0') != '0' or 'transfer-encoding' in headers:
+                await conn.respond(413, [("Connection", "close")])
+                break
+            conn.end_download()
+            await conn.handle(method, target, headers)
+            if headers.get('connection', '').lower() == 'close':
+                break
+    except (asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError, OSError):
+        # Idle timeout, malformed request or the device went away
+        pass
+    finally:
+        conn.end_download()
+        stats.connections -= 1
+        writer.close()
+
+
+async def report(interval=10):
+    last = 0
+    while True:
+        await asyncio.sleep(interval)
+        if stats.requests != last:
+            last = stats.requests
+            print("[%d] %d connections (peak %d), %d requests, %d waiting (%d woken), "
+                  "%d downloads (%d throttled), %.1f MB sent" %
+                  (os.getpid(), stats.connections, stats.peak_connections, stats.requests,
+                   stats.waiting, stats.woken, stats.downloads, stats.throttled,
+                   stats.bytes_sent / 1e6), flush=True)
+
+
+async def watch_releases():
+    # Wakes devices waiting for a release even when no other request comes in
+    while True:
+        await asyncio.sleep(REFRESH_INTERVAL)
+        catalog.refresh()
+
+
+async def serve(args, context):
+    if context is not None:
+        if hasattr(asyncio.sslproto.SSLProtocol, "max_size"):
+            asyncio.sslproto.SSLProtocol.max_size = TLS_READ_BUFFER
+        else:
+            print("[%d] warning: TLS_READ_BUFFER needs Python 3.11, asyncio keeps its own "
+                  "read buffer size" % os.getpid(), flush=True)
+    sendfile = context is None
+    server_ = await asyncio.start_server(
+        lambda r, w: serve_connection(r, w, sendfile), args.host, args.port, ssl=context,
+        ssl_handshake_timeout=TLS_HANDSHAKE_TIMEOUT if context else None,
+        limit=MAX_HEADER_LEN, backlog=args.backlog, reuse_port=args.workers > 1)
+    catalog.changed = asyncio.Event()
+    asyncio.get_running_loop().create_task(report())
+    asyncio.get_running_loop().create_task(watch_releases())
+    async with server_:
+        await server_.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=5000)
+    parser.add_argument('--workers', type=int, default=1, help='processes sharing the port')
+    parser.add_argument('--backlog', type=int, default=1024)
+    parser.add_argument('--no-tls', action='store_true',
+                        help='plain HTTP with sendfile(), for use behind a TLS-terminating proxy')
+    args = parser.parse_args()
+    if args.workers > 1 and not hasattr(os, 'fork'):
+        parser.error('--workers needs fork() and SO_REUSEPORT')
+
+    # Hash and map the current release before the workers fork, so they share both
+    catalog.workers = args.workers
+    catalog.refresh()
+    catalog.artifact(server.image_file(catalog.version))
+    catalog.artifact(release.compressed_file(catalog.version) if server.valid_version(catalog.version) else None)
+    # The ticket keys are made with the context; workers forked after this accept each
+    # other's tickets
+    context = None if args.no_tls else server.tls_context()
+
+    for _ in range(args.workers - 1):
+        if os.fork() == 0:
+            break
+    print("[%d] serving %s on %s:%d" % (os.getpid(), catalog.version, args.host, args.port), flush=True)
+    try:
+        asyncio.run(serve(args, context))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
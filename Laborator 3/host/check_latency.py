@@ -0,0 +1,79 @@
+"""Update check to first firmware byte, before and after the /manifest flow.
+
+before: GET /version on one TLS connection, then a second handshake for /firmware.bin
+        (check_server_version + a separate download, CONFIG_OTA_USE_MANIFEST 0)
+after:  GET /manifest, then /firmware.bin on the same keep-alive connection
+        (ota_session, CONFIG_OTA_USE_MANIFEST 1)
+
+Start server.py first (it must run with HTTP/1.1 for keep-alive), then:
+    python host/check_latency.py --host 127.0.0.1 --runs 20 [--no-verify]
+"""
+import argparse
+import http.client
+import ssl
+import statistics
+import time
+
+
+def connect(args, ctx):
+    conn = http.client.HTTPSConnection(args.host, args.port, context=ctx)
+    conn.connect()
+    return conn
+
+
+def first_byte(conn):
+    conn.request("GET", "/firmware.bin")
+    response = conn.getresponse()
+    response.read(1)
+    t = time.perf_counter()
+    response.read()
+    return t
+
+
+def before(args, ctx):
+    start = time.perf_counter()
+    conn = connect(args, ctx)
+    conn.request("GET", "/version")
+    conn.getresponse().read()
+    conn.close()
+    conn = connect(args, ctx)
+    t = first_byte(conn)
+    conn.close()
+    return t - start
+
+
+def after(args, ctx):
+    start = time.perf_counter()
+    conn = connect(args, ctx)
+    conn.request("GET", "/manifest?from=v0.1.0", headers={"If-None-Match": '"v0.1.0"'})
+    conn.getresponse().read()
+    t = first_byte(conn)
+    conn.close()
+    return t - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--runs", type=int, default=10)
+    parser.add_argument("--cafile", default="ca_cert.pem")
+    parser.add_argument("--no-verify", action="store_true",
+                        help="skip certificate checks, e.g. once the lab certificate has expired "
+                             "(the device has no clock and does not notice)")
+    args = parser.parse_args()
+
+    # Same trust setup as the device: the lab CA, no host name check
+    ctx = ssl.create_default_context(cafile=args.cafile)
+    ctx.check_hostname = False
+    if args.no_verify:
+        ctx.verify_mode = ssl.CERT_NONE
+
+    for name, flow in (("before", before), ("after", after)):
+        samples = [flow(args, ctx) * 1000 for _ in range(args.runs)]
+        print("{:6}  check to first firmware byte: median {:.1f} ms, min {:.1f} ms, max {:.1f} ms".format(
+            name, statistics.median(samples), min(samples), max(samples)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,231 @@
+/* Host benchmark for the streaming firmware decompressor.
+
+   Compresses an image the way release.py does (64 KB segments, zlib level 9, 4 KB window),
+   then streams it through ota_inflate in download-sized chunks as compressed_ota.c does on the
+   device, checking the output against the original. Reports the compression ratio,
+   decompression throughput, the decompressor's peak heap and the transfer time saved on a link
+   of the given speed. Then interrupts the download at random offsets and resumes each time from
+   the last segment checkpoint with a fresh decompressor, as after a reboot, to check that the
+   result is still identical. Without an image argument a synthetic 1 MB firmware-like image is
+   used.
+
+   Build: gcc -O2 -I.. -o inflate_bench inflate_bench.c ../ota_inflate.c -lz
+   Usage: ./inflate_bench [-c chunk_bytes] [-l link_kbit_s] [-i interruptions] [firmware.bin]
+*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "ota_inflate.h"
+
+typedef struct {
+    const uint8_t *expected;
+    size_t len;
+    size_t pos;
+} verify_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int verify_write(const uint8_t *buf, size_t len, void *ctx)
+{
+    verify_t *v = ctx;
+    if (v->pos + len > v->len || memcmp(v->expected + v->pos, buf, len) != 0) {
+        return -1;
+    }
+    v->pos += len;
+    return 0;
+}
+
+// Code-like words from a small vocabulary, zero padding and incompressible constant data
+static uint8_t *synthetic_image(size_t len)
+{
+    uint8_t *img = malloc(len);
+    uint32_t vocab[256];
+    srand(1);
+    for (int i = 0; i < 256; i++) {
+        vocab[i] = ((uint32_t)rand() << 16) ^ rand();
+    }
+    for (size_t pos = 0; pos < len; pos += 4096) {
+        size_t block = len - pos < 4096 ? len - pos : 4096;
+        int kind = rand() % 10;
+        for (size_t i = 0; i < block; i += 4) {
+            uint32_t word = kind < 6 ? vocab[rand() % 64 + (pos >> 16) % 192] : kind < 8 ? 0 : (uint32_t)rand();
+            memcpy(img + pos + i, &word, block - i < 4 ? block - i : 4);
+        }
+    }
+    return img;
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*len);
+    if (fread(buf, 1, *len, f) != *len) {
+        perror("fread");
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+static size_t compress_image(const uint8_t *img, size_t len, uint8_t **out)
+{
+    // Each segment on its own may grow, an incompressible one by a little
+    size_t segments = (len + OTA_INFLATE_SEGMENT_LEN - 1) / OTA_INFLATE_SEGMENT_LEN;
+    size_t cap = segments * (compressBound(OTA_INFLATE_SEGMENT_LEN) + 4);
+    size_t clen = 0;
+    *out = malloc(cap);
+
+    for (size_t pos = 0; pos < len; pos += OTA_INFLATE_SEGMENT_LEN) {
+        z_stream strm = { 0 };
+        deflateInit2(&strm, 9, Z_DEFLATED, OTA_INFLATE_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY);
+        strm.next_in = (Bytef *)img + pos;
+        strm.avail_in = len - pos < OTA_INFLATE_SEGMENT_LEN ? len - pos : OTA_INFLATE_SEGMENT_LEN;
+        strm.next_out = *out + clen + 4;
+        strm.avail_out = cap - clen - 4;
+        if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+            fprintf(stderr, "deflate of segment at %zu did not finish\n", pos);
+            exit(1);
+        }
+        uint32_t seg = strm.total_out;
+        deflateEnd(&strm);
+        (*out)[clen] = seg >> 24;
+        (*out)[clen + 1] = seg >> 16;
+        (*out)[clen + 2] = seg >> 8;
+        (*out)[clen + 3] = seg;
+        clen += 4 + seg;
+    }
+    return clen;
+}
+
+// Download `packed` from `*in_off` to `stop` in chunks, checkpointing at segment ends.
+// Returns true once the image is complete.
+static bool download(const uint8_t *packed, size_t packed_len, size_t chunk, size_t stop,
+                     size_t *in_off, verify_t *v, bool *failed)
+{
+    ota_inflate_t *z = ota_inflate_new(verify_write, v);
+    ota_inflate_status_t status = OTA_INFLATE_MORE;
+    size_t pos = *in_off;
+
+    while (pos < stop) {
+        size_t n = stop - pos < chunk ? stop - pos : chunk;
+        const uint8_t *p = packed + pos;
+        pos += n;
+        while (n) {
+            size_t used;
+            status = ota_inflate_feed(z, p, n, &used);
+            p += used;
+            n -= used;
+            if (status == OTA_INFLATE_ERROR) {
+                *failed = true;
+                ota_inflate_free(z);
+                return false;
+            }
+            if (status == OTA_INFLATE_SEGMENT) {
+                *in_off = pos - n;
+            }
+        }
+    }
+    ota_inflate_free(z);
+    return stop == packed_len && status == OTA_INFLATE_SEGMENT;
+}
+
+int main(int argc, char **argv)
+{
+    size_t chunk = 1024;
+    unsigned link_kbit = 1000;
+    unsigned interruptions = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:l:i:")) != -1) {
+        switch (opt) {
+        case 'c': chunk = strtoul(optarg, NULL, 0); break;
+        case 'l': link_kbit = strtoul(optarg, NULL, 0); break;
+        case 'i': interruptions = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-c chunk] [-l link_kbit_s] [-i interruptions] [firmware.bin]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    size_t len;
+    uint8_t *img = optind < argc ? read_file(argv[optind], &len) : synthetic_image(len = 1 << 20);
+    uint8_t *packed;
+    size_t packed_len = compress_image(img, len, &packed);
+
+    const int runs = 20;
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < runs; r++) {
+        verify_t v = { img, len, 0 };
+        size_t in_off = 0;
+        bool failed = false;
+        uint64_t start = now_ns();
+        bool complete = download(packed, packed_len, chunk, packed_len, &in_off, &v, &failed);
+        uint64_t elapsed = now_ns() - start;
+        if (!complete || v.pos != len) {
+            fprintf(stderr, "FAIL: %zu of %zu bytes\n", v.pos, len);
+            return 1;
+        }
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    // Interrupted downloads: each attempt stops at a random offset, the next one resumes from the
+    // last checkpoint, i.e. the last completed segment, like compressed_ota.c after a reboot
+    size_t downloaded = 0;
+    size_t in_off = 0;
+    verify_t v = { img, len, 0 };
+    bool failed = false;
+    srand(2);
+    for (unsigned i = 0; i <= interruptions; i++) {
+        size_t stop = i == interruptions ? packed_len : in_off + rand() % (packed_len - in_off + 1);
+        // The flashed output restarts at the checkpoint too: segments are OTA_INFLATE_SEGMENT_LEN each
+        size_t resume_from = in_off;
+        v.pos = 0;
+        for (size_t p = 0; p < resume_from; ) {
+            size_t seg = ((size_t)packed[p] << 24) | (packed[p + 1] << 16) | (packed[p + 2] << 8) | packed[p + 3];
+            p += 4 + seg;
+            v.pos += OTA_INFLATE_SEGMENT_LEN;
+        }
+        downloaded += stop - in_off;
+        bool complete = download(packed, packed_len, chunk, stop, &in_off, &v, &failed);
+        if (failed || (i == interruptions && (!complete || v.pos != len))) {
+            fprintf(stderr, "FAIL: resumed download corrupt after %u interruptions\n", i);
+            return 1;
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double raw_s = len * 8.0 / (link_kbit * 1000.0);
+    double packed_s = packed_len * 8.0 / (link_kbit * 1000.0);
+
+    printf("image %zu bytes, compressed %zu bytes (%.1f%%), window %d bytes, chunk %zu bytes\n",
+           len, packed_len, 100.0 * packed_len / len, OTA_INFLATE_WINDOW, chunk);
+    printf("decompress: %.1f MB/s (best of %d), peak decompressor heap %zu bytes, process max RSS %ld KB\n",
+           len / (best / 1e9) / 1e6, runs, ota_inflate_peak_heap(), usage.ru_maxrss);
+    printf("transfer at %u kbit/s: raw %.1f s, compressed %.1f s\n", link_kbit, raw_s, packed_s);
+    printf("resume: %u interruptions, %zu bytes downloaded for a %zu byte image (%.1f%% overhead), output verified\n",
+           interruptions, downloaded, packed_len, 100.0 * (downloaded - packed_len) / packed_len);
+    free(img);
+    free(packed);
+    return 0;
+}
@@ -0,0 +1,178 @@
+"""Simulated fleet waking up together, against server.py or fleet_server.py.
+
+Each of --devices devices starts within --spread seconds, makes its own TLS connection (a
+full handshake, as after a reboot), GETs /manifest with its own X-Device-Id and then the
+offered image with "Accept-Encoding: x-zseg" on the same keep-alive connection, like ota_task
+on the device, and reads the image at most at --kbit (the device's flash rate; 0 for as fast
+as possible). A device outside the staged rollout is offered its own version and stops there;
+one the server defers with 503 waits out Retry-After (scaled by --retry-scale, so a test does
+not take the real minutes) and tries again on a new connection.
+Reports completed, deferred and failed updates, the aggregate download throughput and the
+latency percentiles of the update check (connect to manifest) and of the whole update. With
+--pid the server's peak resident memory is read from /proc afterwards.
+
+Raise the open file limit for large fleets (ulimit -n). Start the server, then:
+    python host/load_test.py --devices 1000 --spread 2 [--host 127.0.0.1] [--port 5000]
+                             [--kbit 800] [--pid <server pid>]
+"""
+import argparse
+import asyncio
+import json
+import random
+import ssl
+import statistics
+import time
+
+
+class Failure(Exception):
+    pass
+
+
+class Deferred(Exception):
+    def __init__(self, retry_after):
+        super().__init__("deferred for %d s" % retry_after)
+        self.retry_after = retry_after
+
+
+async def request(reader, writer, path, headers=""):
+    writer.write(("GET %s HTTP/1.1\r\nHost: ota\r\n%s\r\n" % (path, headers)).encode())
+    await writer.drain()
+    status_line = await reader.readline()
+    if not status_line:
+        raise Failure("connection closed")
+    status = int(status_line.split()[1])
+    length = None
+    retry_after = None
+    while True:
+        line = await reader.readline()
+        if line in (b'\r\n', b''):
+            break
+        name, _, value = line.decode('latin-1').partition(':')
+        if name.lower() == 'content-length':
+            length = int(value)
+        elif name.lower() == 'retry-after':
+            retry_after = int(value)
+    if status == 503 and retry_after is not None:
+        if length:
+            await reader.readexactly(length)
+        raise Deferred(retry_after)
+    if status != 200 or length is None:
+        raise Failure("HTTP %d" % status)
+    return length
+
+
+async def update(args, ctx, device_id):
+    """One check and download. Returns the check time, the bytes received (None if no update
+    was offered) and the finish time."""
+    reader, writer = await asyncio.wait_for(
+        asyncio.open_connection(args.host, args.port, ssl=ctx, limit=16384), args.timeout)
+    try:
+        headers = "X-Device-Id: %s\r\n" % device_id
+        length = await request(reader, writer, "/manifest?from=%s" % args.version, headers)
+        manifest = json.loads(await reader.readexactly(length))
+        t_check = time.perf_counter()
+        if manifest["version"] == args.version or "image" not in manifest:
+            return t_check, None, t_check
+
+        length = await request(reader, writer, manifest["image"]["url"],
+                               headers + "Accept-Encoding: x-zseg\r\n")
+        received = 0
+        block_s = 4096 * 8 / (args.kbit * 1000) if args.kbit else 0
+        while received < length:
+            data = await asyncio.wait_for(reader.read(min(4096, length - received)), args.timeout)
+            if not data:
+                raise Failure("download cut off at %d of %d bytes" % (received, length))
+            received += len(data)
+            if block_s:
+                await asyncio.sleep(block_s * len(data) / 4096)
+        return t_check, received, time.perf_counter()
+    finally:
+        writer.close()
+
+
+async def device(args, ctx, index, start_at, results):
+    await asyncio.sleep(start_at)
+    # Stands in for the station MAC the firmware sends
+    device_id = "%012x" % (0x24a160000000 + index)
+    t0 = time.perf_counter()
+    deferrals = 0
+    try:
+        while True:
+            try:
+                t_check, received, t_done = await update(args, ctx, device_id)
+                break
+            except Deferred as e:
+                deferrals += 1
+                await asyncio.sleep(e.retry_after * args.retry_scale)
+        results.append((t_check - t0, t_done - t0, received, deferrals))
+    except (Failure, OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ssl.SSLError) as e:
+        results.append(e)
+
+
+def percentiles(values):
+    values = sorted(values)
+    pick = lambda p: values[min(int(p / 100 * len(values)), len(values) - 1)]
+    return "p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms" % (
+        pick(50) * 1000, pick(90) * 1000, pick(99) * 1000, values[-1] * 1000)
+
+
+def peak_rss_kb(pid):
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except OSError:
+        return None
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5000)
+    parser.add_argument('--devices', type=int, default=100)
+    parser.add_argument('--spread', type=float, default=1.0, help='seconds over which devices start')
+    parser.add_argument('--kbit', type=int, default=0, help='per-device read rate, 0: unlimited')
+    parser.add_argument('--version', default='v0.0.0', help='version the devices run')
+    parser.add_argument('--timeout', type=float, default=60)
+    parser.add_argument('--retry-scale', type=float, default=0.01,
+                        help='fraction of Retry-After a deferred device waits')
+    parser.add_argument('--pid', type=int, help='server process, to report its peak memory')
+    args = parser.parse_args()
+
+    # The lab certificate is self-signed; verification is not what is measured
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    random.seed(1)
+    results = []
+    start = time.perf_counter()
+    await asyncio.gather(*(device(args, ctx, i, random.uniform(0, args.spread), results)
+                           for i in range(args.devices)))
+    elapsed = time.perf_counter() - start
+
+    done = [r for r in results if not isinstance(r, Exception) and r[2] is not None]
+    held_back = [r for r in results if not isinstance(r, Exception) and r[2] is None]
+    failed = [r for r in results if isinstance(r, Exception)]
+    total_bytes = sum(r[2] for r in done)
+    print("%d devices over %.1f s, %s per device: %d updated, %d not offered the update, "
+          "%d failed in %.1f s, %.1f MB/s" %
+          (args.devices, args.spread, "%d kbit/s" % args.kbit if args.kbit else "unlimited",
+           len(done), len(held_back), len(failed), elapsed, total_bytes / elapsed / 1e6))
+    deferred = [r for r in done if r[3]]
+    if deferred:
+        print("%d updates deferred by the server, %d deferrals in all" %
+              (len(deferred), sum(r[3] for r in deferred)))
+    if done:
+        print("check:  " + percentiles([r[0] for r in done]))
+        print("update: " + percentiles([r[1] for r in done]))
+    if failed:
+        reasons = statistics.multimode(type(e).__name__ + ": " + str(e) for e in failed)
+        print("most common failure: %s" % reasons[0])
+    if args.pid:
+        print("server peak RSS: %s kB" % peak_rss_kb(args.pid))
+
+
+if __name__ == '__main__':
+    asyncio.run(main())
@@ -0,0 +1,316 @@
+/* Loopback test of the multicast firmware broadcast (ota_mcast.h, mcast_sender.py).
+
+   Starts the given number of receivers, one thread each with its own socket joined to the
+   multicast group on 127.0.0.1, all waiting for the image in the given file. Each drops
+   incoming packets at random before decoding them, as a device on a busy channel would, then
+   does what ota_mcast_receive() does with the rest: ota_mcast_rx_packet() writing to a
+   partition in memory that behaves like NOR flash (writes only clear bits), every chunk
+   checked against digests computed here like the manifest's once all its blocks are in, and
+   a chunk that does not match taken back with ota_mcast_rx_forget() and erased to be
+   received again. A receiver stops once it has the image or
+   OTA_MCAST_IDLE_MS after the sender went quiet; one that misses blocks then is counted as
+   falling back to downloading the image from the server.
+
+   Loss is -l on average, in bursts of -b packets on average (a Gilbert-Elliott channel; -b 1
+   drops packets independently). With -x each receiver damages the first symbol it writes,
+   standing in for a bad write, to show that the chunk is received again and never kept.
+
+   Reports how many receivers got the image over multicast, when, and from how many packets;
+   the bytes on the air against a unicast download per device; and what the fallback costs.
+
+   Build: gcc -O2 -I.. -o mcast_sim mcast_sim.c ../ota_mcast.c ../ota_verify.c -lpthread
+   Usage: ./mcast_sim [-n receivers] [-l loss] [-b burst] [-x] image.bin
+          then, from the server directory:
+          python mcast_sender.py image.bin --interface 127.0.0.1 [--rounds 3] [--rate 8000]
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ota_mcast.h"
+#include "ota_verify.h"
+
+#define MAX_RECEIVERS 200
+// How long to wait for the sender to start
+#define START_TIMEOUT_S 60
+
+typedef struct {
+    int index;
+    unsigned seed;
+    int fd;
+    // Results
+    double first;        // seconds since start, first packet of the image
+    double done;         // 0 unless the whole image was received and verified
+    uint32_t arrived;    // packets of the image that reached the socket
+    uint32_t dropped;    // of those, lost on purpose
+    uint32_t packets;    // taken by the decoder
+    uint32_t useful;
+    int blocks_done;
+    int bad_chunks;
+    bool matches;        // the partition holds the image byte for byte
+} receiver_t;
+
+static uint8_t *s_image;
+static size_t s_image_len;
+static uint8_t s_session[OTA_MCAST_SESSION_LEN];
+static uint8_t (*s_digests)[OTA_VERIFY_DIGEST_LEN];
+static int s_chunk_count;
+static double s_loss;
+static double s_burst;
+static bool s_damage;
+static double s_start;
+
+typedef struct {
+    uint8_t *data;
+    bool damage;  // flip a bit in the next write
+} partition_t;
+
+static int partition_write(size_t offset, const uint8_t *buf, size_t len, void *ctx)
+{
+    partition_t *p = ctx;
+    for (size_t i = 0; i < len; i++) {
+        p->data[offset + i] &= buf[i];
+    }
+    if (p->damage) {
+        p->data[offset] ^= 0x01;
+        p->damage = false;
+    }
+    return 0;
+}
+
+static int partition_read(size_t offset, uint8_t *buf, size_t len, void *ctx)
+{
+    partition_t *p = ctx;
+    memcpy(buf, p->data + offset, len);
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int join_group(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int one = 1;
+    int rcvbuf = 4 << 20;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(OTA_MCAST_PORT),
+                                .sin_addr.s_addr = htonl(INADDR_ANY) };
+    struct ip_mreq mreq = { .imr_interface.s_addr = htonl(INADDR_LOOPBACK) };
+    inet_aton(OTA_MCAST_GROUP, &mreq.imr_multiaddr);
+    struct timeval timeout = { 0, 100 * 1000 };
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        perror("join");
+        exit(1);
+    }
+    return fd;
+}
+
+// chunk_matches() in ota_mcast.c, on the partition in memory
+static bool chunk_matches(const uint8_t *partition, int chunk)
+{
+    size_t start = (size_t)chunk * OTA_VERIFY_CHUNK_LEN;
+    size_t end = start + OTA_VERIFY_CHUNK_LEN < s_image_len ? start + OTA_VERIFY_CHUNK_LEN : s_image_len;
+    ota_verify_t *v = ota_verify_new((const uint8_t (*)[OTA_VERIFY_DIGEST_LEN])s_digests, chunk + 1, start);
+    bool ok = ota_verify_update(v, partition + start, end - start) == 0 && ota_verify_finish(v) == 0;
+    ota_verify_free(v);
+    return ok;
+}
+
+static void *receive(void *arg)
+{
+    receiver_t *r = arg;
+    uint8_t packet[OTA_MCAST_PACKET_LEN + 1];
+    ota_mcast_rx_t *rx = malloc(sizeof(*rx));
+    partition_t partition = { .data = malloc(s_image_len), .damage = s_damage };
+    memset(partition.data, 0xff, s_image_len);
+    ota_mcast_rx_init(rx, s_session, s_image_len, partition_write, partition_read, &partition);
+
+    // Gilbert-Elliott: a lossy state entered so that a share s_loss of the packets is in
+    // it, left after s_burst packets on average
+    double enter_bad = s_loss < 1 ? s_loss / (s_burst * (1 - s_loss)) : 1;
+    bool bad = false;
+    double heard = 0;
+    while (rx->blocks_done < rx->blocks) {
+        double now = now_s();
+        if (heard ? now - heard >= OTA_MCAST_IDLE_MS / 1000.0 : now - s_start >= START_TIMEOUT_S) {
+            break;
+        }
+        int len = recv(r->fd, packet, sizeof(packet), 0);
+        if (len != OTA_MCAST_PACKET_LEN || memcmp(packet + 4, s_session, sizeof(s_session)) != 0) {
+            continue;
+        }
+        heard = now_s();
+        if (r->arrived++ == 0) {
+            r->first = heard - s_start;
+        }
+        bad = bad ? rand_r(&r->seed) > RAND_MAX / s_burst : rand_r(&r->seed) < enter_bad * RAND_MAX;
+        if (bad) {
+            r->dropped++;
+            continue;
+        }
+        int block = ota_mcast_rx_packet(rx, packet, len);
+        if (block < 0) {
+            continue;
+        }
+        int chunk = block * OTA_MCAST_BLOCK_LEN / OTA_VERIFY_CHUNK_LEN;
+        if (ota_mcast_chunk_received(rx, chunk) && !chunk_matches(partition.data, chunk)) {
+            r->bad_chunks++;
+            ota_mcast_rx_forget(rx, chunk);
+            size_t start = (size_t)chunk * OTA_VERIFY_CHUNK_LEN;
+            size_t n = s_image_len - start < OTA_VERIFY_CHUNK_LEN ? s_image_len - start : OTA_VERIFY_CHUNK_LEN;
+            memset(partition.data + start, 0xff, n);
+        }
+    }
+    if (rx->blocks_done == rx->blocks) {
+        r->done = now_s() - s_start;
+    }
+    r->packets = rx->packets;
+    r->useful = rx->useful;
+    r->blocks_done = rx->blocks_done;
+    r->matches = memcmp(partition.data, s_image, s_image_len) == 0;
+    free(partition.data);
+    free(rx);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*len ? *len : 1);
+    if (fread(buf, 1, *len, f) != *len) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 20;
+    int opt;
+
+    s_loss = 0.1;
+    s_burst = 1;
+    while ((opt = getopt(argc, argv, "n:l:b:x")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        case 'l': s_loss = atof(optarg); break;
+        case 'b': s_burst = atof(optarg); break;
+        case 'x': s_damage = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-n receivers] [-l loss] [-b burst] [-x] image.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || count < 1 || count > MAX_RECEIVERS || s_loss < 0 || s_loss >= 1 ||
+        s_burst < 1) {
+        fprintf(stderr, "usage: %s [-n receivers] [-l loss] [-b burst] [-x] image.bin\n", argv[0]);
+        return 1;
+    }
+
+    // What the manifest gives the device: the image digest and the chunk digests
+    s_image = read_file(argv[optind], &s_image_len);
+    s_chunk_count = (s_image_len + OTA_VERIFY_CHUNK_LEN - 1) / OTA_VERIFY_CHUNK_LEN;
+    if (s_image_len == 0 || s_chunk_count > OTA_VERIFY_MAX_CHUNKS) {
+        fprintf(stderr, "image must be 1 byte to %d KB\n", OTA_VERIFY_MAX_CHUNKS * OTA_VERIFY_CHUNK_LEN / 1024);
+        return 1;
+    }
+    uint8_t digest[OTA_VERIFY_DIGEST_LEN];
+    ota_verify_sha256(s_image, s_image_len, digest);
+    memcpy(s_session, digest, sizeof(s_session));
+    s_digests = malloc(s_chunk_count * OTA_VERIFY_DIGEST_LEN);
+    for (int i = 0; i < s_chunk_count; i++) {
+        size_t start = (size_t)i * OTA_VERIFY_CHUNK_LEN;
+        size_t n = s_image_len - start < OTA_VERIFY_CHUNK_LEN ? s_image_len - start : OTA_VERIFY_CHUNK_LEN;
+        ota_verify_sha256(s_image + start, n, s_digests[i]);
+    }
+
+    receiver_t *receivers = calloc(count, sizeof(*receivers));
+    pthread_t *threads = calloc(count, sizeof(*threads));
+    for (int i = 0; i < count; i++) {
+        receivers[i].index = i;
+        receivers[i].seed = 1234 + i;
+        receivers[i].fd = join_group();
+    }
+    printf("%d receivers on %s:%d, %.0f%% loss in bursts of %.1f, waiting for the sender\n",
+           count, OTA_MCAST_GROUP, OTA_MCAST_PORT, s_loss * 100, s_burst);
+    fflush(stdout);
+    s_start = now_s();
+    for (int i = 0; i < count; i++) {
+        pthread_create(&threads[i], NULL, receive, &receivers[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        close(receivers[i].fd);
+    }
+
+    int complete = 0, corrupt = 0, bad_chunks = 0;
+    uint32_t on_air = 0;
+    uint64_t kept = 0, useful = 0, dropped = 0, arrived = 0;
+    double *times = calloc(count, sizeof(double));
+    int blocks = (s_image_len + OTA_MCAST_BLOCK_LEN - 1) / OTA_MCAST_BLOCK_LEN;
+    for (int i = 0; i < count; i++) {
+        receiver_t *r = &receivers[i];
+        if (r->done) {
+            times[complete++] = r->done - r->first;
+            corrupt += !r->matches;
+        }
+        bad_chunks += r->bad_chunks;
+        on_air = r->arrived > on_air ? r->arrived : on_air;
+        arrived += r->arrived;
+        dropped += r->dropped;
+        kept += r->packets;
+        useful += r->useful;
+    }
+    printf("image %u bytes, %d blocks of %d symbols\n", (unsigned)s_image_len, blocks,
+           OTA_MCAST_BLOCK_SYMBOLS);
+    printf("received over multicast: %d of %d, %d not matching the image, %d bad chunks received again\n",
+           complete, count, corrupt, bad_chunks);
+    if (complete) {
+        qsort(times, complete, sizeof(double), compare_double);
+        printf("time from first packet: p50 %.1f s, p90 %.1f s, max %.1f s\n",
+               times[complete / 2], times[complete * 9 / 10], times[complete - 1]);
+    }
+    printf("packets: %.1f%% lost, %.2f kept per symbol of the image, %.1f%% of the kept ones useful\n",
+           arrived ? 100.0 * dropped / arrived : 0, (double)kept / count / ((s_image_len + OTA_MCAST_SYMBOL_LEN - 1) / OTA_MCAST_SYMBOL_LEN),
+           kept ? 100.0 * useful / kept : 0);
+    double air_mb = (double)on_air * OTA_MCAST_PACKET_LEN / 1e6;
+    double fallback_mb = (double)(count - complete) * s_image_len / 1e6;
+    printf("on the air %.2f MB once for all; unicast would send %.2f MB; fallback downloads %.2f MB\n",
+           air_mb, (double)count * s_image_len / 1e6, fallback_mb);
+    free(times);
+    free(threads);
+    free(receivers);
+    free(s_digests);
+    free(s_image);
+    return corrupt ? 1 : 0;
+}
@@ -0,0 +1,867 @@
+/* Host benchmark for a whole OTA update, phase by phase.
+
+   Runs the device's update flow against a running server.py: resolve the server, connect and
+   handshake (resuming the TLS session after the first run, as save_client_session does), GET
+   /manifest, then GET /firmware.bin with "Accept-Encoding: x-zseg" on the same connection. The
+   body goes through ota_pipeline to a writer thread that decompresses it with ota_inflate,
+   checks the manifest's chunk digests with ota_verify and writes it to a RAM "flash" whose
+   erases and writes sleep for the device's times. The final check hashes the flash against the
+   manifest's image digest, as esp_ota_end() validates the partition. The phases are counted
+   with ota_stats, so every run prints the summary line the device logs.
+
+   The connection goes through a shaping proxy in this process that delays each direction by
+   the one-way latency and paces it to the link rate, so slow or distant links can be reproduced
+   on localhost. The server certificate is not verified (the lab CA is self-signed and its
+   validity is not the point here).
+
+   Every heap allocation of the update (TLS included, the proxy and the RAM "flash" left out)
+   is counted: each run prints the peak above its start, per phase and for OpenSSL alone, and
+   -m writes the timeline of the heap in use to a CSV file. -L runs the low-RAM profile
+   (ota_memory.h): TLS buffers released while idle and capped at 2 KB for the short requests,
+   as mbedTLS dynamic buffers do, and two 2 KB receive buffers.
+
+   Start server.py first, then:
+   Build: gcc -O2 -I.. -o ota_bench ota_bench.c ../ota_inflate.c ../ota_pipeline.c ../ota_stats.c
+          ../ota_verify.c -lssl -lcrypto -lz -lpthread
+   Usage: ./ota_bench [-h host] [-P port] [-r link_kbit_s] [-l latency_ms] [-e erase_us_per_4k]
+                      [-p program_us_per_4k] [-b buf_len] [-B buf_count] [-n runs]
+                      [-v from_version] [-z] [-L] [-m profile.csv]
+*/
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/ssl.h>
+
+#include "ota_inflate.h"
+#include "ota_pipeline.h"
+#include "ota_stats.h"
+#include "ota_verify.h"
+
+#define SECTOR_LEN  4096
+#define SEGMENT_LEN 1436  // bytes the proxy forwards at a time, one TCP segment
+
+static void sleep_us(int64_t us)
+{
+    if (us > 0) {
+        struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// ---- Allocation profile ----
+
+// malloc and friends are replaced by counting wrappers around glibc's own. Allocations are
+// measured with malloc_usable_size(), so freeing subtracts exactly what allocating added.
+extern void *__libc_malloc(size_t len);
+extern void *__libc_calloc(size_t n, size_t len);
+extern void *__libc_realloc(void *ptr, size_t len);
+extern void __libc_free(void *ptr);
+
+typedef enum { PHASE_IDLE, PHASE_CONNECT, PHASE_CHECK, PHASE_RECEIVE, PHASE_COUNT } heap_phase_t;
+static const char *const s_phase_names[PHASE_COUNT] = { "idle", "connect", "check", "receive" };
+
+#define PROFILE_SAMPLES 65536
+#define PROFILE_STEP    1024  // heap change that makes a new timeline sample
+
+typedef struct {
+    int64_t us;
+    heap_phase_t phase;
+    long live, tls;
+} heap_sample_t;
+
+static struct {
+    pthread_mutex_t lock;
+    heap_phase_t phase;
+    long live, peak;            // bytes in use by the update, highest since heap_reset()
+    long tls, tls_peak;         // of those, OpenSSL's
+    long phase_peak[PHASE_COUNT];
+    long count, largest;        // allocations since heap_reset()
+    int64_t start_us;
+    bool timeline;
+    heap_sample_t samples[PROFILE_SAMPLES];
+    int sample_count;
+    long sampled;               // live at the last sample
+} s_heap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Set on the proxy's threads, which stand for the network; the RAM "flash" stands for the
+// partition and is allocated with __libc_malloc()
+static __thread bool t_untracked;
+
+// `tls`: OpenSSL's, through CRYPTO_set_mem_functions()
+static void heap_count(long delta, long len, bool tls)
+{
+    pthread_mutex_lock(&s_heap.lock);
+    s_heap.live += delta;
+    if (tls) {
+        s_heap.tls += delta;
+        if (s_heap.tls > s_heap.tls_peak) {
+            s_heap.tls_peak = s_heap.tls;
+        }
+    }
+    if (s_heap.live > s_heap.peak) {
+        s_heap.peak = s_heap.live;
+    }
+    if (s_heap.live > s_heap.phase_peak[s_heap.phase]) {
+        s_heap.phase_peak[s_heap.phase] = s_heap.live;
+    }
+    if (delta > 0) {
+        s_heap.count++;
+        if (len > s_heap.largest) {
+            s_heap.largest = len;
+        }
+    }
+    long moved = s_heap.live - s_heap.sampled;
+    if (s_heap.timeline && (moved >= PROFILE_STEP || moved <= -PROFILE_STEP) &&
+        s_heap.sample_count < PROFILE_SAMPLES) {
+        s_heap.samples[s_heap.sample_count++] = (heap_sample_t){
+            ota_stats_now() - s_heap.start_us, s_heap.phase, s_heap.live, s_heap.tls };
+        s_heap.sampled = s_heap.live;
+    }
+    pthread_mutex_unlock(&s_heap.lock);
+}
+
+static void *counted_malloc(size_t len, bool tls)
+{
+    void *p = __libc_malloc(len);
+    if (p && !t_untracked) {
+        heap_count(malloc_usable_size(p), len, tls);
+    }
+    return p;
+}
+
+static void *counted_realloc(void *ptr, size_t len, bool tls)
+{
+    long before = ptr && !t_untracked ? (long)malloc_usable_size(ptr) : 0;
+    void *p = __libc_realloc(ptr, len);
+    if (p && !t_untracked) {
+        heap_count((long)malloc_usable_size(p) - before, len, tls);
+    } else if (p == NULL && len == 0 && before) {
+        heap_count(-before, 0, tls);
+    }
+    return p;
+}
+
+static void counted_free(void *ptr, bool tls)
+{
+    if (ptr && !t_untracked) {
+        heap_count(-(long)malloc_usable_size(ptr), 0, tls);
+    }
+    __libc_free(ptr);
+}
+
+void *malloc(size_t len)
+{
+    return counted_malloc(len, false);
+}
+
+void *calloc(size_t n, size_t len)
+{
+    void *p = __libc_calloc(n, len);
+    if (p && !t_untracked) {
+        heap_count(malloc_usable_size(p), n * len, false);
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t len)
+{
+    return counted_realloc(ptr, len, false);
+}
+
+void free(void *ptr)
+{
+    counted_free(ptr, false);
+}
+
+static void *tls_malloc(size_t len, const char *file, int line)
+{
+    return counted_malloc(len, true);
+}
+
+static void *tls_realloc(void *ptr, size_t len, const char *file, int line)
+{
+    return counted_realloc(ptr, len, true);
+}
+
+static void tls_free(void *ptr, const char *file, int line)
+{
+    counted_free(ptr, true);
+}
+
+static void heap_phase(heap_phase_t phase)
+{
+    pthread_mutex_lock(&s_heap.lock);
+    s_heap.phase = phase;
+    pthread_mutex_unlock(&s_heap.lock);
+}
+
+// Start a run: peaks and counts from here, the timeline restarts
+static void heap_reset(bool timeline)
+{
+    pthread_mutex_lock(&s_heap.lock);
+    s_heap.phase = PHASE_IDLE;
+    s_heap.peak = s_heap.live;
+    s_heap.tls_peak = s_heap.tls;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        s_heap.phase_peak[i] = s_heap.live;
+    }
+    s_heap.count = s_heap.largest = 0;
+    s_heap.start_us = ota_stats_now();
+    s_heap.timeline = timeline;
+    s_heap.sample_count = 0;
+    s_heap.sampled = s_heap.live;
+    pthread_mutex_unlock(&s_heap.lock);
+}
+
+// Peaks above `base`, the heap in use when the run started
+static void heap_format(long base, long tls_base, char *buf, size_t len)
+{
+    pthread_mutex_lock(&s_heap.lock);
+    int n = snprintf(buf, len, "peak %ld bytes (TLS %ld)", s_heap.peak - base, s_heap.tls_peak - tls_base);
+    for (int i = PHASE_CONNECT; i < PHASE_COUNT && n > 0 && (size_t)n < len; i++) {
+        n += snprintf(buf + n, len - n, ", %s %ld", s_phase_names[i], s_heap.phase_peak[i] - base);
+    }
+    if (n > 0 && (size_t)n < len) {
+        snprintf(buf + n, len - n, "; %ld allocations, largest %ld bytes, %ld bytes still held",
+                 s_heap.count, s_heap.largest, s_heap.live - base);
+    }
+    pthread_mutex_unlock(&s_heap.lock);
+}
+
+// Timeline of a run, relative to the heap in use when it started
+static void heap_write_profile(FILE *f, int run, long base, long tls_base)
+{
+    pthread_mutex_lock(&s_heap.lock);
+    s_heap.timeline = false;
+    int count = s_heap.sample_count;
+    pthread_mutex_unlock(&s_heap.lock);
+    for (int i = 0; i < count; i++) {
+        const heap_sample_t *sm = &s_heap.samples[i];
+        fprintf(f, "%d,%.3f,%s,%ld,%ld\n", run, sm->us / 1000.0, s_phase_names[sm->phase],
+                sm->live - base, sm->tls - tls_base);
+    }
+}
+
+// ---- Shaping proxy ----
+
+typedef struct segment {
+    struct segment *next;
+    int64_t due_us;  // received + latency
+    size_t len;
+    uint8_t data[SEGMENT_LEN];
+} segment_t;
+
+// One direction of a proxied connection: a reader queues what arrives, a sender forwards it
+// once it is due, no faster than the link
+typedef struct {
+    int from, to;
+    segment_t *head, *tail;
+    bool eof;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} pipe_t;
+
+typedef struct {
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    int listen_fd;
+    unsigned link_kbit;   // 0: unlimited
+    unsigned latency_ms;  // one way
+} proxy_t;
+
+static proxy_t s_proxy;
+
+static void *pipe_reader(void *arg)
+{
+    pipe_t *p = arg;
+    t_untracked = true;
+    while (1) {
+        segment_t *seg = malloc(sizeof(*seg));
+        ssize_t n = recv(p->from, seg->data, sizeof(seg->data), 0);
+        pthread_mutex_lock(&p->lock);
+        if (n <= 0) {
+            free(seg);
+            p->eof = true;
+        } else {
+            seg->len = n;
+            seg->next = NULL;
+            seg->due_us = ota_stats_now() + s_proxy.latency_ms * 1000;
+            if (p->tail) {
+                p->tail->next = seg;
+            } else {
+                p->head = seg;
+            }
+            p->tail = seg;
+        }
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        if (n <= 0) {
+            return NULL;
+        }
+    }
+}
+
+static void *pipe_sender(void *arg)
+{
+    pipe_t *p = arg;
+    int64_t link_free_us = 0;  // the link is busy with the previous segment until then
+    t_untracked = true;
+
+    while (1) {
+        pthread_mutex_lock(&p->lock);
+        while (p->head == NULL && !p->eof) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        segment_t *seg = p->head;
+        if (seg) {
+            p->head = seg->next;
+            if (p->head == NULL) {
+                p->tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (seg == NULL) {
+            shutdown(p->to, SHUT_WR);
+            return NULL;
+        }
+
+        int64_t now = ota_stats_now();
+        int64_t start = seg->due_us > link_free_us ? seg->due_us : link_free_us;
+        if (s_proxy.link_kbit) {
+            link_free_us = (start > now ? start : now) + (int64_t)seg->len * 8 * 1000 / s_proxy.link_kbit;
+        }
+        sleep_us((s_proxy.link_kbit ? link_free_us : start) - now);
+        bool ok = send(p->to, seg->data, seg->len, MSG_NOSIGNAL) == (ssize_t)seg->len;
+        free(seg);
+        if (!ok) {
+            // The far end is gone; stop reading so the other direction winds down too
+            shutdown(p->from, SHUT_RDWR);
+        }
+    }
+}
+
+static void *proxy_connection(void *arg)
+{
+    int client = (int)(intptr_t)arg;
+    t_untracked = true;
+    int server = socket(s_proxy.server.ss_family, SOCK_STREAM, 0);
+    if (connect(server, (struct sockaddr *)&s_proxy.server, s_proxy.server_len) != 0) {
+        perror("proxy connect");
+        close(server);
+        close(client);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pipe_t up = { .from = client, .to = server };
+    pipe_t down = { .from = server, .to = client };
+    pipe_t *pipes[] = { &up, &down };
+    pthread_t threads[4];
+    for (int i = 0; i < 2; i++) {
+        pthread_mutex_init(&pipes[i]->lock, NULL);
+        pthread_cond_init(&pipes[i]->cond, NULL);
+        pthread_create(&threads[2 * i], NULL, pipe_reader, pipes[i]);
+        pthread_create(&threads[2 * i + 1], NULL, pipe_sender, pipes[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    close(server);
+    close(client);
+    return NULL;
+}
+
+static void *proxy_accept(void *arg)
+{
+    t_untracked = true;
+    while (1) {
+        int client = accept(s_proxy.listen_fd, NULL, NULL);
+        if (client < 0) {
+            return NULL;
+        }
+        pthread_t thread;
+        pthread_create(&thread, NULL, proxy_connection, (void *)(intptr_t)client);
+        pthread_detach(thread);
+    }
+}
+
+// Listens on a loopback port; returns it
+static int proxy_start(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    s_proxy.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(s_proxy.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(s_proxy.listen_fd, 4) != 0) {
+        perror("proxy");
+        exit(1);
+    }
+    getsockname(s_proxy.listen_fd, (struct sockaddr *)&addr, &len);
+    pthread_t thread;
+    pthread_create(&thread, NULL, proxy_accept, NULL);
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
+
+// ---- HTTPS client, the esp_http_client side ----
+
+typedef struct {
+    SSL_CTX *ctx;
+    SSL_SESSION *session;  // kept across runs, like save_client_session
+    int proxy_port;
+    int fd;
+    SSL *ssl;
+    uint8_t buf[SECTOR_LEN];
+    size_t pos, len;       // unread part of buf
+} client_t;
+
+typedef struct {
+    int status;
+    long content_len;
+    bool compressed;
+} response_t;
+
+static bool client_connect(client_t *c, ota_stats_t *st)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                                .sin_port = htons(c->proxy_port) };
+    int64_t start_us = ota_stats_now();
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return false;
+    }
+    c->ssl = SSL_new(c->ctx);
+    SSL_set_fd(c->ssl, c->fd);
+    if (c->session) {
+        SSL_set_session(c->ssl, c->session);
+    }
+    if (SSL_connect(c->ssl) != 1) {
+        fprintf(stderr, "TLS handshake failed\n");
+        return false;
+    }
+    ota_stats_add(st, OTA_PHASE_CONNECT, ota_stats_now() - start_us, 0);
+    SSL_SESSION_free(c->session);
+    c->session = SSL_get1_session(c->ssl);
+    c->pos = c->len = 0;
+    return true;
+}
+
+static void client_close(client_t *c)
+{
+    if (c->ssl) {
+        SSL_shutdown(c->ssl);
+        SSL_free(c->ssl);
+        c->ssl = NULL;
+    }
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static int client_read(client_t *c, uint8_t *buf, size_t len)
+{
+    if (c->pos == c->len) {
+        int n = SSL_read(c->ssl, c->buf, sizeof(c->buf));
+        if (n <= 0) {
+            return n < 0 ? -1 : 0;
+        }
+        c->pos = 0;
+        c->len = n;
+    }
+    size_t n = c->len - c->pos < len ? c->len - c->pos : len;
+    memcpy(buf, c->buf + c->pos, n);
+    c->pos += n;
+    return n;
+}
+
+static bool client_request(client_t *c, const char *path, const char *headers, response_t *r)
+{
+    char req[512];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: ota\r\n%s\r\n", path, headers);
+    if (SSL_write(c->ssl, req, n) != n) {
+        return false;
+    }
+
+    // Status line and headers, a byte at a time out of the read buffer
+    char head[2048];
+    size_t len = 0;
+    while (len < 4 || memcmp(head + len - 4, "\r\n\r\n", 4) != 0) {
+        uint8_t ch;
+        if (len == sizeof(head) - 1 || client_read(c, &ch, 1) != 1) {
+            return false;
+        }
+        head[len++] = ch;
+    }
+    head[len] = '\0';
+
+    memset(r, 0, sizeof(*r));
+    r->content_len = -1;
+    sscanf(head, "HTTP/1.%*d %d", &r->status);
+    for (char *line = strstr(head, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            r->content_len = strtol(line + 17, NULL, 10);
+        } else if (strncasecmp(line + 2, "Content-Encoding:", 17) == 0) {
+            r->compressed = strstr(line + 2, OTA_INFLATE_ENCODING) != NULL;
+        }
+    }
+    return r->content_len >= 0;
+}
+
+// ---- Manifest ----
+
+typedef struct {
+    long image_size;
+    uint8_t image_sha256[OTA_VERIFY_DIGEST_LEN];
+    uint8_t chunks[OTA_VERIFY_MAX_CHUNKS][OTA_VERIFY_DIGEST_LEN];
+    int chunk_count;
+} manifest_t;
+
+static bool parse_hex(const char *hex, uint8_t digest[OTA_VERIFY_DIGEST_LEN])
+{
+    for (int i = 0; i < OTA_VERIFY_DIGEST_LEN; i++) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return false;
+        }
+        digest[i] = byte;
+    }
+    return true;
+}
+
+// Only the "image" object is needed; server.py emits it first, so its keys are the first
+// "size", "sha256" and "chunks" in the body
+static bool parse_manifest(const char *body, manifest_t *m)
+{
+    const char *image = strstr(body, "\"image\"");
+    const char *size = image ? strstr(image, "\"size\":") : NULL;
+    const char *sha = image ? strstr(image, "\"sha256\":") : NULL;
+    const char *chunks = image ? strstr(image, "\"chunks\":") : NULL;
+    if (size == NULL || sha == NULL || chunks == NULL) {
+        return false;
+    }
+    m->image_size = strtol(size + 7, NULL, 10);
+    sha = strchr(sha + 9, '"');
+    if (sha == NULL || !parse_hex(sha + 1, m->image_sha256)) {
+        return false;
+    }
+    m->chunk_count = 0;
+    const char *end = strchr(chunks, ']');
+    for (const char *p = strchr(chunks + 9, '"'); p && p < end; p = strchr(p + 2 * OTA_VERIFY_DIGEST_LEN + 2, '"')) {
+        if (m->chunk_count == OTA_VERIFY_MAX_CHUNKS || !parse_hex(p + 1, m->chunks[m->chunk_count])) {
+            return false;
+        }
+        m->chunk_count++;
+    }
+    return m->chunk_count > 0;
+}
+
+// ---- Flash writer, compressed_ota.c's writer task ----
+
+typedef struct {
+    uint8_t *mem;
+    size_t size;
+    size_t offset;
+    size_t erased_end;
+    unsigned erase_us;
+    unsigned program_us;
+    ota_verify_t *verify;
+    ota_inflate_t *inflate;
+    bool compressed;
+    ota_stats_t *stats;
+} writer_t;
+
+static int flash_write(const uint8_t *buf, size_t len, void *ctx)
+{
+    writer_t *w = ctx;
+    int64_t start_us = ota_stats_now();
+    int result = ota_verify_update(w->verify, buf, len);
+    ota_stats_add(w->stats, OTA_PHASE_VERIFY, ota_stats_now() - start_us, len);
+    if (result != 0 || w->offset + len > w->size) {
+        return -1;
+    }
+    while (w->erased_end < w->offset + len) {
+        start_us = ota_stats_now();
+        sleep_us(w->erase_us);
+        memset(w->mem + w->erased_end, 0xff, SECTOR_LEN);
+        ota_stats_add(w->stats, OTA_PHASE_ERASE, ota_stats_now() - start_us, SECTOR_LEN);
+        w->erased_end += SECTOR_LEN;
+    }
+    start_us = ota_stats_now();
+    sleep_us((int64_t)w->program_us * len / SECTOR_LEN);
+    memcpy(w->mem + w->offset, buf, len);
+    ota_stats_add(w->stats, OTA_PHASE_WRITE, ota_stats_now() - start_us, len);
+    w->offset += len;
+    return 0;
+}
+
+static int write_chunk(const uint8_t *buf, size_t len, void *ctx)
+{
+    writer_t *w = ctx;
+    if (!w->compressed) {
+        return flash_write(buf, len, w);
+    }
+    const uint32_t nested = OTA_PHASE_BIT(OTA_PHASE_VERIFY) | OTA_PHASE_BIT(OTA_PHASE_ERASE) |
+                            OTA_PHASE_BIT(OTA_PHASE_WRITE);
+    for (size_t pos = 0; pos < len; ) {
+        size_t used;
+        int64_t start_us = ota_stats_now();
+        int64_t nested_us = ota_stats_nested_us(w->stats, nested);
+        ota_inflate_status_t status = ota_inflate_feed(w->inflate, buf + pos, len - pos, &used);
+        ota_stats_add(w->stats, OTA_PHASE_INFLATE, ota_stats_now() - start_us -
+                      (ota_stats_nested_us(w->stats, nested) - nested_us), used);
+        if (status == OTA_INFLATE_ERROR) {
+            return -1;
+        }
+        pos += used;
+    }
+    return 0;
+}
+
+// ---- One update ----
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *from_version;
+    bool raw;
+    size_t buf_len;
+    int buf_count;
+    unsigned erase_us;
+    unsigned program_us;
+} options_t;
+
+static bool check_and_update(client_t *c, const options_t *o, ota_stats_t *st)
+{
+    // The server's address; the proxy already forwards to it, this is the device's lookup
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    int64_t start_us = ota_stats_now();
+    getaddrinfo(o->host, o->port, &hints, &res);
+    ota_stats_add(st, OTA_PHASE_DNS, ota_stats_now() - start_us, 0);
+    freeaddrinfo(res);
+
+    heap_phase(PHASE_CONNECT);
+    if (!client_connect(c, st)) {
+        return false;
+    }
+
+    char path[128];
+    response_t r;
+    heap_phase(PHASE_CHECK);
+    start_us = ota_stats_now();
+    snprintf(path, sizeof(path), "/manifest?from=%s", o->from_version);
+    if (!client_request(c, path, "", &r) || r.status != 200 || r.content_len >= 65536) {
+        fprintf(stderr, "manifest request failed (HTTP %d)\n", r.status);
+        return false;
+    }
+    char *body = malloc(r.content_len + 1);
+    long len = 0;
+    int n;
+    while (len < r.content_len && (n = client_read(c, (uint8_t *)body + len, r.content_len - len)) > 0) {
+        len += n;
+    }
+    body[len] = '\0';
+    ota_stats_add(st, OTA_PHASE_CHECK, ota_stats_now() - start_us, len);
+    manifest_t m;
+    bool ok = parse_manifest(body, &m);
+    free(body);
+    if (!ok) {
+        fprintf(stderr, "manifest without image chunk digests\n");
+        return false;
+    }
+
+    heap_phase(PHASE_RECEIVE);
+    if (!client_request(c, "/firmware.bin", o->raw ? "" : "Accept-Encoding: " OTA_INFLATE_ENCODING "\r\n", &r) ||
+        r.status != 200) {
+        fprintf(stderr, "firmware request failed (HTTP %d)\n", r.status);
+        return false;
+    }
+    writer_t w = {
+        .size = (m.image_size + SECTOR_LEN - 1) / SECTOR_LEN * SECTOR_LEN,
+        .erase_us = o->erase_us,
+        .program_us = o->program_us,
+        .compressed = r.compressed,
+        .stats = st,
+    };
+    w.mem = __libc_malloc(w.size);  // the partition, not heap
+    w.verify = ota_verify_new(m.chunks, m.chunk_count, 0);
+    w.inflate = r.compressed ? ota_inflate_new(flash_write, &w) : NULL;
+    ota_pipeline_t *p = ota_pipeline_new(o->buf_len, o->buf_count, write_chunk, &w);
+
+    long received = 0;
+    while (received < r.content_len) {
+        uint8_t *buf = ota_pipeline_acquire(p);
+        if (buf == NULL) {
+            break;
+        }
+        size_t want = o->buf_len;
+        if (r.content_len - received < (long)want) {
+            want = r.content_len - received;
+        }
+        start_us = ota_stats_now();
+        n = client_read(c, buf, want);
+        ota_stats_add(st, OTA_PHASE_RECEIVE, ota_stats_now() - start_us, n > 0 ? n : 0);
+        if (n <= 0) {
+            ota_pipeline_submit(p, buf, 0);
+            break;
+        }
+        received += n;
+        ota_pipeline_submit(p, buf, n);
+    }
+    int err = ota_pipeline_drain(p);
+    ok = err == 0 && received == r.content_len && ota_verify_finish(w.verify) == 0;
+
+    // esp_ota_end() reads the partition back to check the image digest
+    start_us = ota_stats_now();
+    uint8_t digest[OTA_VERIFY_DIGEST_LEN];
+    ota_verify_sha256(w.mem, w.offset, digest);
+    ok = ok && w.offset == (size_t)m.image_size && memcmp(digest, m.image_sha256, sizeof(digest)) == 0;
+    ota_stats_add(st, OTA_PHASE_FINALIZE, ota_stats_now() - start_us, w.offset);
+    if (!ok) {
+        fprintf(stderr, "image rejected: %ld of %ld bytes received, %zu flashed, chunk %d\n",
+                received, r.content_len, w.offset, ota_verify_chunk(w.verify));
+    }
+
+    ota_pipeline_free(p);
+    ota_inflate_free(w.inflate);
+    ota_verify_free(w.verify);
+    __libc_free(w.mem);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    // Before OpenSSL allocates anything, so all of its memory is told apart
+    if (!CRYPTO_set_mem_functions(tls_malloc, tls_realloc, tls_free)) {
+        fprintf(stderr, "cannot count OpenSSL's allocations apart\n");
+    }
+
+    options_t o = {
+        .host = "localhost",
+        .port = "5000",
+        .from_version = "v0.0.0",
+        .buf_len = 4096,    // COMPRESSED_OTA_BUF_LEN
+        .buf_count = 4,     // COMPRESSED_OTA_BUF_COUNT
+        .erase_us = 18000,
+        .program_us = 6000,
+    };
+    int runs = 3;
+    bool low_ram = false;
+    bool buf_len_set = false, buf_count_set = false;
+    const char *profile_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:P:r:l:e:p:b:B:n:v:zLm:")) != -1) {
+        switch (opt) {
+        case 'h': o.host = optarg; break;
+        case 'P': o.port = optarg; break;
+        case 'r': s_proxy.link_kbit = strtoul(optarg, NULL, 0); break;
+        case 'l': s_proxy.latency_ms = strtoul(optarg, NULL, 0); break;
+        case 'e': o.erase_us = strtoul(optarg, NULL, 0); break;
+        case 'p': o.program_us = strtoul(optarg, NULL, 0); break;
+        case 'b': o.buf_len = strtoul(optarg, NULL, 0); buf_len_set = true; break;
+        case 'B': o.buf_count = strtoul(optarg, NULL, 0); buf_count_set = true; break;
+        case 'n': runs = strtoul(optarg, NULL, 0); break;
+        case 'v': o.from_version = optarg; break;
+        case 'z': o.raw = true; break;
+        case 'L': low_ram = true; break;
+        case 'm': profile_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-P port] [-r link_kbit_s] [-l latency_ms] "
+                    "[-e erase_us_per_4k] [-p program_us_per_4k] [-b buf_len] [-B buf_count] "
+                    "[-n runs] [-v from_version] [-z] [-L] [-m profile.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (low_ram) {
+        // OTA_LOW_RAM's COMPRESSED_OTA_BUF_LEN and COMPRESSED_OTA_BUF_COUNT
+        o.buf_len = buf_len_set ? o.buf_len : 2048;
+        o.buf_count = buf_count_set ? o.buf_count : 2;
+    }
+    FILE *profile = NULL;
+    if (profile_path) {
+        profile = fopen(profile_path, "w");
+        if (profile == NULL) {
+            perror(profile_path);
+            return 1;
+        }
+        fprintf(profile, "run,ms,phase,heap,tls\n");
+    }
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(o.host, o.port, &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", o.host);
+        return 1;
+    }
+    memcpy(&s_proxy.server, res->ai_addr, res->ai_addrlen);
+    s_proxy.server_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    client_t c = { .fd = -1, .proxy_port = proxy_start() };
+    c.ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(c.ctx, SSL_VERIFY_NONE, NULL);
+    // The ESP32's mbedTLS resumes TLS 1.2 sessions from tickets
+    SSL_CTX_set_max_proto_version(c.ctx, TLS1_2_VERSION);
+    SSL_CTX_set_session_cache_mode(c.ctx, SSL_SESS_CACHE_CLIENT);
+    if (low_ram) {
+        // CONFIG_MBEDTLS_DYNAMIC_BUFFER: record buffers only while a record is in them;
+        // CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN=2048: short outgoing records
+        SSL_CTX_set_mode(c.ctx, SSL_MODE_RELEASE_BUFFERS);
+        SSL_CTX_set_max_send_fragment(c.ctx, 2048);
+    }
+
+    char link[32] = "unlimited";
+    if (s_proxy.link_kbit) {
+        snprintf(link, sizeof(link), "%u kbit/s", s_proxy.link_kbit);
+    }
+    printf("server %s:%s, link %s, latency %u ms each way, flash %u+%u us per 4 KB, "
+           "%d buffers of %zu bytes, %s image%s\n", o.host, o.port, link, s_proxy.latency_ms,
+           o.erase_us, o.program_us, o.buf_count, o.buf_len, o.raw ? "raw" : "compressed",
+           low_ram ? ", low-RAM TLS" : "");
+
+    int failed = 0;
+    for (int i = 1; i <= runs; i++) {
+        // Every run is a new check on a new connection; runs after the first resume the session
+        ota_stats_t st;
+        char line[320];
+        ota_stats_reset(&st);
+        heap_reset(profile != NULL);
+        long base = s_heap.live, tls_base = s_heap.tls;
+        bool ok = check_and_update(&c, &o, &st);
+        bool resumed = c.ssl && SSL_session_reused(c.ssl);
+        client_close(&c);
+        heap_phase(PHASE_IDLE);
+        ota_stats_format(&st, line, sizeof(line));
+        printf("run %d (%s handshake): %s: %s\n", i, resumed ? "resumed" : "full", ok ? "ok" : "FAILED", line);
+        heap_format(base, tls_base, line, sizeof(line));
+        printf("  heap: %s\n", line);
+        if (profile) {
+            heap_write_profile(profile, i, base, tls_base);
+        }
+        failed += !ok;
+    }
+    if (profile) {
+        fclose(profile);
+    }
+    SSL_SESSION_free(c.session);
+    SSL_CTX_free(c.ctx);
+    return failed ? 1 : 0;
+}
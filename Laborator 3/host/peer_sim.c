@@ -0,0 +1,553 @@
+/* Fleet simulation of firmware distribution between devices on a LAN (ota_peer.h).
+
+   One process per device, forked from this one, and an origin process standing in for the
+   update server, all on localhost. The origin sends to every device at once through one
+   uplink of the given rate. A shared memory table stands in for mDNS: a device that has the
+   new image advertises itself there with its port and whether it is sending, and a lookup
+   takes OTA_PEER_QUERY_MS, as mdns_query_ptr() waits that long for answers.
+
+   Each device starts at a random time within the spread (the server's push_spread), looks up
+   peers running the new version, picks one with ota_peer_pick() and GETs /firmware.bin from
+   it over HTTP at its own link rate, checking every chunk against the manifest digests with
+   ota_verify as compressed_ota_run() does. A peer that is busy, slow to answer or sends a bad
+   chunk is dropped and the next one picked, resuming with Range/If-Range from the last good
+   chunk; with none left the device downloads from the origin, as peer_update() in main.c
+   falls back to the server. Once its image is complete and verified, the device serves it
+   itself with ota_peer_parse_range() and ota_peer_response_head(), one upload at a time,
+   answering other requests meanwhile with 503 right away as ota_peer.c does.
+
+   With -m the origin sends at most that many images at once and defers the other devices
+   with 503 and a Retry-After of -w seconds, after which they look for peers again. With -x,
+   that many of the first devices to finish serve a corrupted image, to show that a
+   bad peer costs a retry and never a bad update. -0 turns peers off: the baseline where every
+   device downloads from the origin. Reports the bytes the origin and the peers sent and the
+   update times.
+
+   Build: gcc -O2 -I.. -o peer_sim peer_sim.c ../ota_peer.c ../ota_verify.c -lpthread
+   Usage: ./peer_sim [-n devices] [-s image_bytes] [-t spread_s] [-r link_kbit_s]
+                     [-o origin_kbit_s] [-m max_downloads] [-w retry_after_s] [-x bad_peers] [-0]
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ota_peer.h"
+#include "ota_verify.h"
+
+#define MAX_DEVICES 1000
+#define VERSION     "v0.1.3"
+#define ORIGIN_ETAG "\"origin\""
+#define PEER_ETAG   "\"peer-" VERSION "\""
+// OTA_SESSION_TIMEOUT_MS
+#define TIMEOUT_S   5
+
+typedef struct {
+    double start;          // seconds since the simulation started
+    double done;           // 0 until the image is complete and verified
+    uint64_t from_origin;  // bytes received
+    uint64_t from_peers;
+    int peer_failures;     // peers dropped: busy (503), timed out or sent a bad chunk
+    int deferrals;         // 503 from the origin: waited Retry-After and looked for peers again
+} result_t;
+
+// Shared between all the processes
+typedef struct {
+    int advertised[MAX_DEVICES];  // set once peers[i] is filled in
+    ota_peer_t peers[MAX_DEVICES];
+    result_t results[MAX_DEVICES];
+    int finished;
+    int stop;
+    pthread_mutex_t origin_lock;  // the origin's uplink
+    uint64_t origin_next_ns;
+    int origin_downloads;         // connections holding a place in the download budget
+} shared_t;
+
+static shared_t *s_shared;
+static const uint8_t *s_image;
+static size_t s_image_len;
+static uint8_t (*s_digests)[OTA_VERIFY_DIGEST_LEN];
+static int s_chunk_count;
+static uint64_t s_start_ns;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    uint64_t now = now_ns();
+    if (ns > now) {
+        struct timespec ts = { (ns - now) / 1000000000ull, (ns - now) % 1000000000ull };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static double elapsed_s(void)
+{
+    return (now_ns() - s_start_ns) / 1e9;
+}
+
+static int listen_any(uint16_t *port)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void set_timeout(int fd, int seconds)
+{
+    struct timeval tv = { seconds, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Value of header `name` in a request or response head, copied to `value`; false if absent
+static bool header(const char *head, const char *name, char *value, size_t len)
+{
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, name_len) == 0 && line[2 + name_len] == ':') {
+            const char *start = line + 3 + name_len;
+            while (*start == ' ') {
+                start++;
+            }
+            size_t n = strcspn(start, "\r\n");
+            n = n < len - 1 ? n : len - 1;
+            memcpy(value, start, n);
+            value[n] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+static int read_head(int fd, char *buf, size_t len)
+{
+    size_t used = 0;
+    while (used < len - 1) {
+        ssize_t n = recv(fd, buf + used, 1, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        used += n;
+        buf[used] = '\0';
+        if (used >= 4 && strcmp(buf + used - 4, "\r\n\r\n") == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    int listen_fd;
+    const uint8_t *image;
+    const char *etag;
+    uint8_t *uploads;      // the advertised "n"; NULL for the origin
+    uint64_t pace_ns_per_block;
+    int max_downloads;     // the origin's download budget (max_downloads in channels.json)
+    int retry_s;
+} server_t;
+
+// One connection: requests until the client closes it. The origin paces all its
+// connections together through its uplink and, like fleet_server.py, keeps a download's
+// place in its budget until the connection closes; a peer is only limited by the loopback.
+static void serve_connection(server_t *srv, int fd)
+{
+    char head[1024];
+    char range[64];
+    char if_range[64];
+    char out[256];
+    bool holding = false;
+
+    set_timeout(fd, TIMEOUT_S * 4);
+    while (read_head(fd, head, sizeof(head)) == 0) {
+        if (srv->max_downloads && !holding) {
+            if (__atomic_fetch_add(&s_shared->origin_downloads, 1, __ATOMIC_RELAXED) >= srv->max_downloads) {
+                __atomic_fetch_sub(&s_shared->origin_downloads, 1, __ATOMIC_RELAXED);
+                int n = snprintf(out, sizeof(out), "HTTP/1.1 503 Service Unavailable\r\n"
+                                 "Content-Length: 0\r\nRetry-After: %d\r\n\r\n", srv->retry_s);
+                send(fd, out, n, MSG_NOSIGNAL);
+                continue;
+            }
+            holding = true;
+        }
+        size_t start = 0;
+        int status = 200;
+        if (header(head, "Range", range, sizeof(range)) &&
+            (!header(head, "If-Range", if_range, sizeof(if_range)) || strcmp(if_range, srv->etag) == 0) &&
+            ota_peer_parse_range(range, s_image_len, &start) != 0) {
+            status = 416;
+        }
+        uint8_t idle = 0;
+        if (status == 200 && srv->uploads &&
+            !__atomic_compare_exchange_n(srv->uploads, &idle, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            status = 503;
+        }
+        size_t len = ota_peer_response_head(out, sizeof(out), status, start, s_image_len, srv->etag);
+        if (send(fd, out, len, MSG_NOSIGNAL) != (ssize_t)len) {
+            if (status == 200 && srv->uploads) {
+                __atomic_store_n(srv->uploads, 0, __ATOMIC_RELEASE);
+            }
+            return;
+        }
+        if (status != 200) {
+            continue;
+        }
+        for (size_t pos = start; pos < s_image_len; pos += len) {
+            len = s_image_len - pos < OTA_PEER_BLOCK_LEN ? s_image_len - pos : OTA_PEER_BLOCK_LEN;
+            if (srv->pace_ns_per_block) {
+                pthread_mutex_lock(&s_shared->origin_lock);
+                uint64_t at = s_shared->origin_next_ns > now_ns() ? s_shared->origin_next_ns : now_ns();
+                s_shared->origin_next_ns = at + srv->pace_ns_per_block * len / OTA_PEER_BLOCK_LEN;
+                pthread_mutex_unlock(&s_shared->origin_lock);
+                sleep_until(at);
+            }
+            if (send(fd, srv->image + pos, len, MSG_NOSIGNAL) != (ssize_t)len) {
+                break;
+            }
+        }
+        if (srv->uploads) {
+            __atomic_store_n(srv->uploads, 0, __ATOMIC_RELEASE);
+        }
+    }
+    if (holding) {
+        __atomic_fetch_sub(&s_shared->origin_downloads, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *server_connection(void *arg)
+{
+    server_t srv = *(server_t *)arg;
+    free(arg);
+    serve_connection(&srv, srv.listen_fd);
+    close(srv.listen_fd);
+    return NULL;
+}
+
+static void accept_connection(server_t *srv, int fd)
+{
+    server_t *conn = malloc(sizeof(*conn));
+    *conn = *srv;
+    conn->listen_fd = fd;
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_connection, conn);
+    pthread_detach(thread);
+}
+
+// The update server: a thread per connection sharing one paced uplink
+static void run_origin(server_t *srv)
+{
+    while (1) {
+        int fd = accept(srv->listen_fd, NULL, NULL);
+        if (fd >= 0) {
+            accept_connection(srv, fd);
+        }
+    }
+}
+
+// A peer: a thread per connection too, but one upload at a time through `uploads`
+static void run_peer(server_t *srv)
+{
+    set_timeout(srv->listen_fd, 1);
+    while (!__atomic_load_n(&s_shared->stop, __ATOMIC_RELAXED)) {
+        int fd = accept(srv->listen_fd, NULL, NULL);
+        if (fd >= 0) {
+            accept_connection(srv, fd);
+        }
+    }
+}
+
+// GET /firmware.bin from *offset on, checking chunks as they arrive. Returns 0 once the whole
+// image is verified, the Retry-After seconds of a 503, -1 for any other failure; *offset is
+// then where the next attempt can resume (with *etag).
+static int download(uint16_t port, size_t *offset, char *etag, size_t etag_len, unsigned link_kbit,
+                    uint64_t *received)
+{
+    char head[1024];
+    char value[64];
+    uint8_t buf[OTA_PEER_BLOCK_LEN];
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    set_timeout(fd, TIMEOUT_S);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int n = snprintf(head, sizeof(head), "GET /firmware.bin HTTP/1.1\r\nHost: peer\r\n");
+    if (*offset) {
+        n += snprintf(head + n, sizeof(head) - n, "Range: bytes=%u-\r\nIf-Range: %s\r\n",
+                      (unsigned)*offset, etag);
+    }
+    n += snprintf(head + n, sizeof(head) - n, "\r\n");
+    if (send(fd, head, n, MSG_NOSIGNAL) != n || read_head(fd, head, sizeof(head)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int status = atoi(head + 9);
+    if (status == 200) {
+        *offset = 0;
+    } else if (status != 206) {
+        close(fd);
+        if (status == 503 && header(head, "Retry-After", value, sizeof(value)) && atoi(value) > 0) {
+            return atoi(value);
+        }
+        return -1;
+    }
+    if (header(head, "ETag", value, sizeof(value))) {
+        strncpy(etag, value, etag_len - 1);
+        etag[etag_len - 1] = '\0';
+    }
+
+    ota_verify_t *verify = ota_verify_new(s_digests, s_chunk_count, *offset);
+    size_t pos = *offset;
+    uint64_t start_ns = now_ns();
+    int ret = -1;
+    while (pos < s_image_len) {
+        size_t want = s_image_len - pos < sizeof(buf) ? s_image_len - pos : sizeof(buf);
+        ssize_t got = recv(fd, buf, want, 0);
+        if (got <= 0) {
+            break;
+        }
+        *received += got;
+        if (ota_verify_update(verify, buf, got) != 0) {
+            break;
+        }
+        pos += got;
+        // The device's link (and flash) rate
+        sleep_until(start_ns + (pos - *offset) * 8000000ull / link_kbit);
+    }
+    if (pos == s_image_len && ota_verify_finish(verify) == 0) {
+        ret = 0;
+    }
+    // Everything before the chunk being hashed (or the one that failed) matched
+    *offset = (size_t)ota_verify_chunk(verify) * OTA_VERIFY_CHUNK_LEN;
+    ota_verify_free(verify);
+    close(fd);
+    return ret;
+}
+
+// Query the stand-in for mDNS: up to OTA_PEER_MAX advertised devices, in no particular order
+static int find_peers(ota_peer_t *peers, int devices, unsigned seed)
+{
+    int count = 0;
+    usleep(OTA_PEER_QUERY_MS * 1000);
+    for (int k = 0; k < devices && count < OTA_PEER_MAX; k++) {
+        int i = (seed + k) % devices;
+        if (__atomic_load_n(&s_shared->advertised[i], __ATOMIC_ACQUIRE)) {
+            peers[count] = s_shared->peers[i];
+            peers[count].uploads = __atomic_load_n(&s_shared->peers[i].uploads, __ATOMIC_RELAXED);
+            count++;
+        }
+    }
+    return count;
+}
+
+static void run_device(int index, int devices, double start_s, unsigned link_kbit, uint16_t origin_port,
+                       bool use_peers, int bad_peers)
+{
+    result_t *r = &s_shared->results[index];
+    char etag[64] = "";
+    size_t offset = 0;
+    unsigned seed = index * 2654435761u;
+
+    sleep_until(s_start_ns + (uint64_t)(start_s * 1e9));
+    r->start = elapsed_s();
+
+    // ota_update(): peers first (peer_update()), then the server; deferred by the server, the
+    // next check starts over with the peers
+    bool done = false;
+    while (!done) {
+        ota_peer_t peers[OTA_PEER_MAX];
+        int count = use_peers ? find_peers(peers, devices, rand_r(&seed)) : 0;
+        while (count > 0 && !done) {
+            int i = ota_peer_pick(peers, count, VERSION, rand_r(&seed));
+            if (i < 0) {
+                break;
+            }
+            done = download(peers[i].port, &offset, etag, sizeof(etag), link_kbit, &r->from_peers) == 0;
+            if (!done) {
+                r->peer_failures++;
+                count = ota_peer_remove(peers, count, i);
+            }
+        }
+        int ret = -1;
+        while (!done && ret < 0) {
+            ret = download(origin_port, &offset, etag, sizeof(etag), link_kbit, &r->from_origin);
+            done = ret == 0;
+        }
+        if (!done) {
+            r->deferrals++;
+            sleep(ret);
+        }
+    }
+    r->done = elapsed_s();
+    int rank = __atomic_fetch_add(&s_shared->finished, 1, __ATOMIC_RELEASE);
+
+    if (!use_peers) {
+        return;
+    }
+    // Serve what was received, which is the verified image; a bad peer flips a byte in it
+    uint8_t *copy = malloc(s_image_len);
+    memcpy(copy, s_image, s_image_len);
+    if (rank < bad_peers) {
+        copy[s_image_len / 2] ^= 0xff;
+    }
+    ota_peer_t *me = &s_shared->peers[index];
+    server_t srv = { .image = copy, .etag = PEER_ETAG, .uploads = &me->uploads };
+    srv.listen_fd = listen_any(&me->port);
+    strcpy(me->host, "127.0.0.1");
+    strcpy(me->version, VERSION);
+    __atomic_store_n(&s_shared->advertised[index], 1, __ATOMIC_RELEASE);
+    run_peer(&srv);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+    int devices = 100;
+    size_t image_len = 1000000;
+    double spread_s = 10;
+    unsigned link_kbit = 8000;
+    unsigned origin_kbit = 20000;
+    int bad_peers = 0;
+    int max_downloads = 0;
+    int retry_s = 5;
+    bool use_peers = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:t:r:o:m:w:x:0")) != -1) {
+        switch (opt) {
+        case 'n': devices = atoi(optarg); break;
+        case 's': image_len = strtoul(optarg, NULL, 0); break;
+        case 't': spread_s = atof(optarg); break;
+        case 'r': link_kbit = atoi(optarg); break;
+        case 'o': origin_kbit = atoi(optarg); break;
+        case 'm': max_downloads = atoi(optarg); break;
+        case 'w': retry_s = atoi(optarg); break;
+        case 'x': bad_peers = atoi(optarg); break;
+        case '0': use_peers = false; break;
+        default:
+            fprintf(stderr, "usage: %s [-n devices] [-s image_bytes] [-t spread_s] [-r link_kbit_s] "
+                    "[-o origin_kbit_s] [-m max_downloads] [-w retry_after_s] [-x bad_peers] [-0]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (devices < 1 || devices > MAX_DEVICES || link_kbit == 0 || origin_kbit == 0 || retry_s < 1 ||
+        image_len > (size_t)OTA_VERIFY_MAX_CHUNKS * OTA_VERIFY_CHUNK_LEN) {
+        fprintf(stderr, "1 to %d devices, link rates above 0, image at most %d bytes\n",
+                MAX_DEVICES, OTA_VERIFY_MAX_CHUNKS * OTA_VERIFY_CHUNK_LEN);
+        return 1;
+    }
+
+    // The image and its manifest digests, inherited by every process
+    uint8_t *image = malloc(image_len);
+    srand(1);
+    for (size_t i = 0; i < image_len; i++) {
+        image[i] = rand();
+    }
+    s_image = image;
+    s_image_len = image_len;
+    s_chunk_count = (image_len + OTA_VERIFY_CHUNK_LEN - 1) / OTA_VERIFY_CHUNK_LEN;
+    s_digests = malloc(s_chunk_count * OTA_VERIFY_DIGEST_LEN);
+    for (int i = 0; i < s_chunk_count; i++) {
+        size_t len = image_len - i * OTA_VERIFY_CHUNK_LEN;
+        ota_verify_sha256(image + i * OTA_VERIFY_CHUNK_LEN,
+                          len < OTA_VERIFY_CHUNK_LEN ? len : OTA_VERIFY_CHUNK_LEN, s_digests[i]);
+    }
+
+    s_shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&s_shared->origin_lock, &attr);
+
+    uint16_t origin_port;
+    server_t origin = { .image = image, .etag = ORIGIN_ETAG,
+                        .pace_ns_per_block = OTA_PEER_BLOCK_LEN * 8000000ull / origin_kbit,
+                        .max_downloads = max_downloads, .retry_s = retry_s };
+    origin.listen_fd = listen_any(&origin_port);
+    pid_t origin_pid = fork();
+    if (origin_pid == 0) {
+        run_origin(&origin);
+        _exit(0);
+    }
+
+    s_start_ns = now_ns();
+    pid_t *pids = malloc(devices * sizeof(pid_t));
+    srand(2);
+    for (int i = 0; i < devices; i++) {
+        double start_s = spread_s * rand() / RAND_MAX;
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            run_device(i, devices, start_s, link_kbit, origin_port, use_peers, bad_peers);
+            _exit(0);
+        }
+    }
+    while (__atomic_load_n(&s_shared->finished, __ATOMIC_ACQUIRE) < devices) {
+        usleep(100000);
+    }
+    __atomic_store_n(&s_shared->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < devices; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    kill(origin_pid, SIGTERM);
+    waitpid(origin_pid, NULL, 0);
+
+    uint64_t from_origin = 0, from_peers = 0;
+    int failures = 0, from_peer_only = 0, deferrals = 0;
+    double last = 0;
+    double *times = malloc(devices * sizeof(double));
+    for (int i = 0; i < devices; i++) {
+        const result_t *r = &s_shared->results[i];
+        from_origin += r->from_origin;
+        from_peers += r->from_peers;
+        failures += r->peer_failures;
+        deferrals += r->deferrals;
+        from_peer_only += r->from_origin == 0;
+        times[i] = r->done - r->start;
+        last = r->done > last ? r->done : last;
+    }
+    qsort(times, devices, sizeof(double), compare_double);
+    printf("%d devices over %.0f s, %u byte image, %u kbit/s links, origin %u kbit/s",
+           devices, spread_s, (unsigned)image_len, link_kbit, origin_kbit);
+    if (max_downloads) {
+        printf(" and %d downloads at once", max_downloads);
+    }
+    printf(", peers %s", use_peers ? "on" : "off");
+    printf(bad_peers ? ", %d bad\n" : "\n", bad_peers);
+    printf("origin sent %.1f MB (%.0f%% of every device from the origin), peers %.1f MB\n",
+           from_origin / 1e6, 100.0 * from_origin / ((double)devices * image_len), from_peers / 1e6);
+    printf("%d devices updated from peers alone, %d peers dropped (busy, slow or bad chunk), "
+           "%d deferrals by the origin\n", from_peer_only, failures, deferrals);
+    printf("update time p50 %.1f s, p90 %.1f s, max %.1f s; all done %.1f s after the first start\n",
+           times[devices / 2], times[devices * 9 / 10], times[devices - 1], last);
+    return 0;
+}
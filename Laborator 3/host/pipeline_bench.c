@@ -0,0 +1,222 @@
+/* Host benchmark for the download/flash-write pipeline.
+
+   A sender thread streams an image over a socketpair at the given link speed, through socket
+   buffers the size of the device's TCP window, so a receiver that stops reading stalls the
+   sender as a busy ESP32 stalls the server. Each receive also costs the time the device spends
+   decrypting TLS records on the downloading task. The receiving side either reads and writes in
+   turn, like the old OTA loop, or hands buffers to ota_pipeline's writer thread. The "flash" is
+   a RAM array whose writes sleep for the sector erase and program times, and is compared with
+   the image at the end. Reports the time per configuration and the speed-up over the serial
+   loop.
+
+   The socket buffer alone already keeps the link busy during a flash write, as lwIP's TCP
+   window does on the device; what the pipeline overlaps is the receiving task's own work
+   (decryption) with the flash writes.
+
+   Build: gcc -O2 -I.. -o pipeline_bench pipeline_bench.c ../ota_pipeline.c -lpthread
+   Usage: ./pipeline_bench [-s image_bytes] [-l link_kbit_s] [-w tcp_window] [-b buf_len]
+                           [-e erase_us_per_4k] [-p program_us_per_4k] [-d decrypt_us_per_4k]
+*/
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ota_pipeline.h"
+
+#define SECTOR_LEN 4096
+#define MSS        1436
+
+typedef struct {
+    int sock;
+    const uint8_t *img;
+    size_t len;
+    unsigned link_kbit;
+} sender_t;
+
+static unsigned s_decrypt_us = 3000;
+
+typedef struct {
+    uint8_t *mem;
+    size_t offset;
+    size_t erased_end;
+    unsigned erase_us;
+    unsigned program_us;
+} flash_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+// Sends MSS-sized segments no faster than the link; send() blocks while the window is full.
+// Time the link spent idle because of a full window is lost, there is no catching up.
+static void *sender_thread(void *arg)
+{
+    sender_t *s = arg;
+    uint64_t due = now_ns();
+
+    for (size_t pos = 0; pos < s->len; ) {
+        size_t n = s->len - pos < MSS ? s->len - pos : MSS;
+        uint64_t now = now_ns();
+        due = (due > now ? due : now) + (uint64_t)n * 8 * 1000000 / s->link_kbit;
+        if (due > now) {
+            sleep_us((due - now) / 1000);
+        }
+        ssize_t sent = send(s->sock, s->img + pos, n, 0);
+        if (sent <= 0) {
+            break;
+        }
+        pos += sent;
+    }
+    shutdown(s->sock, SHUT_WR);
+    return NULL;
+}
+
+// Erases each sector before its first write, like compressed_ota.c's flash_write()
+static int flash_write(const uint8_t *buf, size_t len, void *ctx)
+{
+    flash_t *f = ctx;
+    while (f->erased_end < f->offset + len) {
+        sleep_us(f->erase_us);
+        f->erased_end += SECTOR_LEN;
+    }
+    sleep_us((uint64_t)f->program_us * len / SECTOR_LEN);
+    memcpy(f->mem + f->offset, buf, len);
+    f->offset += len;
+    return 0;
+}
+
+// recv() plus the TLS record decryption esp_http_client_read() does on the device
+static ssize_t receive(int sock, uint8_t *buf, size_t len)
+{
+    ssize_t n = recv(sock, buf, len, 0);
+    if (n > 0) {
+        sleep_us((uint64_t)s_decrypt_us * n / SECTOR_LEN);
+    }
+    return n;
+}
+
+static int open_link(sender_t *s, pthread_t *thread, int window)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+    s->sock = sv[0];
+    pthread_create(thread, NULL, sender_thread, s);
+    return sv[1];
+}
+
+// buf_count 0: the serial read-then-write loop; otherwise the pipeline with that many buffers
+static double run(sender_t *s, flash_t *f, int window, size_t buf_len, int buf_count)
+{
+    pthread_t thread;
+    memset(f->mem, 0, s->len);
+    f->offset = 0;
+    f->erased_end = 0;
+    int sock = open_link(s, &thread, window);
+    uint64_t start = now_ns();
+
+    if (buf_count == 0) {
+        uint8_t *buf = malloc(buf_len);
+        ssize_t n;
+        while ((n = receive(sock, buf, buf_len)) > 0) {
+            flash_write(buf, n, f);
+        }
+        free(buf);
+    } else {
+        ota_pipeline_t *p = ota_pipeline_new(buf_len, buf_count, flash_write, f);
+        while (1) {
+            uint8_t *buf = ota_pipeline_acquire(p);
+            ssize_t n = receive(sock, buf, buf_len);
+            if (n <= 0) {
+                ota_pipeline_submit(p, buf, 0);
+                break;
+            }
+            ota_pipeline_submit(p, buf, n);
+        }
+        ota_pipeline_drain(p);
+        ota_pipeline_free(p);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    pthread_join(thread, NULL);
+    close(sock);
+    close(s->sock);
+    if (f->offset != s->len || memcmp(f->mem, s->img, s->len) != 0) {
+        fprintf(stderr, "FAIL: flash differs from the image (%zu of %zu bytes)\n", f->offset, s->len);
+        exit(1);
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    size_t len = 512 * 1024;
+    size_t buf_len = 4096;
+    int window = 5744;
+    sender_t s = { .link_kbit = 1600 };
+    flash_t f = { .erase_us = 18000, .program_us = 6000 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:l:w:b:e:p:d:")) != -1) {
+        switch (opt) {
+        case 's': len = strtoul(optarg, NULL, 0); break;
+        case 'l': s.link_kbit = strtoul(optarg, NULL, 0); break;
+        case 'w': window = strtoul(optarg, NULL, 0); break;
+        case 'b': buf_len = strtoul(optarg, NULL, 0); break;
+        case 'e': f.erase_us = strtoul(optarg, NULL, 0); break;
+        case 'p': f.program_us = strtoul(optarg, NULL, 0); break;
+        case 'd': s_decrypt_us = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-s image_bytes] [-l link_kbit_s] [-w tcp_window] [-b buf_len] "
+                    "[-e erase_us_per_4k] [-p program_us_per_4k] [-d decrypt_us_per_4k]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    uint8_t *img = malloc(len);
+    srand(1);
+    for (size_t i = 0; i < len; i++) {
+        img[i] = rand();
+    }
+    s.img = img;
+    s.len = len;
+    f.mem = malloc(len);
+
+    double link_s = len * 8.0 / (s.link_kbit * 1000.0);
+    double flash_s = (double)(len + SECTOR_LEN - 1) / SECTOR_LEN * (f.erase_us + f.program_us) / 1e6;
+    double decrypt_s = (double)len / SECTOR_LEN * s_decrypt_us / 1e6;
+    printf("image %zu bytes, link %u kbit/s (%.2f s), decrypt %u us per 4 KB (%.2f s), "
+           "flash %u+%u us per 4 KB (%.2f s), window %d bytes, buffers of %zu bytes\n",
+           len, s.link_kbit, link_s, s_decrypt_us, decrypt_s, f.erase_us, f.program_us, flash_s,
+           window, buf_len);
+
+    double serial = run(&s, &f, window, buf_len, 0);
+    printf("serial read/write:   %.2f s\n", serial);
+    const int counts[] = { 1, 2, 4, 8 };
+    for (int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        double t = run(&s, &f, window, buf_len, counts[i]);
+        printf("pipeline %d buffer%s:  %.2f s (%.2fx), output verified\n",
+               counts[i], counts[i] == 1 ? " " : "s", t, serial / t);
+    }
+    free(img);
+    free(f.mem);
+    return 0;
+}
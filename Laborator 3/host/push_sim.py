@@ -0,0 +1,187 @@
+"""Simulated fleet waiting for a release: periodic polling against long-poll push.
+
+Each of --devices devices starts at a random time and either polls /manifest every
+--period seconds, on a new TLS connection each time as the device reconnects after the
+server's 30 s idle timeout, or, with --push, holds /manifest?wait=<--wait> open on one
+kept-alive connection and asks again as soon as the server answers, like ota_task with
+CONFIG_OTA_PUSH_WAIT_S. --publish seconds in, the "stable" channel of the server's
+channels.json is pointed at --release; a device is notified when its manifest offers it.
+
+Reports, over the second half of the time before the release (after the fleet has
+connected), the server's requests and TLS handshakes per second and the device wake-ups
+(responses received) per device and minute; after the release, the time from
+publishing to each device being notified and the most notifications in one second, which
+is the start of the download wave that push_spread in channels.json flattens.
+channels.json is restored afterwards.
+
+Times are seconds as given: scale the device's defaults (4 min period, 5 min wait) down
+together to keep a run short. Start the server in the directory of channels.json, then:
+    python host/push_sim.py --channels <server dir>/channels.json --from v0.1.2 --release v0.1.3
+                            [--devices 1000] [--period 12 | --push --wait 15]
+                            [--publish 60] [--duration 90]
+"""
+import argparse
+import asyncio
+import json
+import os
+import random
+import ssl
+import time
+
+
+class Counters:
+    def __init__(self):
+        self.requests = 0
+        self.handshakes = 0
+        self.wakeups = 0
+
+
+async def request(reader, writer, path, headers, timeout):
+    """(status, body) of one GET on a kept-alive connection"""
+    writer.write(("GET %s HTTP/1.1\r\nHost: ota\r\n%s\r\n" % (path, headers)).encode())
+    await writer.drain()
+    status_line = await asyncio.wait_for(reader.readline(), timeout)
+    if not status_line:
+        raise ConnectionError("connection closed")
+    status = int(status_line.split()[1])
+    length = 0
+    while True:
+        line = await reader.readline()
+        if line in (b'\r\n', b''):
+            break
+        name, _, value = line.decode('latin-1').partition(':')
+        if name.lower() == 'content-length':
+            length = int(value)
+    return status, await reader.readexactly(length) if length else b''
+
+
+class Device:
+    def __init__(self, args, ctx, index, counters):
+        self.args = args
+        self.ctx = ctx
+        self.counters = counters
+        # Stands in for the station MAC the firmware sends
+        self.headers = 'X-Device-Id: %012x\r\nIf-None-Match: "%s"\r\n' % (
+            0x24a160000000 + index, getattr(args, 'from'))
+        self.connection = None
+        self.notified_at = None
+
+    async def check(self, wait):
+        """One manifest request; True once the release is offered"""
+        if self.connection is None:
+            self.connection = await asyncio.open_connection(self.args.host, self.args.port,
+                                                            ssl=self.ctx)
+            self.counters.handshakes += 1
+        reader, writer = self.connection
+        self.counters.requests += 1
+        status, body = await request(reader, writer, "/manifest?from=%s&wait=%d" % (
+            getattr(self.args, 'from'), wait), self.headers, wait + 10)
+        self.counters.wakeups += 1
+        if status == 200 and json.loads(body)["version"] == self.args.release:
+            self.notified_at = time.perf_counter()
+            return True
+        return False
+
+    def disconnect(self):
+        if self.connection:
+            self.connection[1].close()
+            self.connection = None
+
+    async def run(self, end):
+        try:
+            # Devices boot at different times
+            if self.args.push:
+                await asyncio.sleep(random.uniform(0, self.args.wait))
+                while time.perf_counter() < end:
+                    if await self.check(self.args.wait):
+                        break
+            else:
+                await asyncio.sleep(random.uniform(0, self.args.period))
+                while time.perf_counter() < end:
+                    found = await self.check(0)
+                    self.disconnect()
+                    if found:
+                        break
+                    await asyncio.sleep(self.args.period)
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ssl.SSLError):
+            pass
+        finally:
+            self.disconnect()
+
+
+def percentiles(values):
+    values = sorted(values)
+    pick = lambda p: values[min(int(p / 100 * len(values)), len(values) - 1)]
+    return "p50 %.1f s, p90 %.1f s, p99 %.1f s, max %.1f s" % (
+        pick(50), pick(90), pick(99), values[-1])
+
+
+def write_channels(path, version, spread):
+    with open(path + '.tmp', 'w') as f:
+        json.dump({"default": "stable", "channels": {"stable": {"version": version}},
+                   "push_spread": spread}, f)
+    os.replace(path + '.tmp', path)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5000)
+    parser.add_argument('--devices', type=int, default=100)
+    parser.add_argument('--channels', required=True, help="the server's channels.json")
+    parser.add_argument('--from', required=True, help='version the devices run')
+    parser.add_argument('--release', required=True, help='version published during the run')
+    parser.add_argument('--push', action='store_true', help='long-poll instead of polling')
+    parser.add_argument('--period', type=float, default=12, help='seconds between polls')
+    parser.add_argument('--wait', type=int, default=15, help='seconds a long poll is held')
+    parser.add_argument('--spread', type=float, default=3, help="the server's push_spread")
+    parser.add_argument('--publish', type=float, default=60, help='seconds before the release')
+    parser.add_argument('--duration', type=float, default=90)
+    args = parser.parse_args()
+
+    # The lab certificate is self-signed; verification is not what is measured
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    with open(args.channels) as f:
+        original = f.read()
+    write_channels(args.channels, getattr(args, 'from'), args.spread)
+    # The server looks at the file at most once a second
+    await asyncio.sleep(1.5)
+    try:
+        random.seed(1)
+        counters = Counters()
+        start = time.perf_counter()
+        devices = [Device(args, ctx, i, counters) for i in range(args.devices)]
+        tasks = [asyncio.create_task(d.run(start + args.duration)) for d in devices]
+
+        await asyncio.sleep(args.publish / 2)
+        warm = (counters.requests, counters.handshakes, counters.wakeups)
+        await asyncio.sleep(args.publish / 2)
+        idle = [now - then for now, then in
+                zip((counters.requests, counters.handshakes, counters.wakeups), warm)]
+        published_at = time.perf_counter()
+        write_channels(args.channels, args.release, args.spread)
+        await asyncio.gather(*tasks)
+    finally:
+        with open(args.channels, 'w') as f:
+            f.write(original)
+
+    mode = "push, %d s wait" % args.wait if args.push else "polling every %.0f s" % args.period
+    print("%d devices, %s" % (args.devices, mode))
+    print("before the release: %.1f requests/s, %.1f handshakes/s, %.2f wake-ups per device-minute"
+          % (idle[0] / (args.publish / 2), idle[1] / (args.publish / 2),
+             idle[2] / args.devices / (args.publish / 120)))
+    latency = [d.notified_at - published_at for d in devices if d.notified_at]
+    print("notified: %d of %d" % (len(latency), args.devices))
+    if latency:
+        per_second = {}
+        for t in latency:
+            per_second[int(t)] = per_second.get(int(t), 0) + 1
+        print("release to notification: " + percentiles(latency))
+        print("peak notifications in one second: %d" % max(per_second.values()))
+
+
+if __name__ == '__main__':
+    asyncio.run(main())
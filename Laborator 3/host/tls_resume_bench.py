@@ -0,0 +1,89 @@
+"""TLS handshake cost with and without session resumption, against server.py.
+
+full:    every connection does a full handshake (certificate chain, key exchange)
+resumed: every connection offers the session ticket of the previous one, as ota_session does
+         after the server closed an idle connection
+
+The device speaks TLS 1.2 (mbedTLS), so this does too. Besides the time, it counts the
+handshake bytes each way: the server certificate the device has to receive and parse, and so
+keep in RAM, is only sent in a full handshake. The device logs its own handshake time and heap.
+
+Start server.py first, then:
+    python host/tls_resume_bench.py --host 127.0.0.1 --runs 50 [--no-verify]
+"""
+import argparse
+import socket
+import ssl
+import statistics
+import time
+
+
+def handshake(args, ctx, session):
+    """One connection: returns (seconds, bytes sent, bytes received, reused, session)."""
+    sock = socket.create_connection((args.host, args.port))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    incoming, outgoing = ssl.MemoryBIO(), ssl.MemoryBIO()
+    tls = ctx.wrap_bio(incoming, outgoing, server_hostname=args.host, session=session)
+    sent = received = 0
+
+    start = time.perf_counter()
+    while True:
+        try:
+            tls.do_handshake()
+            break
+        except ssl.SSLWantReadError:
+            pass
+        data = outgoing.read()
+        sent += len(data)
+        sock.sendall(data)
+        data = sock.recv(16384)
+        if not data:
+            raise ConnectionError("server closed the connection during the handshake")
+        received += len(data)
+        incoming.write(data)
+    # The client's Finished message of a full handshake
+    data = outgoing.read()
+    sent += len(data)
+    sock.sendall(data)
+    elapsed = time.perf_counter() - start
+
+    reused = tls.session_reused
+    session = tls.session
+    sock.close()
+    return elapsed, sent, received, reused, session
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--runs", type=int, default=20)
+    parser.add_argument("--cafile", default="ca_cert.pem")
+    parser.add_argument("--no-verify", action="store_true",
+                        help="skip certificate checks, e.g. once the lab certificate has expired")
+    args = parser.parse_args()
+
+    ctx = ssl.create_default_context(cafile=args.cafile)
+    ctx.check_hostname = False
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+    if args.no_verify:
+        ctx.verify_mode = ssl.CERT_NONE
+
+    for name, resume in (("full", False), ("resumed", True)):
+        samples = []
+        session = None
+        for _ in range(args.runs + 1):
+            elapsed, sent, received, reused, last = handshake(args, ctx, session if resume else None)
+            samples.append((elapsed, sent, received, reused))
+            session = last
+        # The first connection of the resumed series has no session to offer yet
+        samples = samples[1:]
+        times = [s[0] * 1000 for s in samples]
+        print("{:8} handshake: median {:.2f} ms, min {:.2f} ms, {} bytes sent, {} bytes received, "
+              "{}/{} resumed".format(name, statistics.median(times), min(times),
+                                     samples[-1][1], samples[-1][2],
+                                     sum(s[3] for s in samples), len(samples)))
+
+
+if __name__ == "__main__":
+    main()
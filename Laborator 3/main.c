@@ -11,6 +11,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_random.h"
 #include "driver/gpio.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
@@ -19,6 +20,7 @@
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
 #include "esp_tls.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
@@ -26,6 +28,13 @@
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
 
+#include "compressed_ota.h"
+#include "delta_ota.h"
+#include "ota_manifest.h"
+#include "ota_mcast.h"
+#include "ota_peer.h"
+#include "ota_resume.h"
+#include "ota_session.h"
 #include "version.h"  // This will be generated by versioning.py
 
 #define CONFIG_ESP_WIFI_SSID      "lab-iot"
@@ -35,6 +44,32 @@
 
 //TODO: Modificati adresa IP de mai jos pentru a coincide cu cea a PC-ul pe care rulati scriptul python
 #define CONFIG_EXAMPLE_FIRMWARE_UPGRADE_URL "https://192.168.89.42:5000/firmware.bin" 
+// Same server: the manifest, the patch and the image are all fetched over one connection to it
+#define CONFIG_OTA_SERVER_URL     "https://192.168.89.42:5000"
+// 1: one keep-alive connection for /manifest and the download, 0: /version on its own
+// connection first, as before (kept to compare the update check to first firmware byte time)
+#define CONFIG_OTA_USE_MANIFEST   1
+// Download attempts per update; each one resumes where the previous one was cut off
+#define CONFIG_OTA_MAX_ATTEMPTS   5
+#define CONFIG_OTA_RETRY_DELAY_MS 2000
+// Update checks without a button press. Shorter than the server's TLS session lifetime (300 s),
+// so the reconnect for each check resumes the session instead of a full handshake.
+#define CONFIG_OTA_CHECK_PERIOD_MS (4 * 60 * 1000)
+// Instead of periodic checks, wait on the server for a release: the manifest request is held
+// open up to this long and answered as soon as one is published, so the device sleeps in a
+// socket read rather than waking to poll. A button press is seen when the wait ends.
+// 0: periodic checks every CONFIG_OTA_CHECK_PERIOD_MS (needs CONFIG_OTA_USE_MANIFEST).
+#define CONFIG_OTA_PUSH_WAIT_S    (5 * 60)
+// 1: serve the running image to other devices on the LAN (ota_peer.h) and download new
+// versions from them when one has it, before asking the update server
+#define CONFIG_OTA_PEER           0
+// 1: listen for the new version on the multicast group (mcast_sender.py, ota_mcast.h) before
+// downloading it; without a sender in the room this costs OTA_MCAST_IDLE_MS per update
+#define CONFIG_OTA_MULTICAST      0
+// Stack of the OTA task. The TLS handshake runs on it below ota_update(), whose large
+// structures (manifest, sessions, peer list) are static for that reason. Every update report
+// logs the stack left; OTA_MEMORY_STACK_MARGIN less than that is warned about.
+#define CONFIG_OTA_TASK_STACK     (OTA_LOW_RAM ? 6144 : 8192)
 
 #define GPIO_OUTPUT_IO 4
 #define GPIO_OUTPUT_PIN_SEL (1ULL<<GPIO_OUTPUT_IO)
@@ -58,37 +93,6 @@ static int s_retry_num = 0;
 static char server_version[32];
 static bool version_received = false;
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt)
-{
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADER_SENT:
-        ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-        break;
-    case HTTP_EVENT_REDIRECT:
-        ESP_LOGI(TAG, "HTTP_EVENT_REDIRECT");
-        break;
-    }
-    return ESP_OK;
-}
-
 esp_err_t version_http_event_handler(esp_http_client_event_t *evt)
 {
     switch (evt->event_id) {
@@ -125,7 +129,7 @@ bool check_server_version(void)
     
     esp_http_client_config_t config = {
         .url = version_url,
-        .cert_pem = (char *)server_cert_pem_start,
+        .use_global_ca_store = true,
         .event_handler = version_http_event_handler,
         .skip_cert_common_name_check = true
     };
@@ -233,49 +237,186 @@ bool wifi_init_sta(void)
     return false;
 }
 
-static void ota_task(void *pvParameters)
+// The server's download budget is full: check again when it said to, plus up to a quarter
+// more so devices told the same second do not all come back together
+static uint32_t throttled(ota_session_t *session)
 {
-    xEventGroupWaitBits(s_event_start_ota, BIT_BTN_PRESSED, pdTRUE, pdTRUE, portMAX_DELAY);
+    uint32_t wait_ms = session->retry_after_ms + esp_random() % (session->retry_after_ms / 4 + 1);
+    ota_session_report(session, "deferred update");
+    ESP_LOGI(TAG, "Update deferred by the server, next check in %u s", (unsigned)(wait_ms / 1000));
+    return wait_ms;
+}
 
-    ESP_LOGI(TAG, "Starting OTA example task");
-    ESP_LOGI(TAG, "Current firmware version: %s", VERSION_SHORT);
-    
+#if CONFIG_OTA_PEER && CONFIG_OTA_USE_MANIFEST
+// The new version from a device on the LAN that already runs it, checked against the manifest
+// digests. Returns ESP_ERR_NOT_FOUND when no peer could send it.
+static esp_err_t peer_update(const ota_manifest_t *manifest)
+{
+    static ota_peer_t peers[OTA_PEER_MAX];
+    static ota_session_t peer;
+    char url[32];
+
+    int count = ota_peer_find(manifest->version, peers, OTA_PEER_MAX);
+    while (count > 0) {
+        int i = ota_peer_pick(peers, count, manifest->version, esp_random());
+        if (i < 0) {
+            break;
+        }
+        snprintf(url, sizeof(url), "http://%s:%u", peers[i].host, peers[i].port);
+        ESP_LOGI(TAG, "Downloading %s from peer %s", manifest->version, url);
+        esp_err_t ret = ota_session_open(&peer, url);
+        if (ret == ESP_OK) {
+            ret = compressed_ota_run(&peer, "/firmware.bin", manifest);
+            ota_session_report(&peer, ret == ESP_OK ? "peer update" : "failed peer update");
+        }
+        ota_session_close(&peer);
+        if (ret == ESP_OK) {
+            return ESP_OK;
+        }
+        count = ota_peer_remove(peers, count, i);
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+#endif
+
+// One update check and, if there is a newer version, the download. Only returns if there is no
+// update, the server deferred it or it failed, with the time until the next check; a successful
+// update reboots into the new image.
+static uint32_t ota_update(ota_session_t *session, bool interrupted)
+{
+    char patch_path[64];
+    snprintf(patch_path, sizeof(patch_path), "/firmware.patch?from=%s", VERSION_SHORT);
+    const char *delta_path = patch_path;
+    const char *image_path = "/firmware.bin";
+    const ota_manifest_t *digests = NULL;
+    esp_err_t ret;
+
+    ESP_LOGI(TAG, "Current firmware version: %s, built %s %s", VERSION_SHORT,
+             APP_DESCRIPTION()->date, APP_DESCRIPTION()->time);
+    ota_session_start_check(session);
+#if CONFIG_OTA_USE_MANIFEST
+    static ota_manifest_t manifest;
+    int64_t asked_us = esp_timer_get_time();
+    ret = ota_manifest_fetch(session, &manifest, CONFIG_OTA_PUSH_WAIT_S);
+    if (ret != ESP_OK) {
+        ota_session_report(session, "check");
+        if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGI(TAG, "No update needed - already at latest version");
+            // The server held the check as long as it could: wait on it again right away. One
+            // that answers at once does not hold requests and is polled instead.
+            bool held = esp_timer_get_time() - asked_us >= CONFIG_OTA_PUSH_WAIT_S * 1000000LL / 2;
+            return CONFIG_OTA_PUSH_WAIT_S && held ? 0 : CONFIG_OTA_CHECK_PERIOD_MS;
+        }
+        ESP_LOGE(TAG, "Update check failed: %s", esp_err_to_name(ret));
+        return CONFIG_OTA_CHECK_PERIOD_MS;
+    }
+    // The manifest only lists a patch when the server has one for our version
+    delta_path = manifest.delta.size ? manifest.delta.url : NULL;
+    if (manifest.image.size) {
+        image_path = manifest.image.url;
+    }
+    digests = &manifest;
+#else
     // First check if there's a newer version available
     if (!check_server_version()) {
         ESP_LOGI(TAG, "No update needed - already at latest version");
-        return;
+        return CONFIG_OTA_CHECK_PERIOD_MS;
     }
+#endif
     
     ESP_LOGI(TAG, "Update available, downloading new firmware...");
-    
-    // Continue with the existing OTA process
-    esp_http_client_config_t config = {
-        .url = CONFIG_EXAMPLE_FIRMWARE_UPGRADE_URL,
-        .cert_pem = (char *)server_cert_pem_start,
-        .cert_len = 1422,
-        .event_handler = _http_event_handler,
-        .keep_alive_enable = true,
-        .use_global_ca_store = true,
-        .skip_cert_common_name_check = true
-    };
 
-    esp_https_ota_config_t ota_config = {
-        .http_config = &config,
-    };
-    
-    ESP_ERROR_CHECK(esp_tls_init_global_ca_store());
-    ESP_ERROR_CHECK(esp_tls_set_global_ca_store((unsigned char*)server_cert_pem_start, server_cert_pem_end - server_cert_pem_start));
-
-    ESP_LOGI(TAG, "Attempting to download update from %s", config.url);
-    esp_err_t ret = esp_https_ota(&ota_config);
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "OTA Succeed, Rebooting...");
-        esp_restart();
-    } else {
-        ESP_LOGE(TAG, "Firmware upgrade failed");
+#if CONFIG_OTA_MULTICAST && CONFIG_OTA_USE_MANIFEST
+    // Whatever arrives is checked against the chunk digests, as from a peer
+    if (!interrupted && manifest.chunk_count) {
+        ret = ota_mcast_receive(&manifest);
+        if (ret == ESP_OK) {
+            ESP_LOGI(TAG, "Multicast OTA Succeed, Rebooting...");
+            esp_restart();
+        }
+        ESP_LOGI(TAG, "Multicast update not possible (%s), downloading instead", esp_err_to_name(ret));
+    }
+#endif
+
+#if CONFIG_OTA_PEER && CONFIG_OTA_USE_MANIFEST
+    // Peers are not trusted, so only with the chunk digests to check what they send
+    if (!interrupted && manifest.chunk_count) {
+        if (peer_update(&manifest) == ESP_OK) {
+            ESP_LOGI(TAG, "Peer OTA Succeed, Rebooting...");
+            esp_restart();
+        }
+    }
+#endif
+
+    // A patch against the running image is a fraction of the full download. It rewrites the
+    // whole OTA partition, so it is not tried while a full download is half done there.
+    if (!interrupted && delta_path) {
+        ret = delta_ota_run(session, delta_path, digests);
+        if (ret == ESP_OK) {
+            ota_session_report(session, "delta update");
+            ESP_LOGI(TAG, "Delta OTA Succeed, Rebooting...");
+            esp_restart();
+        }
+        if (ret == ESP_ERR_NOT_FINISHED) {
+            return throttled(session);
+        }
+        ESP_LOGI(TAG, "Delta update not possible (%s), downloading full firmware", esp_err_to_name(ret));
+    }
+
+    // Full image, compressed on the wire when the server has a compressed copy. Interrupted
+    // attempts continue from the last checkpoint instead of byte zero.
+    for (int attempt = 1; attempt <= CONFIG_OTA_MAX_ATTEMPTS; attempt++) {
+        ret = compressed_ota_run(session, image_path, digests);
+        if (ret == ESP_OK) {
+            ota_session_report(session, "update");
+            ESP_LOGI(TAG, "OTA Succeed, Rebooting...");
+            esp_restart();
+        }
+        if (ret == ESP_ERR_NOT_FINISHED) {
+            return throttled(session);
+        }
+        if (ret == ESP_ERR_INVALID_RESPONSE || ret == ESP_ERR_OTA_VALIDATE_FAILED) {
+            break;
+        }
+        ESP_LOGW(TAG, "Attempt %d/%d failed (%s), resuming in %d ms", attempt, CONFIG_OTA_MAX_ATTEMPTS,
+                 esp_err_to_name(ret), CONFIG_OTA_RETRY_DELAY_MS);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_OTA_RETRY_DELAY_MS));
+    }
+    ota_session_report(session, "failed update");
+    ESP_LOGE(TAG, "Firmware upgrade failed");
+    return CONFIG_OTA_CHECK_PERIOD_MS;
+}
+
+static void ota_task(void *pvParameters)
+{
+    // The CA is parsed once here; every later connection, including the legacy version check,
+    // verifies against the parsed chain
+    ESP_ERROR_CHECK(ota_session_init_ca((const char *)server_cert_pem_start,
+                                        server_cert_pem_end - server_cert_pem_start));
+    // Kept across checks so a reconnect can resume the previous TLS session
+    static ota_session_t session;
+    ESP_ERROR_CHECK(ota_session_open(&session, CONFIG_OTA_SERVER_URL));
+#if CONFIG_OTA_PEER
+    ota_peer_start();
+#endif
+
+    // An update interrupted by a reset carries on by itself, anything else waits for the button,
+    // the next periodic check or the server
+    ota_resume_t progress;
+    bool interrupted = ota_resume_load(&progress) == ESP_OK;
+    if (interrupted) {
+        ESP_LOGI(TAG, "Resuming interrupted firmware download");
     }
+
+    uint32_t wait_ms = CONFIG_OTA_PUSH_WAIT_S ? 0 : CONFIG_OTA_CHECK_PERIOD_MS;
     while (1) {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        if (!interrupted) {
+            xEventGroupWaitBits(s_event_start_ota, BIT_BTN_PRESSED, pdTRUE, pdTRUE,
+                                pdMS_TO_TICKS(wait_ms));
+        }
+        ESP_LOGI(TAG, "Starting OTA example task");
+        wait_ms = ota_update(&session, interrupted);
+        interrupted = false;
     }
 }
 
@@ -345,7 +486,7 @@ void app_main(void)
 
     if (connected) {
         s_event_start_ota = xEventGroupCreate();
-        xTaskCreate(ota_task, "ota_task", 8192, NULL, 5, NULL);
+        xTaskCreate(ota_task, "ota_task", CONFIG_OTA_TASK_STACK, NULL, 5, NULL);
         xTaskCreate(button_task, "button_task", 4096, NULL, 5, NULL);
     }
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+"""Broadcast a release to every device in the room at once over UDP multicast.
+
+Companion to server.py for large fleets on one LAN: the image goes over the air once per
+round, whatever the number of devices, instead of once per device. It is cut into blocks of
+BLOCK_SYMBOLS symbols of SYMBOL_LEN bytes; every round sends each block's symbols followed
+by --overhead more repair symbols, each the XOR of a pseudo-random subset of the block's
+symbols (a random linear fountain code). Later rounds send only repair symbols the devices
+have not seen. A device rebuilds a block from any BLOCK_SYMBOLS independent symbols it
+caught, so a lost packet costs nothing as long as enough others arrive, and a device that
+missed a block in one round picks it up in the next. A device that still misses blocks when
+the sender stops downloads the image from server.py as usual.
+
+The packet format and the symbol selection are those of ota_mcast.h. Devices find the
+stream by the image digest the manifest gives them, so start the sender with the release
+the channel offers, for as long as its devices take to ask:
+    python mcast_sender.py v0.1.5 [--rounds 3] [--rate 2000] [--interface 192.168.1.10]
+A file path works in place of the version. --interface 127.0.0.1 sends over loopback,
+for host/mcast_sim.c.
+"""
+import argparse
+import hashlib
+import math
+import os
+import socket
+import struct
+import time
+
+import release
+
+# ota_mcast.h
+GROUP = '239.255.70.1'
+PORT = 8071
+SYMBOL_LEN = 1024
+BLOCK_SYMBOLS = 16
+BLOCK_LEN = SYMBOL_LEN * BLOCK_SYMBOLS
+HEADER = struct.Struct('>4s8sIHH')
+
+
+def coefficients(block, symbol_id, symbols):
+    """Symbols of `block` that symbol `symbol_id` combines (ota_mcast_coefficients())"""
+    if symbol_id < symbols:
+        return 1 << symbol_id
+    mask = (1 << symbols) - 1
+    x = ((((block << 16) | symbol_id) * 2654435761) & 0xffffffff) | 1
+    while True:
+        x ^= (x << 13) & 0xffffffff
+        x ^= x >> 17
+        x ^= (x << 5) & 0xffffffff
+        if x & mask:
+            return x & mask
+
+
+def symbol_ids(symbols, repair, round_no):
+    """Symbols of a block sent in a round: its own and `repair` more in the first, then
+    repair symbols not sent before"""
+    per_round = symbols + repair
+    if round_no == 0:
+        return range(per_round)
+    first = per_round * round_no
+    return range(first, min(first + per_round, 0x10000))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('release', help='version in releases/, or an image file')
+    parser.add_argument('--group', default=GROUP)
+    parser.add_argument('--port', type=int, default=PORT)
+    parser.add_argument('--interface', default='0.0.0.0', help='address to send from')
+    parser.add_argument('--rate', type=float, default=2000,
+                        help='kbit/s; Wi-Fi sends multicast at a low basic rate')
+    parser.add_argument('--rounds', type=int, default=3)
+    parser.add_argument('--overhead', type=float, default=0.25,
+                        help='repair symbols per block and round, as a share of its symbols')
+    parser.add_argument('--ttl', type=int, default=1)
+    args = parser.parse_args()
+
+    path = args.release if os.path.exists(args.release) else release.release_path(args.release)
+    with open(path, 'rb') as f:
+        image = f.read()
+    session = hashlib.sha256(image).digest()[:8]
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, args.ttl)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(args.interface))
+
+    # Symbols as integers, so a repair symbol is a few big XORs
+    blocks = []
+    for start in range(0, len(image), BLOCK_LEN):
+        data = image[start:start + BLOCK_LEN]
+        data += bytes(-len(data) % SYMBOL_LEN)
+        blocks.append([int.from_bytes(data[i:i + SYMBOL_LEN], 'little')
+                       for i in range(0, len(data), SYMBOL_LEN)])
+
+    interval = (HEADER.size + SYMBOL_LEN) * 8 / (args.rate * 1000)
+    print("Sending %s (%d bytes, %d blocks) to %s:%d, %d rounds at %.0f kbit/s" % (
+        path, len(image), len(blocks), args.group, args.port, args.rounds, args.rate))
+    sent = 0
+    started = due = time.perf_counter()
+    for round_no in range(args.rounds):
+        for block_no, symbols in enumerate(blocks):
+            repair = math.ceil(len(symbols) * args.overhead)
+            for symbol_id in symbol_ids(len(symbols), repair, round_no):
+                mask = coefficients(block_no, symbol_id, len(symbols))
+                value = 0
+                for i, symbol in enumerate(symbols):
+                    if mask >> i & 1:
+                        value ^= symbol
+                packet = HEADER.pack(b'OTAM', session, len(image), block_no, symbol_id) + \
+                    value.to_bytes(SYMBOL_LEN, 'little')
+                due += interval
+                delay = due - time.perf_counter()
+                if delay > 0:
+                    time.sleep(delay)
+                sock.sendto(packet, (args.group, args.port))
+                sent += 1
+        print("round %d done" % (round_no + 1))
+    elapsed = time.perf_counter() - started
+    print("%d packets, %.1f MB in %.1f s (%.2f times the image)" % (
+        sent, sent * (HEADER.size + SYMBOL_LEN) / 1e6, elapsed,
+        sent * (HEADER.size + SYMBOL_LEN) / len(image)))
+
+
+if __name__ == '__main__':
+    main()
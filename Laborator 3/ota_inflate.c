@@ -0,0 +1,258 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_inflate.h"
+
+// Result of feeding one zlib stream
+typedef enum {
+    STREAM_MORE,
+    STREAM_END,
+    STREAM_ERROR,
+} stream_status_t;
+
+#ifdef ESP_PLATFORM
+// tinfl from the ROM: no inflate code in flash, and it can decode into a small circular window
+#include "rom/miniz.h"
+
+struct ota_inflate {
+    tinfl_decompressor inflator;
+    uint8_t window[OTA_INFLATE_WINDOW];
+    size_t window_pos;
+    uint8_t header[4];
+    size_t header_len;
+    size_t segment_left;
+    size_t total_out;
+    ota_inflate_write_t write;
+    void *ctx;
+};
+
+static bool stream_init(ota_inflate_t *z)
+{
+    return true;
+}
+
+static void stream_reset(ota_inflate_t *z)
+{
+    tinfl_init(&z->inflator);
+    z->window_pos = 0;
+}
+
+static stream_status_t stream_feed(ota_inflate_t *z, const uint8_t *in, size_t len, size_t *used)
+{
+    *used = 0;
+    while (1) {
+        size_t in_bytes = len;
+        size_t out_bytes = OTA_INFLATE_WINDOW - z->window_pos;
+        // The zlib header check also rejects streams whose window is larger than ours
+        tinfl_status status = tinfl_decompress(&z->inflator, in, &in_bytes, z->window,
+                                               z->window + z->window_pos, &out_bytes,
+                                               TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT |
+                                               TINFL_FLAG_COMPUTE_ADLER32);
+        in += in_bytes;
+        len -= in_bytes;
+        *used += in_bytes;
+
+        if (out_bytes) {
+            if (z->write(z->window + z->window_pos, out_bytes, z->ctx) != 0) {
+                return STREAM_ERROR;
+            }
+            z->total_out += out_bytes;
+            z->window_pos = (z->window_pos + out_bytes) & (OTA_INFLATE_WINDOW - 1);
+        }
+
+        if (status == TINFL_STATUS_DONE) {
+            return STREAM_END;
+        }
+        if (status < 0) {
+            return STREAM_ERROR;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+            return STREAM_MORE;
+        }
+        // TINFL_STATUS_HAS_MORE_OUTPUT: the window wrapped, go round again
+    }
+}
+
+static void stream_end(ota_inflate_t *z)
+{
+}
+
+#else
+// Host build links zlib with the same window size; tinfl is only available from the ESP32 ROM
+#include <zlib.h>
+
+struct ota_inflate {
+    z_stream strm;
+    uint8_t out[OTA_INFLATE_WINDOW];
+    uint8_t header[4];
+    size_t header_len;
+    size_t segment_left;
+    size_t total_out;
+    ota_inflate_write_t write;
+    void *ctx;
+};
+
+static size_t s_heap;
+static size_t s_peak_heap;
+
+static void heap_add(size_t size)
+{
+    s_heap += size;
+    if (s_heap > s_peak_heap) {
+        s_peak_heap = s_heap;
+    }
+}
+
+// Each allocation carries its size in front so the frees can be counted as well
+static void *counting_alloc(void *opaque, unsigned items, unsigned size)
+{
+    size_t bytes = (size_t)items * size;
+    size_t *p = malloc(sizeof(size_t) + bytes);
+    if (p == NULL) {
+        return NULL;
+    }
+    *p = bytes;
+    heap_add(bytes);
+    return p + 1;
+}
+
+static void counting_free(void *opaque, void *ptr)
+{
+    size_t *p = (size_t *)ptr - 1;
+    s_heap -= *p;
+    free(p);
+}
+
+static bool stream_init(ota_inflate_t *z)
+{
+    heap_add(sizeof(*z));
+    z->strm.zalloc = counting_alloc;
+    z->strm.zfree = counting_free;
+    // Positive window bits: zlib header and Adler-32, and larger windows are rejected
+    return inflateInit2(&z->strm, OTA_INFLATE_WINDOW_BITS) == Z_OK;
+}
+
+static void stream_reset(ota_inflate_t *z)
+{
+    inflateReset(&z->strm);
+}
+
+static stream_status_t stream_feed(ota_inflate_t *z, const uint8_t *in, size_t len, size_t *used)
+{
+    z->strm.next_in = (Bytef *)in;
+    z->strm.avail_in = len;
+
+    while (1) {
+        z->strm.next_out = z->out;
+        z->strm.avail_out = sizeof(z->out);
+        int ret = inflate(&z->strm, Z_NO_FLUSH);
+        size_t out_bytes = sizeof(z->out) - z->strm.avail_out;
+        *used = len - z->strm.avail_in;
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return STREAM_ERROR;
+        }
+        if (out_bytes) {
+            if (z->write(z->out, out_bytes, z->ctx) != 0) {
+                return STREAM_ERROR;
+            }
+            z->total_out += out_bytes;
+        }
+        if (ret == Z_STREAM_END) {
+            return STREAM_END;
+        }
+        if (z->strm.avail_in == 0 && z->strm.avail_out != 0) {
+            return STREAM_MORE;
+        }
+    }
+}
+
+static void stream_end(ota_inflate_t *z)
+{
+    inflateEnd(&z->strm);
+    s_heap -= sizeof(*z);
+}
+
+size_t ota_inflate_peak_heap(void)
+{
+    return s_peak_heap;
+}
+#endif
+
+ota_inflate_t *ota_inflate_new(ota_inflate_write_t write, void *ctx)
+{
+    ota_inflate_t *z = calloc(1, sizeof(*z));
+    if (z == NULL) {
+        return NULL;
+    }
+    if (!stream_init(z)) {
+        ota_inflate_free(z);
+        return NULL;
+    }
+    stream_reset(z);
+    z->write = write;
+    z->ctx = ctx;
+    return z;
+}
+
+ota_inflate_status_t ota_inflate_feed(ota_inflate_t *z, const uint8_t *in, size_t len, size_t *consumed)
+{
+    *consumed = 0;
+    while (len) {
+        // Segment length prefix, possibly split across chunks
+        if (z->header_len < sizeof(z->header)) {
+            z->header[z->header_len++] = *in++;
+            len--;
+            (*consumed)++;
+            if (z->header_len == sizeof(z->header)) {
+                z->segment_left = ((size_t)z->header[0] << 24) | (z->header[1] << 16) |
+                                  (z->header[2] << 8) | z->header[3];
+                if (z->segment_left == 0) {
+                    return OTA_INFLATE_ERROR;
+                }
+            }
+            continue;
+        }
+
+        // Never hand the decompressor bytes of the next segment
+        size_t used;
+        size_t n = len < z->segment_left ? len : z->segment_left;
+        stream_status_t status = stream_feed(z, in, n, &used);
+        in += used;
+        len -= used;
+        *consumed += used;
+        z->segment_left -= used;
+
+        if (status == STREAM_ERROR) {
+            return OTA_INFLATE_ERROR;
+        }
+        if (status == STREAM_END) {
+            if (z->segment_left != 0) {
+                return OTA_INFLATE_ERROR;
+            }
+            z->header_len = 0;
+            stream_reset(z);
+            return OTA_INFLATE_SEGMENT;
+        }
+        if (z->segment_left == 0) {
+            // Length prefix and zlib stream disagree
+            return OTA_INFLATE_ERROR;
+        }
+    }
+    return OTA_INFLATE_MORE;
+}
+
+size_t ota_inflate_total_out(const ota_inflate_t *z)
+{
+    return z->total_out;
+}
+
+void ota_inflate_free(ota_inflate_t *z)
+{
+    if (z == NULL) {
+        return;
+    }
+    stream_end(z);
+    free(z);
+}
@@ -0,0 +1,46 @@
+#ifndef OTA_INFLATE_H
+#define OTA_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed images ("Content-Encoding: x-zseg") are a sequence of segments, each a 4 byte
+// big-endian length followed by an independent zlib stream of OTA_INFLATE_SEGMENT_LEN image
+// bytes (less for the last one). Segment ends are points a download can resume from.
+#define OTA_INFLATE_ENCODING    "x-zseg"
+#define OTA_INFLATE_SEGMENT_LEN (64 * 1024)
+
+// zlib stream window; release.py compresses with the same window (wbits 12), so the device only
+// keeps this much decompressed history. Must be a power of two.
+#define OTA_INFLATE_WINDOW_BITS 12
+#define OTA_INFLATE_WINDOW      (1 << OTA_INFLATE_WINDOW_BITS)
+
+typedef enum {
+    OTA_INFLATE_MORE = 0,    // input consumed, feed the next chunk
+    OTA_INFLATE_SEGMENT = 1, // a segment ended and its checksum matched
+    OTA_INFLATE_ERROR = -1,  // corrupt stream or the write callback failed
+} ota_inflate_status_t;
+
+// Receives the decompressed image in pieces of at most OTA_INFLATE_WINDOW bytes; non-zero aborts
+typedef int (*ota_inflate_write_t)(const uint8_t *buf, size_t len, void *ctx);
+
+typedef struct ota_inflate ota_inflate_t;
+
+ota_inflate_t *ota_inflate_new(ota_inflate_write_t write, void *ctx);
+
+// Decompress a received chunk, passing all output to the write callback. Stops after the end of
+// a segment so the caller can checkpoint; `*consumed` tells how much of `in` was used, feed the
+// rest again. The image is complete when the download ends right after OTA_INFLATE_SEGMENT.
+ota_inflate_status_t ota_inflate_feed(ota_inflate_t *z, const uint8_t *in, size_t len, size_t *consumed);
+
+// Decompressed bytes written so far
+size_t ota_inflate_total_out(const ota_inflate_t *z);
+
+void ota_inflate_free(ota_inflate_t *z);
+
+#ifndef ESP_PLATFORM
+// Host build: the most heap the decompressor held at once, for host/inflate_bench.c
+size_t ota_inflate_peak_heap(void);
+#endif
+
+#endif /* OTA_INFLATE_H */
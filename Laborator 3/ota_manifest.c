@@ -0,0 +1,162 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "ota_manifest.h"
+#include "version.h"
+
+static const char *TAG = "ota_manifest";
+
+// "v0.1.12" -> 12; string comparison would put v0.1.10 before v0.1.9
+static int build_number(const char *version)
+{
+    const char *dot = strrchr(version, '.');
+    return dot ? atoi(dot + 1) : -1;
+}
+
+static bool parse_digest(const char *hex, uint8_t digest[OTA_VERIFY_DIGEST_LEN])
+{
+    if (strlen(hex) != 2 * OTA_VERIFY_DIGEST_LEN) {
+        return false;
+    }
+    for (int i = 0; i < OTA_VERIFY_DIGEST_LEN; i++) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return false;
+        }
+        digest[i] = byte;
+    }
+    return true;
+}
+
+// "chunks" of the image object; without them (or with a chunk length the device does not
+// use) the download is only checked by esp_ota_end()
+static void parse_chunks(const cJSON *root, ota_manifest_t *m)
+{
+    const cJSON *image = cJSON_GetObjectItemCaseSensitive(root, "image");
+    const cJSON *chunk_len = cJSON_GetObjectItemCaseSensitive(image, "chunk_len");
+    const cJSON *chunks = cJSON_GetObjectItemCaseSensitive(image, "chunks");
+    const cJSON *chunk;
+
+    m->chunk_count = 0;
+    if (!cJSON_IsNumber(chunk_len) || chunk_len->valueint != OTA_VERIFY_CHUNK_LEN ||
+        !cJSON_IsArray(chunks) || cJSON_GetArraySize(chunks) > OTA_VERIFY_MAX_CHUNKS) {
+        return;
+    }
+    cJSON_ArrayForEach(chunk, chunks) {
+        if (!cJSON_IsString(chunk) || !parse_digest(chunk->valuestring, m->chunks[m->chunk_count])) {
+            m->chunk_count = 0;
+            return;
+        }
+        m->chunk_count++;
+    }
+}
+
+static void parse_artifact(const cJSON *root, const char *name, ota_artifact_t *a)
+{
+    const cJSON *obj = cJSON_GetObjectItemCaseSensitive(root, name);
+    const cJSON *url = cJSON_GetObjectItemCaseSensitive(obj, "url");
+    const cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(obj, "sha256");
+    const cJSON *size = cJSON_GetObjectItemCaseSensitive(obj, "size");
+
+    memset(a, 0, sizeof(*a));
+    if (cJSON_IsString(url) && cJSON_IsNumber(size)) {
+        strlcpy(a->url, url->valuestring, sizeof(a->url));
+        a->size = size->valueint;
+        if (cJSON_IsString(sha256)) {
+            strlcpy(a->sha256, sha256->valuestring, sizeof(a->sha256));
+        }
+    }
+}
+
+// Manifest round trip without the (re)connect it may have needed
+static void record_check(ota_session_t *s, int64_t start_us, int64_t connect_us, size_t bytes)
+{
+    int64_t us = ota_stats_now() - start_us - (s->stats.us[OTA_PHASE_CONNECT] - connect_us);
+    ota_stats_add(&s->stats, OTA_PHASE_CHECK, us, bytes);
+}
+
+esp_err_t ota_manifest_fetch(ota_session_t *s, ota_manifest_t *m, int wait_s)
+{
+    char path[96];
+    char etag[40];
+    int status;
+    int64_t content_len;
+    int64_t start_us = ota_stats_now();
+    int64_t connect_us = s->stats.us[OTA_PHASE_CONNECT];
+
+    // The manifest ETag is the latest version, so a device on it gets an empty 304
+    snprintf(path, sizeof(path), OTA_MANIFEST_PATH "?from=%s&wait=%d", VERSION_SHORT, wait_s);
+    snprintf(etag, sizeof(etag), "\"%s\"", VERSION_SHORT);
+    ota_session_request(s, path);
+    esp_http_client_set_header(s->client, "If-None-Match", etag);
+    if (wait_s > 0) {
+        esp_http_client_set_timeout_ms(s->client, OTA_SESSION_TIMEOUT_MS + wait_s * 1000);
+    }
+    esp_err_t err = ota_session_send(s, &status, &content_len);
+    if (wait_s > 0) {
+        esp_http_client_set_timeout_ms(s->client, OTA_SESSION_TIMEOUT_MS);
+        // The wait is not part of the update: it starts when the server answers
+        ota_stats_reset(&s->stats);
+        ota_memory_begin(&s->memory);
+        s->check_start_us = s->stats.start_us;
+        start_us = s->stats.start_us;
+        connect_us = 0;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (status == 304) {
+        ESP_LOGI(TAG, "Manifest not modified: %s is the latest version", VERSION_SHORT);
+        ota_session_finish(s);
+        record_check(s, start_us, connect_us, 0);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (status != 200 || content_len <= 0 || content_len >= OTA_MANIFEST_MAX_LEN) {
+        ESP_LOGE(TAG, "Unexpected manifest response: HTTP %d, %lld bytes", status, content_len);
+        ota_session_finish(s);
+        return ESP_FAIL;
+    }
+
+    char *body = malloc(content_len + 1);
+    if (body == NULL) {
+        ota_session_finish(s);
+        return ESP_ERR_NO_MEM;
+    }
+    int len = 0;
+    while (len < content_len) {
+        int n = esp_http_client_read(s->client, body + len, content_len - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    body[len] = '\0';
+    record_check(s, start_us, connect_us, len);
+
+    cJSON *root = len == content_len ? cJSON_Parse(body) : NULL;
+    free(body);
+    const cJSON *version = cJSON_GetObjectItemCaseSensitive(root, "version");
+    if (!cJSON_IsString(version)) {
+        ESP_LOGE(TAG, "Malformed manifest");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    strlcpy(m->version, version->valuestring, sizeof(m->version));
+    parse_artifact(root, "image", &m->image);
+    parse_artifact(root, "compressed", &m->compressed);
+    parse_artifact(root, "delta", &m->delta);
+    parse_chunks(root, m);
+    cJSON_Delete(root);
+
+    ESP_LOGI(TAG, "Server version: %s, Current version: %s (image %d, compressed %d, delta %d bytes, "
+             "%d chunk digests)", m->version, VERSION_SHORT, (int)m->image.size, (int)m->compressed.size,
+             (int)m->delta.size, m->chunk_count);
+    if (build_number(m->version) <= build_number(VERSION_SHORT)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,38 @@
+#ifndef OTA_MANIFEST_H
+#define OTA_MANIFEST_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "ota_session.h"
+#include "ota_verify.h"
+
+#define OTA_MANIFEST_PATH    "/manifest"
+// Room for the chunk digests of an OTA_VERIFY_MAX_CHUNKS image
+#define OTA_MANIFEST_MAX_LEN 4096
+
+// One downloadable form of the new firmware; size is 0 when the server does not offer it
+typedef struct {
+    char url[96];     // path on the update server
+    char sha256[65];  // hex digest of the body as served
+    int32_t size;
+} ota_artifact_t;
+
+typedef struct {
+    char version[32];
+    ota_artifact_t image;      // raw firmware.bin
+    ota_artifact_t compressed; // x-zseg encoding of the same image
+    ota_artifact_t delta;      // patch from the running version
+    // SHA-256 of each OTA_VERIFY_CHUNK_LEN bytes of the image, whichever way it is downloaded;
+    // chunk_count is 0 when the server sent none (or for another chunk length)
+    uint8_t chunks[OTA_VERIFY_MAX_CHUNKS][OTA_VERIFY_DIGEST_LEN];
+    int chunk_count;
+} ota_manifest_t;
+
+// Fetch the manifest on the session's connection with If-None-Match set to the running
+// version. Returns ESP_OK with *m filled when a newer version exists, ESP_ERR_NOT_FOUND when
+// the server answers 304 or only offers the running version or an older one.
+// With wait_s > 0 the server holds the request until it has a newer release for the device
+// or wait_s seconds pass (a long poll); the phase stats then start when it answers.
+esp_err_t ota_manifest_fetch(ota_session_t *s, ota_manifest_t *m, int wait_s);
+
+#endif /* OTA_MANIFEST_H */
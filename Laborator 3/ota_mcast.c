@@ -0,0 +1,399 @@
+#include <string.h>
+
+#include "ota_mcast.h"
+
+#define BLOCKS_PER_CHUNK (OTA_VERIFY_CHUNK_LEN / OTA_MCAST_BLOCK_LEN)
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static int block_symbols(const ota_mcast_rx_t *rx, int block)
+{
+    size_t left = rx->image_len - (size_t)block * OTA_MCAST_BLOCK_LEN;
+    return left < OTA_MCAST_BLOCK_LEN ? (left + OTA_MCAST_SYMBOL_LEN - 1) / OTA_MCAST_SYMBOL_LEN
+                                      : OTA_MCAST_BLOCK_SYMBOLS;
+}
+
+static bool block_done(const ota_mcast_rx_t *rx, int block)
+{
+    return rx->have[block] == (1u << block_symbols(rx, block)) - 1;
+}
+
+// Where symbol `i` of the block being decoded goes, and how much of it is image
+static size_t symbol_offset(const ota_mcast_rx_t *rx, int i, size_t *len)
+{
+    size_t offset = (size_t)rx->block * OTA_MCAST_BLOCK_LEN + (size_t)i * OTA_MCAST_SYMBOL_LEN;
+    *len = rx->image_len - offset < OTA_MCAST_SYMBOL_LEN ? rx->image_len - offset : OTA_MCAST_SYMBOL_LEN;
+    return offset;
+}
+
+static int write_symbol(ota_mcast_rx_t *rx, int i)
+{
+    size_t len;
+    size_t offset = symbol_offset(rx, i, &len);
+    if (rx->write(offset, (const uint8_t *)rx->rows[i], len, rx->ctx) != 0) {
+        return -1;
+    }
+    rx->have[rx->block] |= 1u << i;
+    return 0;
+}
+
+static void xor_row(uint32_t *dst, const uint32_t *src)
+{
+    for (int i = 0; i < OTA_MCAST_SYMBOL_LEN / 4; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+// Take up `block`, starting from the symbols of it already in the partition
+static int start_block(ota_mcast_rx_t *rx, int block)
+{
+    rx->block = block;
+    rx->symbols = block_symbols(rx, block);
+    rx->rank = 0;
+    memset(rx->masks, 0, sizeof(rx->masks));
+    for (int i = 0; i < rx->symbols; i++) {
+        if (!(rx->have[block] & (1u << i))) {
+            continue;
+        }
+        size_t len;
+        size_t offset = symbol_offset(rx, i, &len);
+        memset(rx->rows[i], 0, OTA_MCAST_SYMBOL_LEN);
+        if (rx->read(offset, (uint8_t *)rx->rows[i], len, rx->ctx) != 0) {
+            rx->block = -1;
+            return -1;
+        }
+        rx->masks[i] = 1u << i;
+        rx->rank++;
+    }
+    return 0;
+}
+
+uint32_t ota_mcast_coefficients(uint16_t block, uint16_t id, int symbols)
+{
+    if (id < symbols) {
+        return 1u << id;
+    }
+    // xorshift32 seeded from the block and symbol id, never all zero
+    uint32_t mask = symbols == 32 ? 0xffffffffu : (1u << symbols) - 1;
+    uint32_t x = (((uint32_t)block << 16) | id) * 2654435761u | 1;
+    do {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    } while ((x & mask) == 0);
+    return x & mask;
+}
+
+void ota_mcast_rx_init(ota_mcast_rx_t *rx, const uint8_t session[OTA_MCAST_SESSION_LEN],
+                       uint32_t image_len, ota_mcast_write_t write, ota_mcast_read_t read, void *ctx)
+{
+    memset(rx, 0, sizeof(*rx));
+    memcpy(rx->session, session, OTA_MCAST_SESSION_LEN);
+    rx->image_len = image_len;
+    rx->blocks = (image_len + OTA_MCAST_BLOCK_LEN - 1) / OTA_MCAST_BLOCK_LEN;
+    rx->write = write;
+    rx->read = read;
+    rx->ctx = ctx;
+    rx->block = -1;
+}
+
+bool ota_mcast_rx_matches(const ota_mcast_rx_t *rx, const uint8_t *packet, size_t len)
+{
+    return len == OTA_MCAST_PACKET_LEN && memcmp(packet, "OTAM", 4) == 0 &&
+           memcmp(packet + 4, rx->session, OTA_MCAST_SESSION_LEN) == 0 &&
+           get_be32(packet + 12) == rx->image_len;
+}
+
+int ota_mcast_rx_packet(ota_mcast_rx_t *rx, const uint8_t *packet, size_t len)
+{
+    if (!ota_mcast_rx_matches(rx, packet, len)) {
+        return -1;
+    }
+    rx->packets++;
+    int block = get_be16(packet + 16);
+    if (block >= rx->blocks || rx->blocks > OTA_MCAST_MAX_BLOCKS || block_done(rx, block)) {
+        return -1;
+    }
+    if (block != rx->block && start_block(rx, block) != 0) {
+        return -2;
+    }
+
+    // Eliminate the symbols already held, lowest first; what is left starts a new row
+    uint32_t mask = ota_mcast_coefficients(block, get_be16(packet + 18), rx->symbols);
+    memcpy(rx->scratch, packet + OTA_MCAST_HEADER_LEN, OTA_MCAST_SYMBOL_LEN);
+    for (int i = 0; i < rx->symbols && mask; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        if (rx->masks[i] == 0) {
+            rx->masks[i] = mask;
+            memcpy(rx->rows[i], rx->scratch, OTA_MCAST_SYMBOL_LEN);
+            rx->rank++;
+            rx->useful++;
+            // A plain symbol is kept in the partition in case the block is left unfinished
+            if (mask == 1u << i && write_symbol(rx, i) != 0) {
+                return -2;
+            }
+            break;
+        }
+        mask ^= rx->masks[i];
+        xor_row(rx->scratch, rx->rows[i]);
+    }
+    if (rx->rank < rx->symbols) {
+        return -1;
+    }
+
+    // Every row is filled: clear the higher symbols out of each, last row first
+    for (int i = rx->symbols - 1; i >= 0; i--) {
+        for (int j = i + 1; j < rx->symbols; j++) {
+            if (rx->masks[i] & (1u << j)) {
+                xor_row(rx->rows[i], rx->rows[j]);
+            }
+        }
+        rx->masks[i] = 1u << i;
+        if (!(rx->have[block] & (1u << i)) && write_symbol(rx, i) != 0) {
+            return -2;
+        }
+    }
+    rx->blocks_done++;
+    rx->block = -1;
+    return block;
+}
+
+bool ota_mcast_chunk_received(const ota_mcast_rx_t *rx, int chunk)
+{
+    for (int b = chunk * BLOCKS_PER_CHUNK; b < (chunk + 1) * BLOCKS_PER_CHUNK && b < rx->blocks; b++) {
+        if (!block_done(rx, b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ota_mcast_rx_forget(ota_mcast_rx_t *rx, int chunk)
+{
+    for (int b = chunk * BLOCKS_PER_CHUNK; b < (chunk + 1) * BLOCKS_PER_CHUNK && b < rx->blocks; b++) {
+        if (block_done(rx, b)) {
+            rx->blocks_done--;
+        }
+        rx->have[b] = 0;
+        if (rx->block == b) {
+            rx->block = -1;
+        }
+    }
+}
+
+#ifdef ESP_PLATFORM
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "ota_mcast";
+
+typedef struct {
+    esp_ota_handle_t handle;
+    const esp_partition_t *partition;
+    esp_err_t err;  // why the last write or read failed
+} flash_t;
+
+static int flash_write(size_t offset, const uint8_t *buf, size_t len, void *ctx)
+{
+    flash_t *f = ctx;
+    f->err = esp_ota_write_with_offset(f->handle, buf, len, offset);
+    return f->err == ESP_OK ? 0 : -1;
+}
+
+static int flash_read(size_t offset, uint8_t *buf, size_t len, void *ctx)
+{
+    flash_t *f = ctx;
+    f->err = esp_partition_read(f->partition, offset, buf, len);
+    return f->err == ESP_OK ? 0 : -1;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static int open_group(void)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(OTA_MCAST_PORT),
+                                .sin_addr.s_addr = htonl(INADDR_ANY) };
+    struct ip_mreq mreq = { .imr_interface.s_addr = htonl(INADDR_ANY) };
+    inet_aton(OTA_MCAST_GROUP, &mreq.imr_multiaddr);
+    struct timeval timeout = { .tv_sec = OTA_MCAST_IDLE_MS / 1000,
+                               .tv_usec = OTA_MCAST_IDLE_MS % 1000 * 1000 };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Hash a received chunk back from flash. The decoder's scratch row is free between packets.
+static bool chunk_matches(ota_mcast_rx_t *rx, const ota_manifest_t *manifest,
+                          const esp_partition_t *update, int chunk)
+{
+    size_t start = (size_t)chunk * OTA_VERIFY_CHUNK_LEN;
+    size_t end = start + OTA_VERIFY_CHUNK_LEN < rx->image_len ? start + OTA_VERIFY_CHUNK_LEN : rx->image_len;
+    uint8_t *buf = (uint8_t *)rx->scratch;
+
+    ota_verify_t *v = ota_verify_new(manifest->chunks, chunk + 1, start);
+    if (v == NULL) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t pos = start; pos < end && ok; pos += OTA_MCAST_SYMBOL_LEN) {
+        size_t n = end - pos < OTA_MCAST_SYMBOL_LEN ? end - pos : OTA_MCAST_SYMBOL_LEN;
+        ok = esp_partition_read(update, pos, buf, n) == ESP_OK && ota_verify_update(v, buf, n) == 0;
+    }
+    ok = ok && ota_verify_finish(v) == 0;
+    ota_verify_free(v);
+    return ok;
+}
+
+esp_err_t ota_mcast_receive(const ota_manifest_t *manifest)
+{
+    uint8_t session[OTA_MCAST_SESSION_LEN];
+    static uint8_t packet[OTA_MCAST_PACKET_LEN];  // only ota_task receives, keep it off its stack
+    flash_t flash = { 0 };
+    wifi_ps_type_t ps = WIFI_PS_NONE;
+
+    uint32_t image_len = manifest->image.size;
+    if (manifest->chunk_count == 0 || image_len == 0 ||
+        (image_len + OTA_VERIFY_CHUNK_LEN - 1) / OTA_VERIFY_CHUNK_LEN != manifest->chunk_count) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (int i = 0; i < OTA_MCAST_SESSION_LEN; i++) {
+        int hi = hex_nibble(manifest->image.sha256[2 * i]);
+        int lo = hex_nibble(manifest->image.sha256[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        session[i] = hi << 4 | lo;
+    }
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    flash.partition = update;
+    if (update == NULL || image_len > update->size) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ota_mcast_rx_t *rx = malloc(sizeof(*rx));
+    int sock = open_group();
+    if (rx == NULL || sock < 0) {
+        ESP_LOGE(TAG, "Cannot join %s:%d", OTA_MCAST_GROUP, OTA_MCAST_PORT);
+        free(rx);
+        if (sock >= 0) {
+            close(sock);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+    ota_mcast_rx_init(rx, session, image_len, flash_write, flash_read, &flash);
+    // Power save delivers multicast only at DTIM beacons and drops much of a fast stream
+    esp_wifi_get_ps(&ps);
+    esp_wifi_set_ps(WIFI_PS_NONE);
+
+    ESP_LOGI(TAG, "Listening on %s:%d for %s (%u blocks)", OTA_MCAST_GROUP, OTA_MCAST_PORT,
+             manifest->version, (unsigned)rx->blocks);
+    // Nothing is erased until this image's sender is heard: without one, a check costs only
+    // the wait. The first packet is kept for the decoder.
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    int64_t heard_us = esp_timer_get_time();
+    int len = 0;
+    while (len <= 0 || !ota_mcast_rx_matches(rx, packet, len)) {
+        if (esp_timer_get_time() - heard_us >= OTA_MCAST_IDLE_MS * 1000LL) {
+            ESP_LOGI(TAG, "No sender heard");
+            goto cleanup;
+        }
+        len = recv(sock, packet, sizeof(packet), 0);
+    }
+
+    // Blocks land in any order, so the whole image is erased up front
+    err = esp_ota_begin(update, image_len, &flash.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        goto cleanup;
+    }
+    heard_us = esp_timer_get_time();
+    uint32_t packets = 0;
+    for (bool held = true; rx->blocks_done < rx->blocks; held = false) {
+        if (!held) {
+            len = recv(sock, packet, sizeof(packet), 0);
+        }
+        // Packets of another image keep coming, so silence is measured on ours only
+        if (rx->packets != packets) {
+            packets = rx->packets;
+            heard_us = esp_timer_get_time();
+        }
+        if (esp_timer_get_time() - heard_us >= OTA_MCAST_IDLE_MS * 1000LL) {
+            break;
+        }
+        int block = len > 0 ? ota_mcast_rx_packet(rx, packet, len) : -1;
+        if (block == -2) {
+            err = flash.err;
+            ESP_LOGE(TAG, "Flash access failed: %s", esp_err_to_name(err));
+            goto cleanup;
+        }
+        if (block < 0) {
+            continue;
+        }
+        int chunk = block * OTA_MCAST_BLOCK_LEN / OTA_VERIFY_CHUNK_LEN;
+        if (ota_mcast_chunk_received(rx, chunk) && !chunk_matches(rx, manifest, update, chunk)) {
+            // Flash is only written over once erased
+            ESP_LOGW(TAG, "Chunk %d does not match the manifest, receiving it again", chunk);
+            ota_mcast_rx_forget(rx, chunk);
+            size_t start = (size_t)chunk * OTA_VERIFY_CHUNK_LEN;
+            err = esp_partition_erase_range(update, start, update->size - start < OTA_VERIFY_CHUNK_LEN ?
+                                            update->size - start : OTA_VERIFY_CHUNK_LEN);
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+        }
+    }
+    ESP_LOGI(TAG, "%u of %u blocks from %u packets (%u useful)", (unsigned)rx->blocks_done,
+             (unsigned)rx->blocks, (unsigned)rx->packets, (unsigned)rx->useful);
+    if (rx->blocks_done < rx->blocks) {
+        err = rx->packets ? ESP_ERR_TIMEOUT : ESP_ERR_NOT_FOUND;
+        goto cleanup;
+    }
+    err = esp_ota_end(flash.handle);
+    flash.handle = 0;
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(update);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Received image invalid: %s", esp_err_to_name(err));
+    }
+
+cleanup:
+    if (flash.handle) {
+        esp_ota_abort(flash.handle);
+    }
+    esp_wifi_set_ps(ps);
+    close(sock);
+    free(rx);
+    return err;
+}
+#endif
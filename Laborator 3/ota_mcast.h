@@ -0,0 +1,102 @@
+#ifndef OTA_MCAST_H
+#define OTA_MCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ota_verify.h"
+
+// Firmware broadcast to every device in the room at once. mcast_sender.py sends the image
+// to a UDP multicast group, cut into blocks of OTA_MCAST_BLOCK_SYMBOLS symbols of
+// OTA_MCAST_SYMBOL_LEN bytes, again and again with new repair symbols on every round. A repair
+// symbol is the XOR of a pseudo-random subset of its block's symbols (a random linear
+// fountain code over GF(2)); any OTA_MCAST_BLOCK_SYMBOLS independent symbols of a block, about
+// two more than that on average, rebuild it, whichever were lost.
+//
+// A device decodes one block at a time in RAM. Plain symbols go to their place in the OTA
+// partition as they arrive, so what it caught of a block in one round is read back and
+// completed in the next instead of received again. Every OTA_VERIFY_CHUNK_LEN bytes are
+// checked against the manifest digests once all their blocks are in.
+//
+// The decoder runs in the host build as well (host/mcast_sim.c).
+//
+// Packet, big-endian:
+//   0  "OTAM"
+//   4  session: first 8 bytes of the image SHA-256, as in the manifest
+//   12 image length
+//   16 block
+//   18 symbol id: < the block's symbol count for the plain symbols, repair symbols after
+//   20 OTA_MCAST_SYMBOL_LEN bytes, the last symbol of the image zero padded
+
+#define OTA_MCAST_GROUP          "239.255.70.1"
+#define OTA_MCAST_PORT           8071
+#define OTA_MCAST_SYMBOL_LEN     1024
+#define OTA_MCAST_BLOCK_SYMBOLS  16
+#define OTA_MCAST_BLOCK_LEN      (OTA_MCAST_SYMBOL_LEN * OTA_MCAST_BLOCK_SYMBOLS)
+#define OTA_MCAST_HEADER_LEN     20
+#define OTA_MCAST_PACKET_LEN     (OTA_MCAST_HEADER_LEN + OTA_MCAST_SYMBOL_LEN)
+#define OTA_MCAST_SESSION_LEN    8
+#define OTA_MCAST_MAX_BLOCKS     (OTA_VERIFY_MAX_CHUNKS * OTA_VERIFY_CHUNK_LEN / OTA_MCAST_BLOCK_LEN)
+// Silence after which the sender is taken to have stopped
+#define OTA_MCAST_IDLE_MS        3000
+
+// Image bytes at `offset` to and from the partition; non-zero fails the packet
+typedef int (*ota_mcast_write_t)(size_t offset, const uint8_t *buf, size_t len, void *ctx);
+typedef int (*ota_mcast_read_t)(size_t offset, uint8_t *buf, size_t len, void *ctx);
+
+typedef struct {
+    uint8_t session[OTA_MCAST_SESSION_LEN];
+    uint32_t image_len;
+    int blocks;
+    int blocks_done;
+    uint16_t have[OTA_MCAST_MAX_BLOCKS];  // symbols of each block in the partition
+    ota_mcast_write_t write;
+    ota_mcast_read_t read;
+    void *ctx;
+    // Block being decoded: row i holds a combination whose lowest symbol is i (mask bit i),
+    // or nothing yet (mask 0). Once all rows are filled they are reduced to the symbols.
+    int block;
+    int symbols;
+    int rank;
+    uint32_t masks[OTA_MCAST_BLOCK_SYMBOLS];
+    uint32_t rows[OTA_MCAST_BLOCK_SYMBOLS][OTA_MCAST_SYMBOL_LEN / 4];
+    uint32_t scratch[OTA_MCAST_SYMBOL_LEN / 4];
+    uint32_t packets;  // of this image
+    uint32_t useful;   // packets that added a symbol
+} ota_mcast_rx_t;
+
+// Symbols of `block` that symbol `id` combines, bit i for symbol i. mcast_sender.py draws the
+// same ones.
+uint32_t ota_mcast_coefficients(uint16_t block, uint16_t id, int symbols);
+
+// Receive the image whose SHA-256 starts with `session` (the manifest's image digest) into a
+// partition accessed through `write` and `read`, which start out with nothing of it
+void ota_mcast_rx_init(ota_mcast_rx_t *rx, const uint8_t session[OTA_MCAST_SESSION_LEN],
+                       uint32_t image_len, ota_mcast_write_t write, ota_mcast_read_t read, void *ctx);
+
+// Whether `packet` belongs to the image being received
+bool ota_mcast_rx_matches(const ota_mcast_rx_t *rx, const uint8_t *packet, size_t len);
+
+// Take one packet. Returns the block it completed, now all written, -1 when none was, or -2
+// when writing or reading the partition failed. Packets of other images and of blocks
+// already done are ignored; a packet of another block puts the one being decoded aside.
+int ota_mcast_rx_packet(ota_mcast_rx_t *rx, const uint8_t *packet, size_t len);
+
+// Whether every block of verify chunk `chunk` has been received; ota_mcast_rx_forget() takes
+// a chunk that did not match its digest back, to be erased and received again
+bool ota_mcast_chunk_received(const ota_mcast_rx_t *rx, int chunk);
+void ota_mcast_rx_forget(ota_mcast_rx_t *rx, int chunk);
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "ota_manifest.h"
+
+// Receive the manifest's image from the multicast group into the next OTA partition and make
+// it the boot partition. Needs the chunk digests. The partition is erased only once a packet
+// of the image has been heard. Returns ESP_ERR_NOT_FOUND when no sender is heard, ESP_ERR_TIMEOUT when the sender stopped before every block came through; the
+// caller then downloads the image instead.
+esp_err_t ota_mcast_receive(const ota_manifest_t *manifest);
+#endif
+
+#endif /* OTA_MCAST_H */
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#if CONFIG_HEAP_TRACING_STANDALONE
+#include "esp_heap_trace.h"
+#endif
+
+#include "ota_memory.h"
+
+// The heap keeps its own low-water mark between samples; since 5.1 it can be restarted for
+// each update instead of counting from boot
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define LOCAL_MINIMUM 1
+#else
+#define LOCAL_MINIMUM 0
+#endif
+
+// A peer download opens a second session inside the check; only the outer one restarts the
+// low-water mark and the trace
+static ota_memory_t *s_owner;
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+static heap_trace_record_t s_records[OTA_MEMORY_TRACE_RECORDS];
+static bool s_trace_ready;
+#endif
+
+void ota_memory_begin(ota_memory_t *m)
+{
+    if (s_owner == m) {
+        // Begun again before the report: start over
+#if LOCAL_MINIMUM
+        heap_caps_monitor_local_minimum_free_size_stop();
+#endif
+#if CONFIG_HEAP_TRACING_STANDALONE
+        heap_trace_stop();
+#endif
+        s_owner = NULL;
+    }
+    memset(m, 0, sizeof(*m));
+    m->free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    m->min_free = m->free_before;
+    m->min_largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    m->free_then = m->free_before;
+    m->stack_left = uxTaskGetStackHighWaterMark(NULL);
+    if (s_owner != NULL) {
+        return;
+    }
+    s_owner = m;
+    m->owner = true;
+#if LOCAL_MINIMUM
+    heap_caps_monitor_local_minimum_free_size_start();
+#endif
+#if CONFIG_HEAP_TRACING_STANDALONE
+    if (!s_trace_ready) {
+        s_trace_ready = heap_trace_init_standalone(s_records, OTA_MEMORY_TRACE_RECORDS) == ESP_OK;
+    }
+    // Leak mode forgets an allocation once it is freed: what is left at the end is still held
+    if (s_trace_ready) {
+        heap_trace_start(HEAP_TRACE_LEAKS);
+    }
+#endif
+}
+
+void ota_memory_sample(ota_memory_t *m)
+{
+    uint32_t free_now = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t stack_left = uxTaskGetStackHighWaterMark(NULL);
+
+    if (free_now < m->min_free) {
+        m->min_free = free_now;
+    }
+    if (largest < m->min_largest) {
+        m->min_largest = largest;
+        m->free_then = free_now;
+    }
+    if (stack_left < m->stack_left) {
+        m->stack_left = stack_left;
+    }
+}
+
+int ota_memory_buffers(size_t len, int count)
+{
+    size_t free_now = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    size_t spare = free_now > OTA_MEMORY_RESERVE ? free_now - OTA_MEMORY_RESERVE : 0;
+    // ota_pipeline_new() takes the buffers as one block
+    size_t fit = (spare < largest ? spare : largest) / len;
+    return fit < (size_t)count ? (int)fit : count;
+}
+
+size_t ota_memory_format(ota_memory_t *m, char *buf, size_t len)
+{
+    ota_memory_sample(m);
+#if LOCAL_MINIMUM
+    if (m->owner) {
+        uint32_t low = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        if (low < m->min_free) {
+            m->min_free = low;
+        }
+        heap_caps_monitor_local_minimum_free_size_stop();
+    }
+#endif
+    unsigned fragmented = m->free_then ? 100 - (uint64_t)m->min_largest * 100 / m->free_then : 0;
+    int n = snprintf(buf, len, "heap peak %u bytes (free %u, lowest %u), largest free block %u of %u "
+                     "free (%u%% fragmented), stack left %u",
+                     (unsigned)(m->free_before - m->min_free), (unsigned)m->free_before,
+                     (unsigned)m->min_free, (unsigned)m->min_largest, (unsigned)m->free_then,
+                     fragmented, (unsigned)m->stack_left);
+#if CONFIG_HEAP_TRACING_STANDALONE
+    if (m->owner && s_trace_ready && n > 0 && (size_t)n < len) {
+        heap_trace_stop();
+        size_t count = heap_trace_get_count();
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            heap_trace_record_t record;
+            if (heap_trace_get(i, &record) == ESP_OK) {
+                bytes += record.size;
+            }
+        }
+        n += snprintf(buf + n, len - n, ", %u allocations (%u bytes) made since and still held",
+                      (unsigned)count, (unsigned)bytes);
+    }
+#endif
+    if (m->owner) {
+        s_owner = NULL;
+        m->owner = false;
+    }
+    return n > 0 ? n : 0;
+}
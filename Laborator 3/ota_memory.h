@@ -0,0 +1,69 @@
+#ifndef OTA_MEMORY_H
+#define OTA_MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// Low-RAM profile, for boards that run an HTTP server and Wi-Fi next to the update: two 2 KB
+// receive buffers instead of four of 4 KB, and TLS record buffers allocated per record
+// instead of for the whole connection. Build with sdkconfig.defaults.low_ram, which turns on
+// CONFIG_OTA_LOW_RAM (Kconfig.projbuild) and the TLS part, checked when the session opens:
+//   CONFIG_MBEDTLS_DYNAMIC_BUFFER=y              buffers sized to each record, freed after it
+//   CONFIG_MBEDTLS_DYNAMIC_FREE_CONFIG_DATA=y    key exchange data freed after the handshake
+//   CONFIG_MBEDTLS_ASYMMETRIC_CONTENT_LEN=y
+//   CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN=2048      the device only sends short requests
+// Not CONFIG_MBEDTLS_DYNAMIC_FREE_CA_CERT: it frees the CA chain the connection verified
+// with, which is the shared global CA store (ota_session_init_ca()).
+#ifndef OTA_LOW_RAM
+#ifdef CONFIG_OTA_LOW_RAM
+#define OTA_LOW_RAM 1
+#else
+#define OTA_LOW_RAM 0
+#endif
+#endif
+
+// Free heap left to the rest of the firmware: the update cuts its buffers down, or fails
+// with ESP_ERR_NO_MEM and tries again later, rather than take the heap below this
+#ifndef OTA_MEMORY_RESERVE
+#define OTA_MEMORY_RESERVE (24 * 1024)
+#endif
+
+// Stack the OTA task should keep unused at its deepest, for what the measurement misses
+#ifndef OTA_MEMORY_STACK_MARGIN
+#define OTA_MEMORY_STACK_MARGIN 1024
+#endif
+
+// Allocations recorded by heap tracing (CONFIG_HEAP_TRACING_STANDALONE) during an update
+#define OTA_MEMORY_TRACE_RECORDS 200
+
+// Heap and stack of one update check and download, from ota_memory_begin() on
+typedef struct {
+    uint32_t free_before;   // free heap at the start
+    uint32_t min_free;      // lowest free heap since
+    uint32_t min_largest;   // smallest largest-free-block at the samples
+    uint32_t free_then;     // free heap at that sample, for the fragmentation figure
+    uint32_t stack_left;    // least stack the sampling task had left
+    bool owner;             // outermost measurement: owns the heap's low-water mark and trace
+} ota_memory_t;
+
+// Start measuring; with heap tracing enabled, start recording allocations as well
+void ota_memory_begin(ota_memory_t *m);
+
+// Look at the largest free block and the stack; the lowest free heap is tracked between
+// samples as well
+void ota_memory_sample(ota_memory_t *m);
+
+// How many of `count` buffers of `len` bytes fit in one block each while leaving
+// OTA_MEMORY_RESERVE free; 0 when not even one does
+int ota_memory_buffers(size_t len, int count);
+
+// Stop measuring and describe the update's memory in one line: peak use, fragmentation at
+// the low point, stack left and, with heap tracing, allocations made and not freed since
+// ota_memory_begin()
+size_t ota_memory_format(ota_memory_t *m, char *buf, size_t len);
+
+#endif /* OTA_MEMORY_H */
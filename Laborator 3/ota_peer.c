@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_peer.h"
+
+int ota_peer_pick(const ota_peer_t *peers, int count, const char *version, uint32_t seed)
+{
+    int candidates[OTA_PEER_MAX];
+    int n = 0;
+
+    for (int i = 0; i < count && n < OTA_PEER_MAX; i++) {
+        if (strcmp(peers[i].version, version) == 0 && peers[i].uploads < OTA_PEER_MAX_UPLOADS) {
+            candidates[n++] = i;
+        }
+    }
+    if (n == 0) {
+        return -1;
+    }
+    int a = candidates[seed % n];
+    int b = candidates[(seed / n) % n];
+    return peers[b].uploads < peers[a].uploads ? b : a;
+}
+
+int ota_peer_remove(ota_peer_t *peers, int count, int index)
+{
+    memmove(&peers[index], &peers[index + 1], (count - index - 1) * sizeof(peers[0]));
+    return count - 1;
+}
+
+int ota_peer_parse_range(const char *range, size_t size, size_t *start)
+{
+    char *end;
+
+    *start = 0;
+    if (range == NULL || strncmp(range, "bytes=", 6) != 0) {
+        return 0;
+    }
+    unsigned long first = strtoul(range + 6, &end, 10);
+    // Anything else is answered with the whole image, which a range request allows
+    if (end == range + 6 || strcmp(end, "-") != 0) {
+        return 0;
+    }
+    if (first >= size) {
+        return -1;
+    }
+    *start = first;
+    return 0;
+}
+
+size_t ota_peer_response_head(char *buf, size_t len, int status, size_t start, size_t size,
+                              const char *etag)
+{
+    int n;
+
+    if (status == 200 && start) {
+        n = snprintf(buf, len, "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %u-%u/%u\r\n",
+                     (unsigned)start, (unsigned)size - 1, (unsigned)size);
+    } else if (status == 200) {
+        n = snprintf(buf, len, "HTTP/1.1 200 OK\r\n");
+    } else if (status == 503) {
+        n = snprintf(buf, len, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+                     "Retry-After: %d\r\n\r\n", OTA_PEER_RETRY_S);
+        return n > 0 && (size_t)n < len ? n : 0;
+    } else {
+        n = snprintf(buf, len, "HTTP/1.1 %d Error\r\nContent-Length: 0\r\n\r\n", status);
+        return n > 0 && (size_t)n < len ? n : 0;
+    }
+    if (n > 0 && (size_t)n < len) {
+        n += snprintf(buf + n, len - n, "Content-Type: application/octet-stream\r\n"
+                      "Content-Length: %u\r\nETag: %s\r\nAccept-Ranges: bytes\r\n\r\n",
+                      (unsigned)(size - start), etag);
+    }
+    return n > 0 && (size_t)n < len ? n : 0;
+}
+
+#ifdef ESP_PLATFORM
+#include <stdatomic.h>
+#include "esp_http_server.h"
+#include "esp_idf_version.h"
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif_ip_addr.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mdns.h"
+#include "version.h"
+
+static const char *TAG = "ota_peer";
+
+// Since 5.1 an upload runs on a task of its own, leaving the server free to turn other
+// requests away at once; before, it runs on the server task and they wait for it
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define ASYNC_UPLOAD 1
+#else
+#define ASYNC_UPLOAD 0
+#endif
+#define UPLOAD_TASK_STACK 3072
+
+typedef struct {
+    httpd_req_t *req;
+    size_t start;
+    uint8_t *buf;
+} upload_t;
+
+static const esp_partition_t *s_running;
+static size_t s_image_len;
+static char s_etag[48];
+static atomic_int s_uploads;
+
+static void advertise_uploads(int uploads)
+{
+    char n[4];
+    snprintf(n, sizeof(n), "%d", uploads);
+    mdns_service_txt_item_set(OTA_PEER_SERVICE, OTA_PEER_PROTO, "n", n);
+}
+
+// The head is written by hand because httpd_resp_send_chunk() would send it chunked,
+// without a Content-Length
+static void upload(upload_t *u)
+{
+    char head[256];
+    size_t len = ota_peer_response_head(head, sizeof(head), 200, u->start, s_image_len, s_etag);
+
+    if (httpd_send(u->req, head, len) == (int)len) {
+        ESP_LOGI(TAG, "Sending %s to a peer from byte %u", VERSION_SHORT, (unsigned)u->start);
+        for (size_t pos = u->start; pos < s_image_len; pos += len) {
+            len = s_image_len - pos < OTA_PEER_BLOCK_LEN ? s_image_len - pos : OTA_PEER_BLOCK_LEN;
+            if (esp_partition_read(s_running, pos, u->buf, len) != ESP_OK ||
+                httpd_send(u->req, (const char *)u->buf, len) != (int)len) {
+                ESP_LOGW(TAG, "Upload to a peer stopped at byte %u", (unsigned)pos);
+                break;
+            }
+        }
+    }
+    free(u->buf);
+    atomic_fetch_sub(&s_uploads, 1);
+    advertise_uploads(atomic_load(&s_uploads));
+}
+
+#if ASYNC_UPLOAD
+static void upload_task(void *arg)
+{
+    upload_t *u = arg;
+    upload(u);
+    httpd_req_async_handler_complete(u->req);
+    free(u);
+    vTaskDelete(NULL);
+}
+#endif
+
+static esp_err_t answer(httpd_req_t *req, int status)
+{
+    char head[128];
+    size_t len = ota_peer_response_head(head, sizeof(head), status, 0, s_image_len, s_etag);
+    httpd_send(req, head, len);
+    return ESP_OK;
+}
+
+// GET /firmware.bin: the running image, straight from flash
+static esp_err_t image_get(httpd_req_t *req)
+{
+    char range[32];
+    char if_range[sizeof(s_etag)];
+    size_t start = 0;
+
+    // A resumed download only continues here if it was started on this same image
+    if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK &&
+        (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+         strcmp(if_range, s_etag) == 0) &&
+        ota_peer_parse_range(range, s_image_len, &start) != 0) {
+        return answer(req, 416);
+    }
+    // A device asking while the uploads are taken is told so at once and tries another peer
+    if (atomic_fetch_add(&s_uploads, 1) >= OTA_PEER_MAX_UPLOADS) {
+        atomic_fetch_sub(&s_uploads, 1);
+        return answer(req, 503);
+    }
+    upload_t *u = malloc(sizeof(*u));
+    uint8_t *buf = malloc(OTA_PEER_BLOCK_LEN);
+    if (u == NULL || buf == NULL) {
+        free(u);
+        free(buf);
+        atomic_fetch_sub(&s_uploads, 1);
+        return answer(req, 503);
+    }
+    *u = (upload_t){ .req = req, .start = start, .buf = buf };
+    advertise_uploads(atomic_load(&s_uploads));
+#if ASYNC_UPLOAD
+    if (httpd_req_async_handler_begin(req, &u->req) == ESP_OK) {
+        if (xTaskCreate(upload_task, "peer_upload", UPLOAD_TASK_STACK, u, tskIDLE_PRIORITY + 5,
+                        NULL) == pdPASS) {
+            return ESP_OK;
+        }
+        httpd_req_async_handler_complete(u->req);
+        u->req = req;
+    }
+    // Without a task of its own it is sent from the server task, as before 5.1
+#endif
+    upload(u);
+    free(u);
+    return ESP_OK;
+}
+
+esp_err_t ota_peer_start(void)
+{
+    uint8_t mac[6];
+    char hostname[16];
+
+    esp_err_t err = mdns_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mDNS start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(hostname, sizeof(hostname), "esp-ota-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    mdns_hostname_set(hostname);
+
+    // The factory partition has no state and is always served
+    esp_ota_img_states_t state;
+    s_running = esp_ota_get_running_partition();
+    if (esp_ota_get_state_partition(s_running, &state) == ESP_OK &&
+        state != ESP_OTA_IMG_VALID && state != ESP_OTA_IMG_UNDEFINED) {
+        ESP_LOGI(TAG, "Running image not confirmed yet, not serving it to peers");
+        return ESP_OK;
+    }
+    // The partition is larger than the image; the verified length is what was downloaded
+    esp_image_metadata_t meta;
+    const esp_partition_pos_t pos = { .offset = s_running->address, .size = s_running->size };
+    err = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &meta);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Running image does not verify, not serving it: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_image_len = meta.image_len;
+    snprintf(s_etag, sizeof(s_etag), "\"peer-%s\"", VERSION_SHORT);
+
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = OTA_PEER_PORT;
+    config.max_open_sockets = 3;
+    err = httpd_start(&server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Peer HTTP server start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    const httpd_uri_t image = { .uri = "/firmware.bin", .method = HTTP_GET, .handler = image_get };
+    httpd_register_uri_handler(server, &image);
+
+    mdns_txt_item_t txt[] = { { "v", VERSION_SHORT }, { "n", "0" } };
+    err = mdns_service_add(NULL, OTA_PEER_SERVICE, OTA_PEER_PROTO, OTA_PEER_PORT, txt, 2);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mDNS service registration failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Serving %s (%u bytes) to peers on port %d", VERSION_SHORT,
+             (unsigned)s_image_len, OTA_PEER_PORT);
+    return ESP_OK;
+}
+
+int ota_peer_find(const char *version, ota_peer_t *peers, int max)
+{
+    mdns_result_t *results = NULL;
+    int count = 0;
+
+    esp_err_t err = mdns_query_ptr(OTA_PEER_SERVICE, OTA_PEER_PROTO, OTA_PEER_QUERY_MS, max, &results);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Peer query failed: %s", esp_err_to_name(err));
+        return 0;
+    }
+    for (const mdns_result_t *r = results; r && count < max; r = r->next) {
+        const mdns_ip_addr_t *addr = r->addr;
+        while (addr && addr->addr.type != ESP_IPADDR_TYPE_V4) {
+            addr = addr->next;
+        }
+        if (addr == NULL) {
+            continue;
+        }
+        ota_peer_t *p = &peers[count];
+        memset(p, 0, sizeof(*p));
+        snprintf(p->host, sizeof(p->host), IPSTR, IP2STR(&addr->addr.u_addr.ip4));
+        p->port = r->port;
+        for (size_t i = 0; i < r->txt_count; i++) {
+            if (r->txt[i].value == NULL) {
+                continue;
+            }
+            if (strcmp(r->txt[i].key, "v") == 0) {
+                strlcpy(p->version, r->txt[i].value, sizeof(p->version));
+            } else if (strcmp(r->txt[i].key, "n") == 0) {
+                p->uploads = atoi(r->txt[i].value);
+            }
+        }
+        if (strcmp(p->version, version) == 0) {
+            count++;
+        }
+    }
+    mdns_query_results_free(results);
+    ESP_LOGI(TAG, "%d peer(s) on the LAN run %s", count, version);
+    return count;
+}
+#endif
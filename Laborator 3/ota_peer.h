@@ -0,0 +1,66 @@
+#ifndef OTA_PEER_H
+#define OTA_PEER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Firmware distribution between devices on the same LAN. A device advertises the image it
+// runs over mDNS (_esp-ota._tcp, TXT "v" its version and "n" the images it is sending) and
+// serves it over plain HTTP from its running partition; a device about to update downloads
+// the new version from such a peer instead of the update server. Peers are not trusted: the
+// image is checked against the manifest's chunk digests as it is written, and without
+// digests no peer is used.
+//
+// Peer selection and the HTTP framing run in the host build as well (host/peer_sim.c).
+
+#define OTA_PEER_SERVICE     "_esp-ota"
+#define OTA_PEER_PROTO       "_tcp"
+#define OTA_PEER_PORT        8070
+#define OTA_PEER_MAX         16
+// Images a device sends at once. Another request meanwhile is answered 503 with Retry-After
+// right away, and the asking device picks another peer. Before IDF 5.1 the upload runs on
+// the esp_http_server task, which handles one request at a time: the request then waits for
+// the upload to end, and the asking device gives up on the peer after OTA_SESSION_TIMEOUT_MS.
+#define OTA_PEER_MAX_UPLOADS 1
+#define OTA_PEER_QUERY_MS    1500
+#define OTA_PEER_BLOCK_LEN   4096
+// Seconds a device that is asked for one image too many tells the asking device to wait
+#define OTA_PEER_RETRY_S     5
+
+typedef struct {
+    char host[16];      // IPv4 address
+    uint16_t port;
+    char version[32];   // version it runs and serves
+    uint8_t uploads;    // images it was sending when it answered (TXT "n")
+} ota_peer_t;
+
+// Index in `peers` of the peer to download `version` from, -1 when none has it with an upload
+// slot free. Two candidates are drawn using `seed` and the less busy one is taken, so a fleet
+// updating together spreads over the peers instead of all picking the first one found.
+int ota_peer_pick(const ota_peer_t *peers, int count, const char *version, uint32_t seed);
+
+// Drop peers[index], after a failed transfer. Returns the new count.
+int ota_peer_remove(ota_peer_t *peers, int count, int index);
+
+// First byte to send for a "Range" header (NULL: none) on an image of `size` bytes. Returns 0,
+// or -1 when the range cannot be satisfied. Only "bytes=<first>-", what the devices send.
+int ota_peer_parse_range(const char *range, size_t size, size_t *start);
+
+// Response head for sending an image of `size` bytes from `start` (200, or 206 when start is
+// not 0), 503 with Retry-After while the uploads are taken, or another status with no body.
+// Returns its length, 0 if it does not fit.
+size_t ota_peer_response_head(char *buf, size_t len, int status, size_t start, size_t size,
+                              const char *etag);
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+
+// Start mDNS, then advertise and serve the running image. The image is only served once
+// it is valid: not while it is still pending verification after an update.
+esp_err_t ota_peer_start(void);
+
+// Peers on the LAN running `version`; fills at most `max` of them and returns how many
+int ota_peer_find(const char *version, ota_peer_t *peers, int max);
+#endif
+
+#endif /* OTA_PEER_H */
@@ -0,0 +1,255 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ota_pipeline.h"
+
+// A buffer on its way between the two tasks. A NULL buffer is a control message to the writer,
+// answered on the done queue once everything queued before it has been written.
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} slot_t;
+
+#define CONTROL_DRAIN 0
+#define CONTROL_STOP  1
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+typedef QueueHandle_t queue_t;
+typedef TaskHandle_t writer_t;
+
+static queue_t queue_new(int len)
+{
+    return xQueueCreate(len, sizeof(slot_t));
+}
+
+static void queue_send(queue_t q, slot_t slot)
+{
+    xQueueSend(q, &slot, portMAX_DELAY);
+}
+
+static slot_t queue_receive(queue_t q)
+{
+    slot_t slot;
+    xQueueReceive(q, &slot, portMAX_DELAY);
+    return slot;
+}
+
+static void queue_delete(queue_t q)
+{
+    if (q) {
+        vQueueDelete(q);
+    }
+}
+
+#else
+// Host build: the same bounded blocking queues on pthreads, for host/pipeline_bench.c
+#include <pthread.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    slot_t *slots;
+    int len;
+    int head;
+    int count;
+} *queue_t;
+typedef pthread_t writer_t;
+
+static queue_t queue_new(int len)
+{
+    queue_t q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->slots = calloc(len, sizeof(slot_t));
+    if (q->slots == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->len = len;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return q;
+}
+
+static void queue_send(queue_t q, slot_t slot)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->len) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    q->slots[(q->head + q->count++) % q->len] = slot;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static slot_t queue_receive(queue_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    slot_t slot = q->slots[q->head];
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return slot;
+}
+
+static void queue_delete(queue_t q)
+{
+    if (q) {
+        pthread_cond_destroy(&q->changed);
+        pthread_mutex_destroy(&q->lock);
+        free(q->slots);
+        free(q);
+    }
+}
+#endif
+
+struct ota_pipeline {
+    queue_t free_q;  // empty buffers
+    queue_t full_q;  // filled buffers and control messages, in submission order
+    queue_t done_q;  // the writer's answers to control messages
+    uint8_t *bufs;
+    size_t buf_len;
+    int buf_count;
+    int error;       // first non-zero write result; set by the writer only
+    bool running;
+    writer_t writer;
+    ota_pipeline_write_t write;
+    void *ctx;
+};
+
+static void writer_loop(ota_pipeline_t *p)
+{
+    while (1) {
+        slot_t slot = queue_receive(p->full_q);
+        if (slot.buf == NULL) {
+            queue_send(p->done_q, slot);
+            if (slot.len == CONTROL_STOP) {
+                return;
+            }
+            continue;
+        }
+        // After a failure the buffers still go back, so the downloading task never blocks
+        if (p->error == 0) {
+            p->error = p->write(slot.buf, slot.len, p->ctx);
+        }
+        queue_send(p->free_q, slot);
+    }
+}
+
+#ifdef ESP_PLATFORM
+static void writer_task(void *arg)
+{
+    writer_loop(arg);
+    vTaskDelete(NULL);
+}
+
+static bool writer_start(ota_pipeline_t *p)
+{
+    return xTaskCreate(writer_task, "ota_writer", OTA_PIPELINE_STACK_SIZE, p,
+                       OTA_PIPELINE_PRIORITY, &p->writer) == pdPASS;
+}
+
+static void writer_join(ota_pipeline_t *p)
+{
+    // The task deletes itself after answering CONTROL_STOP and touches nothing of `p` after that
+}
+#else
+static void *writer_thread(void *arg)
+{
+    writer_loop(arg);
+    return NULL;
+}
+
+static bool writer_start(ota_pipeline_t *p)
+{
+    return pthread_create(&p->writer, NULL, writer_thread, p) == 0;
+}
+
+static void writer_join(ota_pipeline_t *p)
+{
+    pthread_join(p->writer, NULL);
+}
+#endif
+
+ota_pipeline_t *ota_pipeline_new(size_t buf_len, int buf_count, ota_pipeline_write_t write, void *ctx)
+{
+    ota_pipeline_t *p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->buf_len = buf_len;
+    p->buf_count = buf_count;
+    p->write = write;
+    p->ctx = ctx;
+    p->bufs = malloc(buf_len * buf_count);
+    p->free_q = queue_new(buf_count);
+    p->full_q = queue_new(buf_count + 1);
+    p->done_q = queue_new(1);
+    if (p->bufs == NULL || p->free_q == NULL || p->full_q == NULL || p->done_q == NULL) {
+        ota_pipeline_free(p);
+        return NULL;
+    }
+    for (int i = 0; i < buf_count; i++) {
+        queue_send(p->free_q, (slot_t){ p->bufs + i * buf_len, 0 });
+    }
+    p->running = writer_start(p);
+    if (!p->running) {
+        ota_pipeline_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+uint8_t *ota_pipeline_acquire(ota_pipeline_t *p)
+{
+    slot_t slot = queue_receive(p->free_q);
+    // The writer sets the error before returning the buffer, so this sees it
+    if (p->error != 0) {
+        queue_send(p->free_q, slot);
+        return NULL;
+    }
+    return slot.buf;
+}
+
+void ota_pipeline_submit(ota_pipeline_t *p, uint8_t *buf, size_t len)
+{
+    queue_send(len ? p->full_q : p->free_q, (slot_t){ buf, len });
+}
+
+int ota_pipeline_drain(ota_pipeline_t *p)
+{
+    queue_send(p->full_q, (slot_t){ NULL, CONTROL_DRAIN });
+    queue_receive(p->done_q);
+    return p->error;
+}
+
+size_t ota_pipeline_buf_len(const ota_pipeline_t *p)
+{
+    return p->buf_len;
+}
+
+void ota_pipeline_free(ota_pipeline_t *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    if (p->running) {
+        queue_send(p->full_q, (slot_t){ NULL, CONTROL_STOP });
+        queue_receive(p->done_q);
+        writer_join(p);
+    }
+    queue_delete(p->free_q);
+    queue_delete(p->full_q);
+    queue_delete(p->done_q);
+    free(p->bufs);
+    free(p);
+}
@@ -0,0 +1,42 @@
+#ifndef OTA_PIPELINE_H
+#define OTA_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Overlaps receiving the firmware with writing it: the downloading task fills buffers from a
+// fixed pool and hands them over, a writer task empties them into flash (through the
+// decompressor for compressed images) and returns them to the pool. With a single buffer the
+// two take turns, which is the old read-then-write loop.
+//
+// Runs on FreeRTOS on the device and on pthreads in the host build (host/pipeline_bench.c).
+
+// Writer task stack: inflate state is on the heap, but the flash and NVS calls need room
+#define OTA_PIPELINE_STACK_SIZE 4096
+#define OTA_PIPELINE_PRIORITY   5
+
+// Called on the writer task for every submitted buffer, in order; non-zero stops the writer,
+// the code is returned by ota_pipeline_drain()
+typedef int (*ota_pipeline_write_t)(const uint8_t *buf, size_t len, void *ctx);
+
+typedef struct ota_pipeline ota_pipeline_t;
+
+// `buf_count` buffers of `buf_len` bytes each are allocated up front
+ota_pipeline_t *ota_pipeline_new(size_t buf_len, int buf_count, ota_pipeline_write_t write, void *ctx);
+
+// An empty buffer of ota_pipeline_buf_len() bytes to receive into. Blocks while all buffers
+// are waiting to be written; NULL once the writer has failed.
+uint8_t *ota_pipeline_acquire(ota_pipeline_t *p);
+
+// Queue the first `len` bytes of an acquired buffer for writing; `len` 0 returns it unused
+void ota_pipeline_submit(ota_pipeline_t *p, uint8_t *buf, size_t len);
+
+// Wait until every submitted buffer has been written. Returns 0 or the writer's error.
+int ota_pipeline_drain(ota_pipeline_t *p);
+
+size_t ota_pipeline_buf_len(const ota_pipeline_t *p);
+
+// Stops the writer; anything still queued is discarded
+void ota_pipeline_free(ota_pipeline_t *p);
+
+#endif /* OTA_PIPELINE_H */
@@ -0,0 +1,58 @@
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "ota_resume.h"
+
+static const char *TAG = "ota_resume";
+
+esp_err_t ota_resume_load(ota_resume_t *progress)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(*progress);
+
+    esp_err_t err = nvs_open(OTA_RESUME_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_get_blob(nvs, "progress", progress, &len);
+    nvs_close(nvs);
+    if (err == ESP_OK && len != sizeof(*progress)) {
+        // Written by a firmware with a different layout
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    return err;
+}
+
+esp_err_t ota_resume_save(const ota_resume_t *progress)
+{
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(OTA_RESUME_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, "progress", progress, sizeof(*progress));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to save progress: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void ota_resume_clear(void)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(OTA_RESUME_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, "progress");
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
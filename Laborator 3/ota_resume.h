@@ -0,0 +1,28 @@
+#ifndef OTA_RESUME_H
+#define OTA_RESUME_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define OTA_RESUME_NAMESPACE "ota_resume"
+#define OTA_RESUME_ETAG_LEN  72
+// Raw downloads are checkpointed every this many flashed bytes (a multiple of the flash
+// sector), compressed ones at every OTA_INFLATE_SEGMENT_LEN segment end; never at the end of
+// the body, which has to be checked against the manifest first
+#define OTA_RESUME_CHECKPOINT (64 * 1024)
+
+// Progress of an interrupted firmware download, kept in NVS across reboots
+typedef struct {
+    char etag[OTA_RESUME_ETAG_LEN]; // entity being downloaded, sent back in If-Range
+    uint8_t compressed;             // 1 if the body is the x-zseg encoding
+    uint32_t partition;             // flash address of the OTA partition being written
+    uint32_t in_offset;             // bytes of the response body already used
+    uint32_t out_offset;            // bytes already flashed, sector aligned
+} ota_resume_t;
+
+// ESP_ERR_NOT_FOUND (or any NVS error) means start from scratch
+esp_err_t ota_resume_load(ota_resume_t *progress);
+esp_err_t ota_resume_save(const ota_resume_t *progress);
+void ota_resume_clear(void);
+
+#endif /* OTA_RESUME_H */
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_mac.h"
+#include "esp_tls.h"
+
+#include "ota_session.h"
+
+static const char *TAG = "ota_session";
+
+// Headers a request may set; cleared before the next request on the same connection
+static const char *const s_request_headers[] = {
+    "Accept-Encoding", "Range", "If-Range", "If-None-Match",
+};
+
+static esp_err_t session_event_handler(esp_http_client_event_t *evt)
+{
+    ota_session_t *s = evt->user_data;
+
+    if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+        // A resumed session skips the certificate chain check and the key exchange, which is
+        // most of the time and of the heap peak of a full handshake
+        s->handshakes++;
+        ota_memory_sample(&s->memory);
+        ota_stats_add(&s->stats, OTA_PHASE_CONNECT, esp_timer_get_time() - s->connect_start_us, 0);
+        ESP_LOGI(TAG, "Connected to %s: handshake %d took %lld ms, connection holds %ld bytes, "
+                 "free heap %u (lowest %u)", s->base_url, s->handshakes,
+                 (esp_timer_get_time() - s->connect_start_us) / 1000,
+                 (long)s->heap_before - (long)esp_get_free_heap_size(),
+                 (unsigned)esp_get_free_heap_size(),
+                 (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_session_init_ca(const char *cert_pem, size_t len)
+{
+    esp_err_t err = esp_tls_set_global_ca_store((const unsigned char *)cert_pem, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Parsing the server CA failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t ota_session_open(ota_session_t *s, const char *base_url)
+{
+    memset(s, 0, sizeof(*s));
+    strlcpy(s->base_url, base_url, sizeof(s->base_url));
+    ota_session_start_check(s);
+
+    esp_http_client_config_t config = {
+        .url = base_url,
+        .use_global_ca_store = true,
+        .event_handler = session_event_handler,
+        .user_data = s,
+        .keep_alive_enable = true,
+        .timeout_ms = OTA_SESSION_TIMEOUT_MS,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        .save_client_session = true,
+#endif
+        .skip_cert_common_name_check = true
+    };
+#if !CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    ESP_LOGW(TAG, "CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS is off, every reconnect is a full handshake");
+#endif
+#if OTA_LOW_RAM && !CONFIG_MBEDTLS_DYNAMIC_BUFFER
+    ESP_LOGW(TAG, "OTA_LOW_RAM without CONFIG_MBEDTLS_DYNAMIC_BUFFER: the TLS record buffers stay "
+             "allocated for the whole connection");
+#endif
+    s->client = esp_http_client_init(&config);
+    if (s->client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Set once, kept across requests: ota_session_request() only clears s_request_headers
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(s->device_id, sizeof(s->device_id), "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    esp_http_client_set_header(s->client, "X-Device-Id", s->device_id);
+    return ESP_OK;
+}
+
+// Host of scheme://host:port
+static void resolve_server(ota_session_t *s)
+{
+    char host[sizeof(s->base_url)];
+    const char *start = strstr(s->base_url, "://");
+    start = start ? start + 3 : s->base_url;
+    strlcpy(host, start, sizeof(host));
+    host[strcspn(host, ":/")] = '\0';
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    int64_t start_us = esp_timer_get_time();
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    ota_stats_add(&s->stats, OTA_PHASE_DNS, esp_timer_get_time() - start_us, 0);
+    if (err != 0 || res == NULL) {
+        ESP_LOGW(TAG, "Resolving %s failed: %d", host, err);
+    }
+    if (res) {
+        freeaddrinfo(res);
+    }
+}
+
+void ota_session_start_check(ota_session_t *s)
+{
+    ota_stats_reset(&s->stats);
+    ota_memory_begin(&s->memory);
+    s->check_start_us = s->stats.start_us;
+    s->first_byte_us = 0;
+    resolve_server(s);
+}
+
+esp_err_t ota_session_request(ota_session_t *s, const char *path)
+{
+    char url[160];
+
+    snprintf(url, sizeof(url), "%s%s", s->base_url, path);
+    for (int i = 0; i < sizeof(s_request_headers) / sizeof(s_request_headers[0]); i++) {
+        esp_http_client_delete_header(s->client, s_request_headers[i]);
+    }
+    esp_http_client_set_method(s->client, HTTP_METHOD_GET);
+    return esp_http_client_set_url(s->client, url);
+}
+
+esp_err_t ota_session_send(ota_session_t *s, int *status, int64_t *content_len)
+{
+    // Reuses the open connection if the server kept it alive, connects otherwise
+    s->connect_start_us = esp_timer_get_time();
+    s->heap_before = esp_get_free_heap_size();
+    esp_err_t err = esp_http_client_open(s->client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Request to %s failed: %s", s->base_url, esp_err_to_name(err));
+        return err;
+    }
+    int64_t len = esp_http_client_fetch_headers(s->client);
+    ota_memory_sample(&s->memory);
+    if (content_len) {
+        *content_len = len;
+    }
+    *status = esp_http_client_get_status_code(s->client);
+
+    s->retry_after_ms = 0;
+    if (*status == 503 || *status == 429) {
+        // Only the delay-seconds form; an HTTP date falls back to the default
+        char *value = NULL;
+        esp_http_client_get_header(s->client, "Retry-After", &value);
+        int seconds = value ? atoi(value) : 0;
+        if (seconds <= 0) {
+            seconds = OTA_SESSION_DEFAULT_RETRY_S;
+        }
+        s->retry_after_ms = (seconds < OTA_SESSION_MAX_RETRY_S ? seconds : OTA_SESSION_MAX_RETRY_S) * 1000;
+    }
+    return ESP_OK;
+}
+
+void ota_session_finish(ota_session_t *s)
+{
+    int len;
+    esp_http_client_flush_response(s->client, &len);
+}
+
+void ota_session_first_byte(ota_session_t *s)
+{
+    if (s->first_byte_us == 0) {
+        s->first_byte_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "Update check to first firmware byte: %lld ms, %d handshake(s)",
+                 (s->first_byte_us - s->check_start_us) / 1000, s->handshakes);
+    }
+}
+
+void ota_session_report(ota_session_t *s, const char *outcome)
+{
+    char line[320];
+    ota_stats_format(&s->stats, line, sizeof(line));
+    ESP_LOGI(TAG, "OTA %s: %s", outcome, line);
+    ota_memory_format(&s->memory, line, sizeof(line));
+    ESP_LOGI(TAG, "OTA %s: %s", outcome, line);
+    if (s->memory.stack_left < OTA_MEMORY_STACK_MARGIN) {
+        ESP_LOGW(TAG, "Only %u bytes of the OTA task's stack were left, raise CONFIG_OTA_TASK_STACK",
+                 (unsigned)s->memory.stack_left);
+    }
+}
+
+void ota_session_close(ota_session_t *s)
+{
+    if (s->client) {
+        esp_http_client_cleanup(s->client);
+        s->client = NULL;
+    }
+}
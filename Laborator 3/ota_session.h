@@ -0,0 +1,70 @@
+#ifndef OTA_SESSION_H
+#define OTA_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+#include "ota_memory.h"
+#include "ota_stats.h"
+
+// Wait before retrying when the server is too busy and does not say for how long, and the
+// longest a Retry-After is followed
+#define OTA_SESSION_DEFAULT_RETRY_S 60
+#define OTA_SESSION_MAX_RETRY_S     (60 * 60)
+// Network timeout of a request; a long-polled manifest gets the server's hold on top
+#define OTA_SESSION_TIMEOUT_MS      5000
+
+// One keep-alive HTTPS connection to the update server, shared by the manifest check and the
+// firmware download so an update costs a single TLS handshake. The session outlives a check:
+// when the server has closed the idle connection, the next check reconnects with the saved TLS
+// session ticket (CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS, set in sdkconfig.defaults) instead of a
+// full handshake.
+typedef struct {
+    esp_http_client_handle_t client;
+    char base_url[64];        // scheme://host:port, request paths are appended to it
+    int64_t check_start_us;   // update check started
+    int64_t first_byte_us;    // first firmware byte received, 0 until then
+    int handshakes;           // connections (TLS handshakes) made so far
+    int64_t connect_start_us; // last request started, for timing its handshake
+    uint32_t heap_before;     // free heap when the last request started
+    uint32_t retry_after_ms;  // the last response was 503/429: come back after this long
+    char device_id[13];       // station MAC in hex, sent as X-Device-Id for channel and rollout
+    ota_stats_t stats;        // phases of the current check and update
+    ota_memory_t memory;      // heap and stack of the current check and update
+} ota_session_t;
+
+// Parse the server CA once into the esp-tls global CA store. Every connection made afterwards,
+// by a session or any other client with use_global_ca_store, verifies against the parsed chain.
+esp_err_t ota_session_init_ca(const char *cert_pem, size_t len);
+
+// Every request of the session identifies the device with "X-Device-Id: <MAC>", which the
+// server uses to pick its release channel and rollout stage
+esp_err_t ota_session_open(ota_session_t *s, const char *base_url);
+
+// Start timing a new update check (check to first firmware byte), reset the phase stats and
+// start measuring its memory.
+// Resolves the server, which leaves the address in the lwIP DNS cache for the connect.
+void ota_session_start_check(ota_session_t *s);
+
+// Start a GET of `path`, dropping the per-request headers of the previous request.
+// Set any headers for this request after this call.
+esp_err_t ota_session_request(ota_session_t *s, const char *path);
+
+// Send the request and read the response headers. When the server is throttling downloads
+// (503 or 429) retry_after_ms is set from its Retry-After, otherwise it is 0.
+esp_err_t ota_session_send(ota_session_t *s, int *status, int64_t *content_len);
+
+// Discard the unread rest of the response so the connection can carry the next request
+void ota_session_finish(ota_session_t *s);
+
+// Record the arrival of the first firmware byte (only the first call counts)
+void ota_session_first_byte(ota_session_t *s);
+
+// Log the phase stats of the check and update in one line, and its memory in another
+void ota_session_report(ota_session_t *s, const char *outcome);
+
+void ota_session_close(ota_session_t *s);
+
+#endif /* OTA_SESSION_H */
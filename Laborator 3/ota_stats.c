@@ -0,0 +1,84 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ota_stats.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+
+int64_t ota_stats_now(void)
+{
+    return esp_timer_get_time();
+}
+#else
+// Host build, for host/ota_bench.c
+#include <time.h>
+
+int64_t ota_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+static const char *const s_phase_names[OTA_PHASE_COUNT] = {
+    [OTA_PHASE_DNS] = "dns",
+    [OTA_PHASE_CONNECT] = "connect",
+    [OTA_PHASE_CHECK] = "check",
+    [OTA_PHASE_RECEIVE] = "receive",
+    [OTA_PHASE_PATCH] = "patch",
+    [OTA_PHASE_INFLATE] = "inflate",
+    [OTA_PHASE_VERIFY] = "verify",
+    [OTA_PHASE_ERASE] = "erase",
+    [OTA_PHASE_WRITE] = "write",
+    [OTA_PHASE_FINALIZE] = "finalize",
+};
+
+void ota_stats_reset(ota_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->start_us = ota_stats_now();
+}
+
+void ota_stats_add(ota_stats_t *st, ota_phase_t phase, int64_t us, uint64_t bytes)
+{
+    st->us[phase] += us;
+    st->bytes[phase] += bytes;
+    st->calls[phase]++;
+}
+
+int64_t ota_stats_nested_us(const ota_stats_t *st, uint32_t phase_mask)
+{
+    int64_t us = 0;
+    for (int i = 0; i < OTA_PHASE_COUNT; i++) {
+        if (phase_mask & OTA_PHASE_BIT(i)) {
+            us += st->us[i];
+        }
+    }
+    return us;
+}
+
+size_t ota_stats_format(const ota_stats_t *st, char *buf, size_t len)
+{
+    size_t pos = 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < OTA_PHASE_COUNT && pos < len; i++) {
+        if (st->calls[i] == 0) {
+            continue;
+        }
+        pos += snprintf(buf + pos, len - pos, "%s %" PRId64 " ms", s_phase_names[i], st->us[i] / 1000);
+        if (pos < len && st->bytes[i]) {
+            pos += snprintf(buf + pos, len - pos, " %" PRIu64 " B", st->bytes[i]);
+        }
+        if (pos < len) {
+            pos += snprintf(buf + pos, len - pos, ", ");
+        }
+    }
+    if (pos < len) {
+        pos += snprintf(buf + pos, len - pos, "total %" PRId64 " ms", (ota_stats_now() - st->start_us) / 1000);
+    }
+    return pos < len ? pos : len - 1;
+}
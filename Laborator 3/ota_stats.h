@@ -0,0 +1,48 @@
+#ifndef OTA_STATS_H
+#define OTA_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where an update spends its time. Phases do not nest: time spent erasing or writing flash
+// from inside the decompressor or the patcher counts as erase/write, not inflate/patch.
+// Phases run on the writer task of ota_pipeline.h are timed concurrently with receive, so
+// the phases can add up to more than the total.
+typedef enum {
+    OTA_PHASE_DNS,      // resolving the update server
+    OTA_PHASE_CONNECT,  // TCP connect and TLS handshake
+    OTA_PHASE_CHECK,    // manifest request and response, without connecting
+    OTA_PHASE_RECEIVE,  // esp_http_client_read(): waiting for the network and TLS decryption
+    OTA_PHASE_PATCH,    // applying a delta patch
+    OTA_PHASE_INFLATE,  // decompressing
+    OTA_PHASE_VERIFY,   // hashing chunks against the manifest
+    OTA_PHASE_ERASE,    // flash sector erase
+    OTA_PHASE_WRITE,    // flash write
+    OTA_PHASE_FINALIZE, // esp_ota_end() image validation and boot partition switch
+    OTA_PHASE_COUNT
+} ota_phase_t;
+
+typedef struct {
+    int64_t start_us;                  // ota_stats_reset()
+    int64_t us[OTA_PHASE_COUNT];
+    uint64_t bytes[OTA_PHASE_COUNT];   // bytes handled in the phase (received, written, ...)
+    uint32_t calls[OTA_PHASE_COUNT];
+} ota_stats_t;
+
+void ota_stats_reset(ota_stats_t *st);
+
+// Microsecond clock the phases are measured with
+int64_t ota_stats_now(void);
+
+void ota_stats_add(ota_stats_t *st, ota_phase_t phase, int64_t us, uint64_t bytes);
+
+// Time in phases that are not counted yet would otherwise double count: the total of the
+// given nested phases, to subtract from an enclosing measurement
+int64_t ota_stats_nested_us(const ota_stats_t *st, uint32_t phase_mask);
+
+#define OTA_PHASE_BIT(phase) (1u << (phase))
+
+// One line: every phase that ran with its time and bytes, then the total since reset
+size_t ota_stats_format(const ota_stats_t *st, char *buf, size_t len);
+
+#endif /* OTA_STATS_H */
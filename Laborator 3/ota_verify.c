@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_verify.h"
+
+#if defined(ESP_PLATFORM) && !defined(OTA_VERIFY_SOFTWARE_SHA)
+// mbedTLS takes the SHA accelerator when it is free and falls back to software when another
+// context (a TLS handshake, say) holds it
+#include "mbedtls/sha256.h"
+
+typedef mbedtls_sha256_context sha256_t;
+
+static void sha256_start(sha256_t *ctx)
+{
+    mbedtls_sha256_init(ctx);
+    mbedtls_sha256_starts(ctx, 0);
+}
+
+static void sha256_update(sha256_t *ctx, const uint8_t *buf, size_t len)
+{
+    mbedtls_sha256_update(ctx, buf, len);
+}
+
+static void sha256_finish(sha256_t *ctx, uint8_t digest[OTA_VERIFY_DIGEST_LEN])
+{
+    mbedtls_sha256_finish(ctx, digest);
+    mbedtls_sha256_free(ctx);
+}
+
+#else
+// Portable FIPS 180-4 SHA-256, for targets without the accelerator and the host build
+typedef struct {
+    uint32_t state[8];
+    uint64_t len;
+    uint8_t block[64];
+    size_t fill;
+} sha256_t;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256_t *ctx, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+               ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+static void sha256_start(sha256_t *ctx)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->len = 0;
+    ctx->fill = 0;
+}
+
+static void sha256_update(sha256_t *ctx, const uint8_t *buf, size_t len)
+{
+    ctx->len += len;
+    if (ctx->fill) {
+        size_t n = len < 64 - ctx->fill ? len : 64 - ctx->fill;
+        memcpy(ctx->block + ctx->fill, buf, n);
+        ctx->fill += n;
+        buf += n;
+        len -= n;
+        if (ctx->fill < 64) {
+            return;
+        }
+        sha256_block(ctx, ctx->block);
+        ctx->fill = 0;
+    }
+    // Whole blocks straight from the caller's buffer
+    for (; len >= 64; buf += 64, len -= 64) {
+        sha256_block(ctx, buf);
+    }
+    memcpy(ctx->block, buf, len);
+    ctx->fill = len;
+}
+
+static void sha256_finish(sha256_t *ctx, uint8_t digest[OTA_VERIFY_DIGEST_LEN])
+{
+    uint64_t bits = ctx->len * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t pad_len = (ctx->fill < 56 ? 56 : 120) - ctx->fill;
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = bits >> (56 - 8 * i);
+    }
+    sha256_update(ctx, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = ctx->state[i] >> 24;
+        digest[4 * i + 1] = ctx->state[i] >> 16;
+        digest[4 * i + 2] = ctx->state[i] >> 8;
+        digest[4 * i + 3] = ctx->state[i];
+    }
+}
+#endif
+
+struct ota_verify {
+    sha256_t sha;
+    const uint8_t (*digests)[OTA_VERIFY_DIGEST_LEN];
+    int count;
+    int chunk;        // index of the chunk being hashed
+    size_t fill;      // bytes of it hashed so far
+    bool failed;
+};
+
+// Ends the current chunk's hash and starts the next one, so there is always a context to free
+static bool chunk_matches(ota_verify_t *v)
+{
+    uint8_t digest[OTA_VERIFY_DIGEST_LEN];
+    sha256_finish(&v->sha, digest);
+    sha256_start(&v->sha);
+    return memcmp(digest, v->digests[v->chunk], sizeof(digest)) == 0;
+}
+
+ota_verify_t *ota_verify_new(const uint8_t (*digests)[OTA_VERIFY_DIGEST_LEN], int count, size_t offset)
+{
+    if (offset % OTA_VERIFY_CHUNK_LEN != 0) {
+        return NULL;
+    }
+    ota_verify_t *v = calloc(1, sizeof(*v));
+    if (v == NULL) {
+        return NULL;
+    }
+    v->digests = digests;
+    v->count = count;
+    v->chunk = offset / OTA_VERIFY_CHUNK_LEN;
+    v->failed = v->chunk > count;
+    sha256_start(&v->sha);
+    return v;
+}
+
+int ota_verify_update(ota_verify_t *v, const uint8_t *buf, size_t len)
+{
+    while (len && !v->failed) {
+        if (v->chunk >= v->count) {
+            v->failed = true;
+            break;
+        }
+        size_t n = len < OTA_VERIFY_CHUNK_LEN - v->fill ? len : OTA_VERIFY_CHUNK_LEN - v->fill;
+        sha256_update(&v->sha, buf, n);
+        buf += n;
+        len -= n;
+        v->fill += n;
+        if (v->fill == OTA_VERIFY_CHUNK_LEN) {
+            if (!chunk_matches(v)) {
+                v->failed = true;
+                break;
+            }
+            v->chunk++;
+            v->fill = 0;
+        }
+    }
+    return v->failed ? -1 : 0;
+}
+
+int ota_verify_finish(ota_verify_t *v)
+{
+    if (!v->failed && v->fill) {
+        if (chunk_matches(v)) {
+            v->chunk++;
+            v->fill = 0;
+        } else {
+            v->failed = true;
+        }
+    }
+    if (!v->failed && v->chunk != v->count) {
+        v->failed = true;
+    }
+    return v->failed ? -1 : 0;
+}
+
+int ota_verify_chunk(const ota_verify_t *v)
+{
+    return v->chunk;
+}
+
+void ota_verify_free(ota_verify_t *v)
+{
+    if (v == NULL) {
+        return;
+    }
+    // Releases the accelerator if a chunk was left half hashed
+    uint8_t digest[OTA_VERIFY_DIGEST_LEN];
+    sha256_finish(&v->sha, digest);
+    free(v);
+}
+
+void ota_verify_sha256(const uint8_t *buf, size_t len, uint8_t digest[OTA_VERIFY_DIGEST_LEN])
+{
+    sha256_t sha;
+    sha256_start(&sha);
+    sha256_update(&sha, buf, len);
+    sha256_finish(&sha, digest);
+}
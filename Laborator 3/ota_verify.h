@@ -0,0 +1,39 @@
+#ifndef OTA_VERIFY_H
+#define OTA_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The manifest lists the SHA-256 of every OTA_VERIFY_CHUNK_LEN bytes of the image. Downloads
+// hash the image as it is flashed and stop at the first chunk that does not match, instead of
+// hearing from esp_ota_end() only after the whole image is written. Chunks line up with the
+// resume checkpoints (OTA_RESUME_CHECKPOINT, OTA_INFLATE_SEGMENT_LEN), so a resumed download
+// starts on a chunk boundary.
+#define OTA_VERIFY_CHUNK_LEN  (64 * 1024)
+#define OTA_VERIFY_MAX_CHUNKS 32  // 2 MB image
+#define OTA_VERIFY_DIGEST_LEN 32
+
+typedef struct ota_verify ota_verify_t;
+
+// Check an image against `count` chunk digests from image byte `offset` on, which must be a
+// multiple of OTA_VERIFY_CHUNK_LEN. The digests are not copied.
+ota_verify_t *ota_verify_new(const uint8_t (*digests)[OTA_VERIFY_DIGEST_LEN], int count, size_t offset);
+
+// Hash the next image bytes. Returns -1 once a chunk completed with the wrong digest or the
+// image runs past the last chunk, and from then on.
+int ota_verify_update(ota_verify_t *v, const uint8_t *buf, size_t len);
+
+// The image is complete: check the last, possibly short, chunk and that none is missing
+int ota_verify_finish(ota_verify_t *v);
+
+// Chunk being hashed; after a failure, the one that failed
+int ota_verify_chunk(const ota_verify_t *v);
+
+void ota_verify_free(ota_verify_t *v);
+
+// One-shot SHA-256 on the backend the chunks use: mbedTLS on the device, which runs on the SHA
+// accelerator with CONFIG_MBEDTLS_HARDWARE_SHA, and the portable software implementation on
+// the host or with OTA_VERIFY_SOFTWARE_SHA defined (host/verify_bench.c)
+void ota_verify_sha256(const uint8_t *buf, size_t len, uint8_t digest[OTA_VERIFY_DIGEST_LEN]);
+
+#endif /* OTA_VERIFY_H */
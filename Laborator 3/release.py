@@ -0,0 +1,114 @@
+"""Archive a built firmware image and generate delta patches from earlier releases.
+
+Every build is kept as releases/<version>.bin, next to a compressed copy
+releases/<version>.bin.z that server.py sends to devices asking for "x-zseg": the image
+is cut into 64 KB segments, each stored as a 4 byte big-endian length and an independent
+zlib stream, so an interrupted download can resume at any segment end (ota_inflate.h).
+The compressor window matches OTA_INFLATE_WINDOW_BITS, so the device decompresses with a
+4 KB history. For each earlier release a detools patch
+(heatshrink compressed, the format esp_delta_ota applies) is written to
+releases/patches/<from>-<to>.patch, so server.py can hand a device only the difference
+between the version it runs and the latest one.
+
+Run by versioning.py after PlatformIO builds firmware.bin, or by hand:
+    python release.py .pio/build/esp-wrover-kit/firmware.bin v0.1.5
+"""
+import os
+import shutil
+import struct
+import sys
+import zlib
+
+RELEASES_DIR = 'releases'
+PATCHES_DIR = os.path.join(RELEASES_DIR, 'patches')
+# Older bases are rarely still deployed; keep patch generation time bounded
+MAX_PATCH_BASES = 5
+# Must not exceed OTA_INFLATE_WINDOW_BITS on the device
+COMPRESS_WINDOW_BITS = 12
+# OTA_INFLATE_SEGMENT_LEN on the device
+SEGMENT_LEN = 64 * 1024
+
+
+def release_path(version):
+    return os.path.join(RELEASES_DIR, version + '.bin')
+
+
+def compressed_path(version):
+    return release_path(version) + '.z'
+
+
+def patch_path(from_version, to_version):
+    return os.path.join(PATCHES_DIR, '{}-{}.patch'.format(from_version, to_version))
+
+
+def build_no(version):
+    return int(version.rsplit('.', 1)[1])
+
+
+def previous_releases(version):
+    if not os.path.isdir(RELEASES_DIR):
+        return []
+    versions = [name[:-4] for name in os.listdir(RELEASES_DIR) if name.endswith('.bin')]
+    older = [v for v in versions if v != version and build_no(v) < build_no(version)]
+    return sorted(older, key=build_no)[-MAX_PATCH_BASES:]
+
+
+def create_patch(from_version, to_version):
+    import detools
+
+    with open(release_path(from_version), 'rb') as ffrom, \
+            open(release_path(to_version), 'rb') as fto, \
+            open(patch_path(from_version, to_version), 'wb') as fpatch:
+        detools.create_patch(ffrom, fto, fpatch, compression='heatshrink')
+    return os.path.getsize(patch_path(from_version, to_version))
+
+
+def compress(version):
+    """Size of the compressed image, or None when it is not smaller than the image and was
+    left out: server.py then only offers the image itself"""
+    with open(release_path(version), 'rb') as fin, open(compressed_path(version), 'wb') as fout:
+        while True:
+            segment = fin.read(SEGMENT_LEN)
+            if not segment:
+                break
+            compressor = zlib.compressobj(9, zlib.DEFLATED, COMPRESS_WINDOW_BITS, 9)
+            packed = compressor.compress(segment) + compressor.flush()
+            fout.write(struct.pack('>I', len(packed)))
+            fout.write(packed)
+    size = os.path.getsize(compressed_path(version))
+    if size >= os.path.getsize(release_path(version)):
+        os.remove(compressed_path(version))
+        return None
+    return size
+
+
+def compressed_file(version):
+    """The compressed image of `version`, if it was published and is smaller than the image"""
+    path = compressed_path(version)
+    if os.path.exists(path) and os.path.getsize(path) < os.path.getsize(release_path(version)):
+        return path
+    return None
+
+
+def publish(firmware, version):
+    os.makedirs(PATCHES_DIR, exist_ok=True)
+    shutil.copyfile(firmware, release_path(version))
+    full_size = os.path.getsize(firmware)
+    print('Release {}: {} bytes'.format(version, full_size))
+    size = compress(version)
+    if size is None:
+        print('  compressed: not smaller than the full image, not published')
+    else:
+        print('  compressed: {} bytes ({:.1f}% of full image)'.format(size, 100.0 * size / full_size))
+
+    for base in previous_releases(version):
+        size = create_patch(base, version)
+        print('  patch {} -> {}: {} bytes ({:.1f}% of full image)'.format(
+            base, version, size, 100.0 * size / full_size))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print('usage: python release.py <firmware.bin> <version>')
+        sys.exit(1)
+    publish(sys.argv[1], sys.argv[2])
@@ -1,44 +1,360 @@
-import io
-from flask import Flask, send_file
+import hashlib
+from flask import Flask, send_file, request, abort, jsonify
+import werkzeug.serving
+from werkzeug.serving import WSGIRequestHandler
+import json
 import os.path
+import random
+import selectors
+import ssl
+import threading
+import time
+
+import release
 
 app = Flask(__name__)
 
+FIRMWARE_PATH = os.path.join(".pio", "build", "esp-wrover-kit", "firmware.bin")
+# Version, size and SHA-256 of the build, written by versioning.py
+FIRMWARE_METADATA_PATH = os.path.splitext(FIRMWARE_PATH)[0] + ".json"
+# Compressed encoding of the image, see release.py and ota_inflate.h
+FIRMWARE_ENCODING = "x-zseg"
+
+# The manifest lists the SHA-256 of every CHUNK_LEN bytes of the image so the device can stop
+# a bad download at the first chunk that does not match (OTA_VERIFY_CHUNK_LEN on the device)
+CHUNK_LEN = 64 * 1024
+
+# Release channels and staged rollout. Without this file every device is offered the latest
+# build and downloads are not limited. Devices identify themselves with "X-Device-Id" (their
+# MAC), which picks their channel and their place in a staged rollout:
+#
+#   {
+#     "default": "stable",
+#     "channels": {
+#       "stable": {"version": "v0.1.3", "rollout": 20, "previous": "v0.1.2"},
+#       "beta":   {"version": "v0.1.4"}
+#     },
+#     "devices": {"246f28a1b2c3": "beta"},
+#     "max_downloads": 50,
+#     "retry_after": 30,
+#     "push_spread": 60
+#   }
+#
+# A release reaches `rollout` percent of its channel (100 when absent); the others are offered
+# `previous`, or nothing new. Versions must be published in releases/ (release.py), except
+# the current build. At most `max_downloads` images are sent at once (0 or absent: no limit);
+# past that a device gets 503 with a Retry-After of `retry_after` to twice that many seconds.
+# Devices waiting on /manifest?wait= for a release are answered at random over `push_spread`
+# seconds after it is published, so they do not all start downloading at once.
+CHANNELS_PATH = "channels.json"
+
+# Longest a device may hold /manifest?wait= open; the default spread of a release's answers
+PUSH_MAX_WAIT = 15 * 60
+PUSH_SPREAD = 30
+
+# path -> (mtime, size, sha256 hex, [sha256 hex per CHUNK_LEN]): hashed once per file
+# version, not per request
+digest_cache = {}
+
+def file_hashes(path):
+    st = os.stat(path)
+    cached = digest_cache.get(path)
+    if cached is None or cached[:2] != (st.st_mtime_ns, st.st_size):
+        digest = hashlib.sha256()
+        chunks = []
+        with open(path, 'rb') as f:
+            for block in iter(lambda: f.read(CHUNK_LEN), b''):
+                digest.update(block)
+                chunks.append(hashlib.sha256(block).hexdigest())
+        cached = (st.st_mtime_ns, st.st_size, digest.hexdigest(), chunks)
+        digest_cache[path] = cached
+    return cached
+
+def file_digest(path):
+    return file_hashes(path)[2]
+
+def file_etag(path):
+    return file_digest(path)[:32]
+
+def artifact(path, url):
+    return {"url": url, "size": os.path.getsize(path), "sha256": file_digest(path)}
+
+channels_cache = {}
+
+def load_channels():
+    """channels.json, parsed again only when it changes; None without one"""
+    try:
+        st = os.stat(CHANNELS_PATH)
+    except OSError:
+        return None
+    key = (st.st_mtime_ns, st.st_size)
+    if channels_cache.get("key") != key:
+        with open(CHANNELS_PATH) as f:
+            channels_cache.update(key=key, config=json.load(f))
+    return channels_cache["config"]
+
+def rollout_bucket(device_id, version):
+    """0-99, fixed for a device and release; each release starts with a different group"""
+    return int(hashlib.sha256(f"{device_id}:{version}".encode()).hexdigest()[:8], 16) % 100
+
+def offered_version(config, latest, device_id, base):
+    """Release for a device running `base`; `base` itself when there is nothing new for it"""
+    if config is None:
+        return latest
+    channels = config.get("channels", {})
+    name = config.get("devices", {}).get(device_id, config.get("default", "stable"))
+    channel = channels.get(name) or channels.get(config.get("default", "stable"))
+    if channel is None:
+        return latest
+    version = channel["version"]
+    # Devices that do not identify themselves wait for the release to reach everyone
+    if channel.get("rollout", 100) >= 100 or \
+            (device_id and rollout_bucket(device_id, version) < channel["rollout"]):
+        return version
+    return channel.get("previous") or base
+
+def is_newer(offered, base):
+    """Whether `offered` is an update for a device running `base`"""
+    try:
+        return release.build_no(offered) > release.build_no(base)
+    except (ValueError, IndexError):
+        return offered != base
+
+def push_delay(config):
+    """Seconds before answering a waiting device about a release that was just published"""
+    return random.uniform(0, (config or {}).get("push_spread", PUSH_SPREAD))
+
+class DownloadBudget:
+    """Images being sent at once, across the server's threads"""
+    def __init__(self):
+        self.active = 0
+        self.lock = threading.Lock()
+
+    def acquire(self, limit):
+        with self.lock:
+            if limit and self.active >= limit:
+                return False
+            self.active += 1
+            return True
+
+    def release(self):
+        with self.lock:
+            self.active -= 1
+
+downloads = DownloadBudget()
+
+def retry_after(config):
+    """Seconds a throttled device should wait, spread so retries do not arrive together"""
+    seconds = (config or {}).get("retry_after", 30)
+    return str(seconds + random.randint(0, seconds))
+
+def send_firmware(path):
+    config = load_channels() or {}
+    if not downloads.acquire(config.get("max_downloads", 0)):
+        return app.response_class("Too many downloads, retry later", 503,
+                                  {"Retry-After": retry_after(config)})
+    # Streamed from disk in blocks; conditional=True answers Range, If-Range and If-None-Match,
+    # so an interrupted download resumes where it stopped while the file is unchanged
+    # The slot is only given back when the response closes, so a file replaced or removed
+    # since it was looked up must not keep it
+    try:
+        response = send_file(path, mimetype='application/octet-stream', conditional=True,
+                             etag=file_etag(path), max_age=0)
+    except Exception:
+        downloads.release()
+        raise
+    response.headers["Vary"] = "Accept-Encoding"
+    response.call_on_close(downloads.release)
+    return response
+
+def valid_version(version):
+    return bool(version) and os.path.sep not in version and "/" not in version
+
+def image_file(version):
+    """Plain image of a release: the published copy, or the build itself for the current version"""
+    if not valid_version(version):
+        return None
+    path = release.release_path(version)
+    if os.path.exists(path):
+        return path
+    if version == current_version() and os.path.exists(FIRMWARE_PATH):
+        return FIRMWARE_PATH
+    return None
+
+def firmware_file(accept_encoding, version):
+    """(path or None, Content-Encoding or None) of the image of `version` for /firmware.bin"""
+    # Devices that can inflate while flashing get the compressed image
+    if FIRMWARE_ENCODING in accept_encoding and valid_version(version):
+        path = release.compressed_file(version)
+        if path:
+            return path, FIRMWARE_ENCODING
+    return image_file(version), None
+
+# ?version= is the release the manifest offered; without it, the current build
 @app.route('/firmware.bin')
 def firm():
-    with open(".pio\\build\\esp-wrover-kit\\firmware.bin", 'rb') as bites:
-        print(bites)
-        return send_file(
-                     io.BytesIO(bites.read()),
-                     mimetype='application/octet-stream'
-               )
+    path, encoding = firmware_file(request.headers.get("Accept-Encoding", ""),
+                                   request.args.get("version") or current_version())
+    if path is None:
+        abort(404)
+    response = send_firmware(path)
+    if encoding:
+        response.headers["Content-Encoding"] = encoding
+    return response
 
 @app.route("/")
 def hello():
     return "Hello World!"
 
+def current_version():
+    # The version versioning.py described the build with
+    try:
+        with open(FIRMWARE_METADATA_PATH, "r") as f:
+            return json.load(f)["version"]
+    except (OSError, ValueError, KeyError):
+        pass
+
+    # Fallback to constructing version from build number
+    with open("versioning", "r") as f:
+        build_no = f.readline().strip()
+    return f"v0.1.{build_no}"
+
 # Add a new route to provide version info
 @app.route("/version")
 def version():
     try:
-        # First try to read from versioning file
-        with open("versioning", "r") as f:
-            build_no = f.read().strip()
-        
-        # Try to get the full version from version.h if it exists
-        if os.path.exists("include/version.h"):
-            with open("include/version.h", "r") as f:
-                content = f.read()
-                import re
-                match = re.search(r'VERSION_SHORT\s+"([^"]+)"', content)
-                if match:
-                    return match.group(1)
-        
-        # Fallback to constructing version from build number
-        return f"v0.1.{build_no}"
+        return current_version()
     except Exception as e:
         print(f"Error getting version: {e}")
         return "unknown"
 
+def patch_file(base, latest):
+    """Path of the patch from `base` to `latest`, None if there is none"""
+    if not valid_version(base) or not valid_version(latest):
+        return None
+    path = release.patch_path(base, latest)
+    return path if os.path.exists(path) else None
+
+# Delta from the version the device runs (?from=v0.1.N) to the latest release.
+# 404 when no patch exists for that base; the device then downloads /firmware.bin.
+@app.route("/firmware.patch")
+def firmware_patch():
+    base = request.args.get("from", "")
+    latest = request.args.get("version") or current_version()
+    path = patch_file(base, latest)
+    if path is None:
+        abort(404)
+    response = send_firmware(path)
+    response.headers["X-Delta-Base"] = base
+    response.headers["X-Firmware-Version"] = latest
+    return response
+
+# Everything a device needs to decide on and start an update in one small response:
+# the release offered to it (its channel's, once its rollout stage is reached) and the image,
+# compressed image and (for ?from=<its version>) patch it can download. The ETag is that
+# version, so a device sending its own version in If-None-Match gets an empty 304 when there
+# is nothing new for it. With ?wait=<seconds> the request is held until there is (a long
+# poll): the devices of a fleet block on their open connections instead of polling, and are
+# woken when a release for them is published.
+def manifest_body(latest, base):
+    body = {"version": latest}
+    image = image_file(latest)
+    url = "/firmware.bin?version=" + latest
+    if image:
+        body["image"] = artifact(image, url)
+        # Describe the image bytes, so they also check the compressed and patched downloads
+        body["image"]["chunk_len"] = CHUNK_LEN
+        body["image"]["chunks"] = file_hashes(image)[3]
+    compressed = release.compressed_file(latest) if valid_version(latest) else None
+    if compressed:
+        body["compressed"] = artifact(compressed, url)
+        body["compressed"]["encoding"] = FIRMWARE_ENCODING
+    patch = patch_file(base, latest)
+    if patch:
+        body["delta"] = artifact(patch, "/firmware.patch?from=%s&version=%s" % (base, latest))
+        body["delta"]["from"] = base
+    return body
+
+def held_offer(device_id, base, wait):
+    """offered_version() for a device waiting up to `wait` seconds for something newer. The
+    development server looks at the release files once a second; fleet_server.py wakes its
+    waiting devices when a file changes."""
+    deadline = time.monotonic() + wait
+    waited = False
+    while True:
+        config = load_channels()
+        latest = offered_version(config, current_version(), device_id, base)
+        if is_newer(latest, base) or time.monotonic() >= deadline:
+            break
+        waited = True
+        time.sleep(1)
+    if waited and is_newer(latest, base):
+        time.sleep(max(min(push_delay(config), deadline - time.monotonic()), 0))
+    return latest
+
+@app.route("/manifest")
+def manifest():
+    base = request.args.get("from", "")
+    wait = min(request.args.get("wait", 0, type=int), PUSH_MAX_WAIT)
+    latest = held_offer(request.headers.get("X-Device-Id", ""), base, wait)
+    response = jsonify(manifest_body(latest, base))
+    response.set_etag(latest)
+    response.headers["Cache-Control"] = "no-cache"
+    return response.make_conditional(request)
+
+class KeepAliveHandler(WSGIRequestHandler):
+    """HTTP/1.1 handler that keeps the TLS connection open between the manifest and the
+    firmware download. Werkzeug always answers "Connection: close" because it cannot tell
+    where an unread request body ends; requests without a body (all the device sends) are
+    safe to keep alive."""
+    protocol_version = "HTTP/1.1"
+
+    # Headers and body go out as separate writes; with Nagle on, every response after the
+    # first one waits for the client's delayed ACK
+    disable_nagle_algorithm = True
+    # Idle connections are closed after this long; the device's next check reconnects and
+    # resumes its TLS session
+    timeout = 30
+
+    def setup(self):
+        super().setup()
+        self.log_message("TLS %s, session %s", self.connection.version(),
+                         "resumed" if self.connection.session_reused else "new")
+
+    def send_header(self, keyword, value):
+        has_body = "Content-Length" in self.headers or "Transfer-Encoding" in self.headers
+        if keyword.lower() == "connection" and value.lower() == "close" and not has_body:
+            return
+        super().send_header(keyword, value)
+
+class NoDrainSelectors:
+    """Stands in for the selectors module inside werkzeug.serving, whose only use is
+    discarding whatever the client sent after each response. On a kept-alive connection
+    that is the next request. This relies on Werkzeug internals, hence the pinned version
+    in requirements.txt; the stub is only installed when this file runs as the server."""
+    EVENT_READ = selectors.EVENT_READ
+
+    class DefaultSelector:
+        def register(self, fileobj, events):
+            pass
+
+        def select(self, timeout=None):
+            return []
+
+        def close(self):
+            pass
+
+def tls_context():
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain('ca_cert.pem', 'ca_key.pem')
+    # Session tickets (and OpenSSL's session ID cache, on by default) let a device that
+    # reconnects within the session lifetime, 300 s, skip the certificate chain and the key
+    # exchange
+    context.options &= ~ssl.OP_NO_TICKET
+    return context
+
+# Development server; fleet_server.py serves the same device routes to a whole fleet
 if __name__ == '__main__':
-    app.run(host='0.0.0.0', ssl_context=('ca_cert.pem', 'ca_key.pem'), debug=True)
\ No newline at end of file
+    werkzeug.serving.selectors = NoDrainSelectors
+    app.run(host='0.0.0.0', ssl_context=tls_context(), debug=True,
+            request_handler=KeepAliveHandler)
\ No newline at end of file
@@ -1,30 +1,130 @@
+"""Number the firmware builds and describe each built image for the server.
+
+PlatformIO runs this before every build (extra_scripts = pre:versioning.py). The build
+number in `versioning` goes up only when the firmware sources changed since the number was
+given, so rebuilding unchanged sources keeps the version and builds nothing.
+
+The version is not compiled into the sources: it goes to version.txt, which ESP-IDF uses as
+PROJECT_VER in the image's esp_app_desc_t, along with the build date and time. Only the app
+description is compiled again when it changes, and the firmware reads it at run time
+(include/version.h). That header is written only when its content changes, which is never
+for an unchanged script.
+
+Once firmware.bin is linked, firmware.json is written next to it with the version, size and
+SHA-256 of the image, for server.py, and the image is published with release.py.
+"""
+import datetime
+import hashlib
+import json
+import os
+
 FILENAME_BUILDNO = 'versioning'
 FILENAME_VERSION_H = 'include/version.h'
+FILENAME_VERSION_TXT = 'version.txt'
 version = 'v0.1.'
 
-import datetime
+# What the image is built from; generated files are left out
+SOURCE_DIRS = ['.', 'src', 'include']
+SOURCE_SUFFIXES = ('.c', '.h', '.txt', '.yml', '.pem', '.ini', '.csv')
+SOURCE_NAMES = ('sdkconfig', 'sdkconfig.defaults', 'sdkconfig.defaults.low_ram', 'Kconfig.projbuild')
+GENERATED = {os.path.normpath(FILENAME_VERSION_H), FILENAME_VERSION_TXT}
 
-build_no = 0
-try:
-    with open(FILENAME_BUILDNO) as f:
-        build_no = int(f.readline()) + 1
-except:
-    print('Starting build number from 1..')
-    build_no = 1
-with open(FILENAME_BUILDNO, 'w+') as f:
-    f.write(str(build_no))
-    print('Build number: {}'.format(build_no))
-
-hf = """
-#ifndef BUILD_NUMBER
-  #define BUILD_NUMBER "{}"
-#endif
-#ifndef VERSION
-  #define VERSION "{} - {}"
-#endif
-#ifndef VERSION_SHORT
-  #define VERSION_SHORT "{}"
+VERSION_H = """#ifndef VERSION_H
+#define VERSION_H
+
+// Generated by versioning.py. The version is the image's PROJECT_VER (version.txt), so
+// changing it does not recompile the files that include this header.
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_app_desc.h"
+#define APP_DESCRIPTION() esp_app_get_description()
+#else
+#include "esp_ota_ops.h"
+#define APP_DESCRIPTION() esp_ota_get_app_description()
 #endif
-""".format(build_no, version+str(build_no), datetime.datetime.now(), version+str(build_no))
-with open(FILENAME_VERSION_H, 'w+') as f:
-    f.write(hf)
\ No newline at end of file
+
+#define VERSION_SHORT (APP_DESCRIPTION()->version)
+
+#endif /* VERSION_H */
+"""
+
+
+def write_if_changed(path, content):
+    """Keep the file, and its timestamp, when it already holds `content`"""
+    try:
+        with open(path) as f:
+            if f.read() == content:
+                return False
+    except OSError:
+        pass
+    if os.path.dirname(path):
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        f.write(content)
+    return True
+
+
+def sources_digest():
+    digest = hashlib.sha256()
+    for directory in SOURCE_DIRS:
+        if not os.path.isdir(directory):
+            continue
+        for name in sorted(os.listdir(directory)):
+            path = os.path.normpath(os.path.join(directory, name))
+            if path in GENERATED or not os.path.isfile(path) or \
+                    not (name.endswith(SOURCE_SUFFIXES) or name in SOURCE_NAMES):
+                continue
+            digest.update(path.encode() + b'\0')
+            with open(path, 'rb') as f:
+                digest.update(hashlib.sha256(f.read()).digest())
+    return digest.hexdigest()
+
+
+def next_build_no():
+    """The build number, and the digest of the sources it was given for, on the next line"""
+    sources = sources_digest()
+    try:
+        with open(FILENAME_BUILDNO) as f:
+            build_no = int(f.readline())
+            if f.readline().strip() == sources:
+                return build_no
+            build_no += 1
+    except (OSError, ValueError):
+        print('Starting build number from 1..')
+        build_no = 1
+    with open(FILENAME_BUILDNO, 'w') as f:
+        f.write('{}\n{}\n'.format(build_no, sources))
+    return build_no
+
+
+def write_metadata(firmware, full_version):
+    """firmware.json next to firmware.bin"""
+    with open(firmware, 'rb') as f:
+        image = f.read()
+    metadata = {
+        'version': full_version,
+        'build': int(full_version.rsplit('.', 1)[1]),
+        'size': len(image),
+        'sha256': hashlib.sha256(image).hexdigest(),
+        'built': datetime.datetime.now().isoformat(timespec='seconds'),
+    }
+    with open(os.path.splitext(firmware)[0] + '.json', 'w') as f:
+        json.dump(metadata, f, indent=1)
+        f.write('\n')
+
+
+build_no = next_build_no()
+print('Build number: {}'.format(build_no))
+write_if_changed(FILENAME_VERSION_TXT, version + str(build_no) + '\n')
+write_if_changed(FILENAME_VERSION_H, VERSION_H)
+
+# Under PlatformIO, describe and archive the image and build delta patches once firmware.bin
+# is linked; an up to date firmware.bin is left alone
+try:
+    Import("env")
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin",
+                      lambda target, source, env: write_metadata(str(target[0]), version + str(build_no)))
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin",
+                      '"$PYTHONEXE" release.py "$BUILD_DIR/${PROGNAME}.bin" ' + version + str(build_no))
+except NameError:
+    pass